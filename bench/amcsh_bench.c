@@ -0,0 +1,307 @@
+// Shell benchmark: runs each workload under amcsh and any other shells found,
+// timing whole shell processes with CLOCK_MONOTONIC and wait4 rusage.
+// Usage: amcsh_bench [-n runs] [-w warmup] [-o results.jsonl] [-s shell]... [workload...]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdbool.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifndef AMCSH_BENCH_SHELL
+#define AMCSH_BENCH_SHELL "./amcsh"
+#endif
+
+#define MAX_SHELLS 8
+
+extern char **environ;
+
+// A workload is either a -c string or a script fed on stdin: line repeated count times
+typedef struct {
+    const char *name;
+    const char *description;
+    const char *command;   // Run as "shell -c command" when set
+    const char *line;
+    int count;
+} workload_t;
+
+static const workload_t workloads[] = {
+    {"startup", "shell -c exit", "exit", NULL, 0},
+    {"builtin", "1000 x echo", NULL, "echo test\n", 1000},
+    {"utility", "500 x test and printf", NULL, "test -d /\nprintf '%s %d\\n' x 1 >/dev/null\n", 500},
+    {"spawn", "200 x external /bin/true", NULL, "/bin/true\n", 200},
+    {"pipeline", "20 x three-stage pipeline", NULL, "ls -la /usr/bin | grep a | cat >/dev/null\n", 20},
+    {"subst", "500 x command substitution", NULL, "echo $(echo nested) >/dev/null\n", 500},
+};
+
+#define WORKLOAD_COUNT ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+typedef struct {
+    double wall_ms;
+    double cpu_ms;
+    long maxrss_kb;
+} sample_t;
+
+typedef struct {
+    int runs;            // Samples kept after outlier rejection
+    int outliers;
+    double median;
+    double ci_low;       // 95% confidence interval of the median
+    double ci_high;
+    double p99;
+    double mean;
+    double cpu_ms;       // Medians of the kept runs
+    long maxrss_kb;
+} stats_t;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_long(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+// Linear interpolation between order statistics of a sorted array
+static double percentile(const double *sorted, int n, double q) {
+    double pos = q * (n - 1);
+    int i = (int)pos;
+    return i + 1 < n ? sorted[i] + (pos - i) * (sorted[i + 1] - sorted[i]) : sorted[n - 1];
+}
+
+// Script for a stdin workload, written once to an unlinked temporary file
+static int make_script(const workload_t *w) {
+    char path[] = "/tmp/amcsh_bench.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+
+    size_t len = strlen(w->line);
+    for (int i = 0; i < w->count; i++) {
+        if (write(fd, w->line, len) != (ssize_t)len) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// One shell process, from spawn to reap; stdin is the script, output discarded
+static int run_once(const char *shell, const workload_t *w, int script, int null_fd,
+                    sample_t *sample) {
+    char *argv[] = {(char *)shell, NULL, NULL, NULL};
+    if (w->command) {
+        argv[1] = "-c";
+        argv[2] = (char *)w->command;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, script >= 0 ? script : null_fd, STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, null_fd, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, null_fd, STDERR_FILENO);
+    if (script >= 0) {
+        lseek(script, 0, SEEK_SET);
+    }
+
+    pid_t pid;
+    double start = now_ms();
+    int err = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0 && errno == EINTR);
+    sample->wall_ms = now_ms() - start;
+    sample->cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+                     (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+    sample->maxrss_kb = ru.ru_maxrss;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Tukey's fences drop runs disturbed by the rest of the system; the median's
+// confidence interval comes from binomial order statistics, so no
+// distribution is assumed
+static void summarize(const sample_t *samples, int n, stats_t *stats) {
+    double *wall = malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++) wall[i] = samples[i].wall_ms;
+    qsort(wall, n, sizeof(double), compare_double);
+
+    double q1 = percentile(wall, n, 0.25), q3 = percentile(wall, n, 0.75);
+    double low = q1 - 1.5 * (q3 - q1), high = q3 + 1.5 * (q3 - q1);
+
+    double *kept = malloc(n * sizeof(double));
+    double *cpu = malloc(n * sizeof(double));
+    long *rss = malloc(n * sizeof(long));
+    int k = 0;
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        if (samples[i].wall_ms < low || samples[i].wall_ms > high) continue;
+        kept[k] = samples[i].wall_ms;
+        cpu[k] = samples[i].cpu_ms;
+        rss[k] = samples[i].maxrss_kb;
+        sum += kept[k++];
+    }
+    qsort(kept, k, sizeof(double), compare_double);
+    qsort(cpu, k, sizeof(double), compare_double);
+    qsort(rss, k, sizeof(long), compare_long);
+
+    double half = 1.96 * sqrt(k) / 2;
+    int lo = (int)floor(k / 2.0 - half), hi = (int)ceil(k / 2.0 + half);
+    if (lo < 0) lo = 0;
+    if (hi > k - 1) hi = k - 1;
+
+    stats->runs = k;
+    stats->outliers = n - k;
+    stats->median = percentile(kept, k, 0.5);
+    stats->ci_low = kept[lo];
+    stats->ci_high = kept[hi];
+    stats->p99 = percentile(kept, k, 0.99);
+    stats->mean = sum / k;
+    stats->cpu_ms = percentile(cpu, k, 0.5);
+    stats->maxrss_kb = rss[k / 2];
+
+    free(wall);
+    free(kept);
+    free(cpu);
+    free(rss);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: amcsh_bench [-n runs] [-w warmup] [-o results.jsonl] "
+                    "[-s shell]... [workload...]\nWorkloads:\n");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        fprintf(stderr, "  %-10s %s\n", workloads[i].name, workloads[i].description);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 50, warmup = 5;
+    const char *output = NULL;
+    const char *shells[MAX_SHELLS];
+    int shell_count = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:o:s:h")) != -1) {
+        switch (opt) {
+            case 'n': runs = atoi(optarg); break;
+            case 'w': warmup = atoi(optarg); break;
+            case 'o': output = optarg; break;
+            case 's':
+                if (shell_count < MAX_SHELLS) shells[shell_count++] = optarg;
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (runs < 4) {
+        fprintf(stderr, "amcsh_bench: need at least 4 runs\n");
+        return 2;
+    }
+
+    // amcsh against whichever reference shells are installed
+    if (shell_count == 0) {
+        static const char *defaults[] = {AMCSH_BENCH_SHELL, "/bin/bash", "/bin/dash"};
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++) {
+            if (access(defaults[i], X_OK) == 0) shells[shell_count++] = defaults[i];
+        }
+    }
+
+    bool selected[WORKLOAD_COUNT];
+    for (int i = 0; i < WORKLOAD_COUNT; i++) selected[i] = optind == argc;
+    for (int a = optind; a < argc; a++) {
+        int i = 0;
+        while (i < WORKLOAD_COUNT && strcmp(argv[a], workloads[i].name) != 0) i++;
+        if (i == WORKLOAD_COUNT) {
+            fprintf(stderr, "amcsh_bench: unknown workload '%s'\n", argv[a]);
+            usage();
+            return 2;
+        }
+        selected[i] = true;
+    }
+
+    FILE *json = NULL;
+    if (output && !(json = fopen(output, "a"))) {
+        perror(output);
+        return 1;
+    }
+
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    sample_t *samples = malloc(runs * sizeof(sample_t));
+    time_t started = time(NULL);
+
+    printf("%-10s %-16s %5s %4s %9s %21s %9s %9s %9s\n", "workload", "shell", "runs", "out",
+           "median_ms", "95% CI", "p99_ms", "cpu_ms", "rss_kb");
+    for (int w = 0; w < WORKLOAD_COUNT; w++) {
+        if (!selected[w]) continue;
+        const workload_t *load = &workloads[w];
+        int script = load->command ? -1 : make_script(load);
+        if (!load->command && script < 0) {
+            perror("amcsh_bench: script");
+            continue;
+        }
+
+        for (int s = 0; s < shell_count; s++) {
+            const char *name = strrchr(shells[s], '/') ? strrchr(shells[s], '/') + 1 : shells[s];
+            int status = 0;
+            for (int i = 0; i < warmup && status == 0; i++) {
+                sample_t ignored;
+                status = run_once(shells[s], load, script, null_fd, &ignored);
+            }
+            for (int i = 0; i < runs && status == 0; i++) {
+                status = run_once(shells[s], load, script, null_fd, &samples[i]);
+            }
+            if (status != 0) {
+                // A shell that cannot run the workload has no meaningful time
+                printf("%-10s %-16s %s\n", load->name, name,
+                       status < 0 ? strerror(errno) : "failed");
+                continue;
+            }
+
+            stats_t st;
+            summarize(samples, runs, &st);
+            printf("%-10s %-16s %5d %4d %9.3f [%8.3f, %9.3f] %9.3f %9.3f %9ld\n",
+                   load->name, name, st.runs, st.outliers, st.median, st.ci_low, st.ci_high,
+                   st.p99, st.cpu_ms, st.maxrss_kb);
+            fflush(stdout);
+
+            if (json) {
+                fprintf(json, "{\"time\":%lld,\"workload\":\"%s\",\"shell\":\"%s\","
+                        "\"runs\":%d,\"outliers\":%d,\"median_ms\":%.4f,\"ci_low_ms\":%.4f,"
+                        "\"ci_high_ms\":%.4f,\"p99_ms\":%.4f,\"mean_ms\":%.4f,"
+                        "\"cpu_ms\":%.4f,\"maxrss_kb\":%ld}\n",
+                        (long long)started, load->name, shells[s], st.runs, st.outliers,
+                        st.median, st.ci_low, st.ci_high, st.p99, st.mean, st.cpu_ms,
+                        st.maxrss_kb);
+            }
+        }
+        if (script >= 0) close(script);
+    }
+
+    if (json) fclose(json);
+    free(samples);
+    close(null_fd);
+    return 0;
+}
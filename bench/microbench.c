@@ -0,0 +1,372 @@
+// Subsystem microbenchmarks: parser, command cache, completion trie,
+// highlighting, history and thread pool, in ns/op and heap allocations/op.
+// Usage: amcsh_microbench [filter]
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "highlight.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static amcsh_state_t bench_state;
+
+// Every heap allocation in the process, counted by interposing on malloc
+static atomic_ulong allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+#define MIN_TIME_NS 200000000ull   // Each benchmark runs for at least 0.2s
+
+static const char *filter;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+typedef void (*bench_fn_t)(void *ctx, long iterations);
+
+// Run fn in growing batches until it has run long enough, then report per op
+static void bench(const char *name, bench_fn_t fn, void *ctx) {
+    if (filter && !strstr(name, filter)) {
+        return;
+    }
+    fn(ctx, 1); // Warm caches and lazy initialization
+
+    long iterations = 1;
+    uint64_t elapsed;
+    unsigned long allocs;
+    for (;;) {
+        unsigned long before = atomic_load(&allocations);
+        uint64_t start = now_ns();
+        fn(ctx, iterations);
+        elapsed = now_ns() - start;
+        allocs = atomic_load(&allocations) - before;
+        if (elapsed >= MIN_TIME_NS || iterations >= (1L << 30)) {
+            break;
+        }
+        // Aim just past the minimum time from the batch so far
+        long next = elapsed ? (long)(iterations * 1.2 * MIN_TIME_NS / elapsed) : iterations * 100;
+        iterations = next > iterations * 100 ? iterations * 100 : next > iterations ? next : iterations * 2;
+    }
+    printf("%-36s %12ld %12.1f %12.2f\n", name, iterations,
+           (double)elapsed / iterations, (double)allocs / iterations);
+    fflush(stdout);
+}
+
+// Parser
+
+static void bench_parse(void *ctx, long iterations) {
+    const char *line = ctx;
+    size_t len = strlen(line);
+    char buffer[AMCSH_MAX_CMD_LENGTH];
+    for (long i = 0; i < iterations; i++) {
+        memcpy(buffer, line, len + 1);
+        amcsh_command_t cmd;
+        amcsh_command_init(&cmd, buffer);
+        amcsh_parse_command(&cmd);
+        amcsh_command_free(&cmd);
+    }
+}
+
+// Command cache
+
+#define CACHE_NAMES 64
+
+static void bench_cache_hit(void *ctx, long iterations) {
+    (void)ctx;
+    char name[32];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(name, sizeof(name), "cmd%ld", i % CACHE_NAMES);
+        free(amcsh_cache_lookup(name));
+    }
+}
+
+static void bench_cache_miss(void *ctx, long iterations) {
+    (void)ctx;
+    char name[32];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(name, sizeof(name), "missing%ld", i % CACHE_NAMES);
+        free(amcsh_cache_lookup(name));
+    }
+}
+
+static void bench_cache_update(void *ctx, long iterations) {
+    (void)ctx;
+    char name[32];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(name, sizeof(name), "cmd%ld", i % CACHE_NAMES);
+        amcsh_cache_update(name, "/usr/bin/placeholder");
+    }
+}
+
+typedef struct {
+    bench_fn_t fn;
+    long iterations;
+} thread_job_t;
+
+static void *run_thread_job(void *arg) {
+    thread_job_t *job = arg;
+    amcsh_current_state = &bench_state;
+    job->fn(NULL, job->iterations);
+    return NULL;
+}
+
+// Hit lookups on every thread, with one thread also updating
+static void bench_cache_contended(void *ctx, long iterations) {
+    int threads = *(int *)ctx;
+    pthread_t ids[16];
+    thread_job_t jobs[16];
+    for (int t = 0; t < threads; t++) {
+        jobs[t].fn = t == 0 && threads > 1 ? bench_cache_update : bench_cache_hit;
+        jobs[t].iterations = iterations / threads + 1;
+        pthread_create(&ids[t], NULL, run_thread_job, &jobs[t]);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+    }
+}
+
+// Completion trie
+
+typedef struct {
+    amcsh_trie_node_t *root;
+    char **words;
+    int count;
+} trie_ctx_t;
+
+static void bench_trie_insert(void *ctx, long iterations) {
+    trie_ctx_t *trie = ctx;
+    for (long i = 0; i < iterations; i++) {
+        amcsh_trie_insert(trie->root, trie->words[i % trie->count]);
+    }
+}
+
+static void bench_trie_search(void *ctx, long iterations) {
+    trie_ctx_t *trie = ctx;
+    static const char *prefixes[] = {"g", "py", "ls", "xz", "nomatch"};
+    for (long i = 0; i < iterations; i++) {
+        int matches;
+        amcsh_trie_search(trie->root, prefixes[i % 5], &matches);
+    }
+}
+
+// Highlighting: one keystroke on a long pasted line, from edit to the
+// escaped text the line editor paints
+
+typedef struct {
+    amcsh_highlight_t hl;
+    char *line;
+    size_t len;
+    size_t at;             // Where keys land
+} highlight_ctx_t;
+
+static void highlight_key(highlight_ctx_t *ctx, long i) {
+    // Type a character, then delete it, so the line stays the same size
+    if (i % 2 == 0) {
+        memmove(ctx->line + ctx->at + 1, ctx->line + ctx->at, ctx->len - ctx->at + 1);
+        ctx->line[ctx->at] = 'x';
+        ctx->len++;
+    } else {
+        memmove(ctx->line + ctx->at, ctx->line + ctx->at + 1, ctx->len - ctx->at);
+        ctx->len--;
+    }
+    size_t from, to, len;
+    if (amcsh_highlight_update(&ctx->hl, ctx->line, ctx->len, &from, &to)) {
+        amcsh_highlight_render(&ctx->hl, from, to, &len);
+    }
+}
+
+static void bench_highlight(void *ctx, long iterations) {
+    for (long i = 0; i < iterations; i++) {
+        highlight_key(ctx, i);
+    }
+}
+
+static void bench_highlight_size(size_t size, const char *label, size_t at_percent) {
+    static const char *pieces[] = {
+        "grep -n 'some pattern' ./src/main.c | sort -u > /tmp/out.txt && ",
+        "echo \"$HOME/x\" $(date +%s) ${USER} 2>/dev/null; ",
+        "nosuchcommand --flag < ./missing/input || ",
+    };
+    highlight_ctx_t ctx;
+    amcsh_highlight_init(&ctx.hl);
+    ctx.line = malloc(size + 128);
+    ctx.len = 0;
+    for (int i = 0; ctx.len < size; i++) {
+        const char *piece = pieces[i % 3];
+        memcpy(ctx.line + ctx.len, piece, strlen(piece));
+        ctx.len += strlen(piece);
+    }
+    ctx.line[ctx.len] = '\0';
+    size_t from, to;
+    amcsh_highlight_update(&ctx.hl, ctx.line, ctx.len, &from, &to);
+    ctx.at = ctx.len * at_percent / 100;
+    bench(label, bench_highlight, &ctx);
+    amcsh_highlight_free(&ctx.hl);
+    free(ctx.line);
+}
+
+// History
+
+static long history_next;
+
+static void bench_history_add(void *ctx, long iterations) {
+    (void)ctx;
+    char line[64];
+    for (long i = 0; i < iterations; i++) {
+        snprintf(line, sizeof(line), "make -j8 target%ld\n", history_next++);
+        amcsh_history_add(line);
+    }
+}
+
+static void bench_history_search(void *ctx, long iterations) {
+    (void)ctx;
+    for (long i = 0; i < iterations; i++) {
+        int count;
+        char **results = amcsh_history_search("target12345", &count);
+        for (int r = 0; r < count; r++) free(results[r]);
+        free(results);
+    }
+}
+
+// History is process-wide, so each size runs in its own child
+static void bench_history_size(long size) {
+    char add_label[64], search_label[64];
+    snprintf(add_label, sizeof(add_label), "history_add/%ld", size);
+    snprintf(search_label, sizeof(search_label), "history_search/%ld", size);
+    if (filter && !strstr(add_label, filter) && !strstr(search_label, filter)) {
+        return;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char capacity[32];
+        snprintf(capacity, sizeof(capacity), "%ld", size);
+        setenv("AMCSH_HISTORY_SIZE", capacity, 1);
+        setenv("HOME", "/nonexistent", 1);
+        bench_history_add(NULL, size); // Fill to capacity: every timed add evicts
+
+        bench(add_label, bench_history_add, NULL);
+        bench(search_label, bench_history_search, NULL);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+// Thread pool: time from submit until the task starts running
+
+typedef struct {
+    atomic_ullong started;
+    atomic_int done;
+} pool_probe_t;
+
+static void *pool_probe_task(void *arg) {
+    pool_probe_t *probe = arg;
+    atomic_store(&probe->started, now_ns());
+    atomic_store(&probe->done, 1);
+    return NULL;
+}
+
+static uint64_t pool_latency_total;
+
+static void bench_pool_latency(void *ctx, long iterations) {
+    amcsh_thread_pool_t *pool = ctx;
+    for (long i = 0; i < iterations; i++) {
+        pool_probe_t probe = {0, 0};
+        uint64_t submitted = now_ns();
+        amcsh_thread_pool_submit(pool, pool_probe_task, &probe);
+        while (!atomic_load(&probe.done)) {
+            sched_yield();
+        }
+        pool_latency_total += atomic_load(&probe.started) - submitted;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    filter = argc > 1 ? argv[1] : NULL;
+
+    amcsh_current_state = &bench_state;
+    amcsh_state_init(&bench_state);
+
+    printf("%-36s %12s %12s %12s\n", "benchmark", "iterations", "ns/op", "allocs/op");
+
+    bench("parse/simple", bench_parse, "ls -la /usr/bin\n");
+    bench("parse/quoted", bench_parse, "printf '%s\\n' \"$HOME/a b\" 'x y' z\n");
+    bench("parse/pipeline", bench_parse, "cat f.txt | grep -v foo | sort | uniq -c\n");
+    bench("parse/redirect", bench_parse, "sort < /dev/null > /dev/null\n");
+
+    char name[32];
+    for (int i = 0; i < CACHE_NAMES; i++) {
+        snprintf(name, sizeof(name), "cmd%d", i);
+        amcsh_cache_update(name, "/usr/bin/placeholder");
+    }
+    bench("cache/lookup_hit", bench_cache_hit, NULL);
+    bench("cache/lookup_miss", bench_cache_miss, NULL);
+    bench("cache/update", bench_cache_update, NULL);
+    static int thread_counts[] = {2, 4, 8};
+    for (int t = 0; t < 3; t++) {
+        snprintf(name, sizeof(name), "cache/contended_%dthreads", thread_counts[t]);
+        bench(name, bench_cache_contended, &thread_counts[t]);
+    }
+
+    // Command-like words: a spread of prefixes as in a real PATH
+    trie_ctx_t trie = {calloc(1, sizeof(amcsh_trie_node_t)), NULL, 4096};
+    trie.words = malloc(trie.count * sizeof(char *));
+    static const char *stems[] = {"git", "gcc", "grep", "python", "ls", "lsof", "xz", "make"};
+    for (int i = 0; i < trie.count; i++) {
+        char word[32];
+        snprintf(word, sizeof(word), "%s%d", stems[i % 8], i);
+        trie.words[i] = strdup(word);
+    }
+    bench("trie/insert", bench_trie_insert, &trie);
+    bench("trie/search", bench_trie_search, &trie);
+
+    bench_highlight_size(10240, "highlight/key_middle_10k", 50);
+    bench_highlight_size(10240, "highlight/key_end_10k", 100);
+    bench_highlight_size(200, "highlight/key_middle_200", 50);
+
+    bench_history_size(1000);
+    bench_history_size(100000);
+    bench_history_size(1000000);
+
+    amcsh_thread_pool_t pool;
+    amcsh_thread_pool_init(&pool, &bench_state);
+    pool_latency_total = 0;
+    if (!filter || strstr("pool/submit_to_run", filter)) {
+        bench_pool_latency(&pool, 100); // Start the workers
+        pool_latency_total = 0;
+        long runs = 20000;
+        unsigned long before = atomic_load(&allocations);
+        bench_pool_latency(&pool, runs);
+        printf("%-36s %12ld %12.1f %12.2f\n", "pool/submit_to_run", runs,
+               (double)pool_latency_total / runs,
+               (double)(atomic_load(&allocations) - before) / runs);
+    }
+    amcsh_thread_pool_shutdown(&pool);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Spawn latency of each backend as the shell's resident set grows.
+// Usage: spawn_bench [iterations] [rss_mb...]
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 500;
+    static const int default_sizes[] = {0, 64, 256, 1024};
+    int size_count = argc > 2 ? argc - 2 : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+
+    char path[PATH_MAX];
+    if (amcsh_spawn_resolve("true", path, sizeof(path)) != 0) {
+        fprintf(stderr, "spawn_bench: true: not found\n");
+        return 1;
+    }
+
+    double *samples = malloc(iterations * sizeof(double));
+    char *child_argv[] = {"true", NULL};
+
+    printf("%8s  %-6s  %10s  %10s  %10s\n", "rss_mb", "spawn", "mean_us", "p50_us", "p99_us");
+    for (int s = 0; s < size_count; s++) {
+        size_t mb = argc > 2 ? strtoul(argv[s + 2], NULL, 10) : (size_t)default_sizes[s];
+
+        // Touch every page so it is resident and has to be mapped by fork-like paths
+        char *ballast = mb ? malloc(mb << 20) : NULL;
+        if (mb && !ballast) {
+            fprintf(stderr, "spawn_bench: cannot allocate %zu MB\n", mb);
+            continue;
+        }
+        if (ballast) memset(ballast, 1, mb << 20);
+
+        for (int b = 0; b < AMCSH_SPAWN_BACKEND_COUNT; b++) {
+            amcsh_spawn_set_backend((amcsh_spawn_backend_t)b);
+
+            amcsh_spawn_req_t req;
+            amcsh_spawn_req_init(&req, child_argv);
+            req.path = path;
+
+            double total = 0;
+            int done = 0;
+            for (int i = 0; i < iterations; i++) {
+                double start = now_us();
+                pid_t pid = amcsh_spawn_process(&req, NULL);
+                if (pid < 0) {
+                    fprintf(stderr, "spawn_bench: %s: %s\n",
+                            amcsh_spawn_backend_name(b), strerror(errno));
+                    break;
+                }
+                samples[done] = now_us() - start;
+                total += samples[done++];
+                waitpid(pid, NULL, 0);
+            }
+            if (done == 0) continue;
+
+            qsort(samples, done, sizeof(double), compare_double);
+            printf("%8zu  %-6s  %10.1f  %10.1f  %10.1f\n", mb, amcsh_spawn_backend_name(b),
+                   total / done, samples[done / 2], samples[done * 99 / 100]);
+        }
+        free(ballast);
+    }
+
+    free(samples);
+    return 0;
+}
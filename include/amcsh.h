@@ -2,16 +2,28 @@
 #define AMCSH_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
 #include <histedit.h>
+#include "builtins.h"
 
 #define AMCSH_VERSION "0.1.0"
 #define AMCSH_MAX_ARGS 256
 #define AMCSH_MAX_CMD_LENGTH 4096
+#define AMCSH_MAX_PROCSUBS 8
 #define AMCSH_HISTORY_SIZE 1000
 #define AMCSH_MAX_THREADS 4
+#define AMCSH_MAX_DONE_JOBS 64        // Finished jobs a script keeps for "jobs"
 #define AMCSH_CMD_CACHE_SIZE 128
+#define AMCSH_OUTPUT_BUFFER_SIZE 65536
+#define AMCSH_OUTPUT_MAX_IOV 64
+#define AMCSH_PROMPT_DEADLINE_MS 20    // Wait for slow prompt segments before drawing
+#define AMCSH_PROMPT_SHOW_DURATION 2.0 // Seconds a command must take to be shown
 
 // Command cache entry
 typedef struct {
@@ -26,6 +38,8 @@ typedef struct {
 typedef struct amcsh_worker {
     pthread_t thread;
     bool active;
+    bool busy;             // Running a task
+    bool started;          // Thread created; workers start on first use
     void *(*task)(void *);
     void *args;
     struct amcsh_thread_pool *thread_pool;
@@ -37,22 +51,144 @@ typedef struct amcsh_thread_pool {
     pthread_mutex_t queue_mutex;
     pthread_cond_t queue_cond;
     bool shutdown;
+    struct amcsh_state *owner;  // Shell state the workers' tasks run against
 } amcsh_thread_pool_t;
 
+// Bump allocator for per-command data (expanded words, captured output)
+typedef struct amcsh_arena_block {
+    struct amcsh_arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} amcsh_arena_block_t;
+
+// Malloc'd buffer handed over to an arena, freed along with it
+typedef struct amcsh_arena_owned {
+    struct amcsh_arena_owned *next;
+    void *ptr;
+} amcsh_arena_owned_t;
+
+typedef struct {
+    amcsh_arena_block_t *head;  // Most recent block first
+    amcsh_arena_owned_t *owned; // Adopted buffers
+} amcsh_arena_t;
+
+// Here-document waiting for its body
+typedef struct amcsh_heredoc {
+    char *delimiter;        // Terminating line
+    bool strip_tabs;        // <<- strips leading tabs
+    bool expand;            // Unquoted delimiter: expand $ and `
+    bool is_stdin;          // Still the last input redirection
+    struct amcsh_heredoc *next;
+} amcsh_heredoc_t;
+
+// Supplies continuation lines (here-document bodies); NULL at end of input
+typedef const char *(*amcsh_line_reader_t)(void *ctx);
+
+// How external commands are started (AMCSH_SPAWN=posix|vfork|clone)
+typedef enum {
+    AMCSH_SPAWN_POSIX,     // posix_spawn
+    AMCSH_SPAWN_VFORK,     // vfork + execve
+    AMCSH_SPAWN_CLONE,     // clone(CLONE_VM | CLONE_VFORK | CLONE_PIDFD) + execve
+    AMCSH_SPAWN_BACKEND_COUNT
+} amcsh_spawn_backend_t;
+
+#define AMCSH_SPAWN_MAX_RLIMITS 8
+#define AMCSH_SPAWN_MAX_CPUS 1024
+
+// Per-child settings applied between clone and exec
+typedef struct {
+    bool has_affinity;
+    unsigned long affinity[AMCSH_SPAWN_MAX_CPUS / (8 * sizeof(unsigned long))]; // cpu_set_t layout
+    bool has_nice;
+    int nice;
+    int rlimit_count;
+    struct {
+        int resource;
+        struct rlimit limit;
+    } rlimits[AMCSH_SPAWN_MAX_RLIMITS];
+} amcsh_spawn_attr_t;
+
+// One process to start
+typedef struct {
+    const char *path;      // Executable, already resolved against PATH
+    char **argv;
+    char **envp;
+    int fds[3];            // Duplicated onto fds 0-2 when >= 0
+    int close_from;        // Close every fd from this one up (0: keep them)
+    const int *inherit;    // Kept open at their own numbers (/dev/fd arguments)
+    int inherit_count;
+    bool set_pgid;
+    pid_t pgid;            // Group to join; 0 makes the child a group leader
+    const amcsh_spawn_attr_t *attr; // Optional affinity, priority and limits
+} amcsh_spawn_req_t;
+
 // Command structure
 typedef struct amcsh_command {
     char *raw_cmd;          // Raw command string
     char **argv;           // Command arguments
     int argc;              // Number of arguments
+    int argv_capacity;     // Allocated argv slots
+    const amcsh_builtin_t *builtin; // Registry entry for argv[0], resolved at parse time
+    bool external_only;    // "command -p": skip optional builtins
     int redirect_in;       // Input redirection fd
     int redirect_out;      // Output redirection fd
     bool append_out;       // Append to output file?
+    int redirect_err;      // Error redirection fd
+    bool err_to_out;       // 2>&1: stderr follows the pipe or inherited stdout
+    bool redirect_failed;  // A redirection could not be opened: do not run
     int pipe_read;        // Read end of pipe
     int pipe_write;       // Write end of pipe
     bool background;      // Run in background?
-    struct amcsh_command *next; // Next command in sequence
+    bool timed;           // "time" keyword: report resource usage
+    bool time_posix;      // "time -p": POSIX output format
+    pid_t pgid;           // Process group to join (0: start a new one)
+    amcsh_spawn_attr_t *spawn_attr; // Affinity, priority and limits from prefixes
+    char *group;          // Body of a ( ) or { } group, run instead of argv
+    bool subshell;        // The group is ( ): its changes stay inside it
+    struct amcsh_command *next; // Next stage of a pipeline
+    amcsh_heredoc_t *heredocs;  // Bodies still to be read, in order
+    int procsub_fds[AMCSH_MAX_PROCSUBS];   // This shell's ends of <( ) and >( )
+    pid_t procsub_pids[AMCSH_MAX_PROCSUBS];
+    int procsub_count;
+    int job_log;          // Write end of a background job's output log, or -1
+    amcsh_arena_t arena;  // Storage for expanded words
 } amcsh_command_t;
 
+// Buffered builtin output, flushed with one writev per buffer
+typedef struct amcsh_output {
+    int fd;                // Destination, or -1 to collect in memory
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool failed;           // Write error (usually EPIPE); later output is dropped
+} amcsh_output_t;
+
+// Builtin standard streams saved by amcsh_io_enter
+typedef struct {
+    amcsh_output_t *out;
+    int in;
+} amcsh_io_t;
+
+// A forked subshell's builtin output, set up by amcsh_child_enter
+typedef struct {
+    amcsh_output_t out;
+    amcsh_io_t saved;
+    char buf[AMCSH_OUTPUT_BUFFER_SIZE];
+} amcsh_child_t;
+
+// Resource usage summed over every process of a job
+typedef struct {
+    double real;           // Wall-clock seconds
+    double user;           // CPU seconds in user mode
+    double sys;            // CPU seconds in the kernel
+    long maxrss;           // Largest resident set of any process, KB
+    long minflt;           // Page faults served without I/O
+    long majflt;           // Page faults that needed I/O
+    long nvcsw;            // Voluntary context switches
+    long nivcsw;           // Involuntary context switches
+} amcsh_usage_t;
+
 // Job status
 typedef enum {
     JOB_RUNNING,
@@ -63,15 +199,23 @@ typedef enum {
 // Job control structure
 typedef struct amcsh_job {
     pid_t pgid;             // Process group ID
+    int number;             // %N: numbered in creation order, as in other shells
     char *command;          // Command string
     amcsh_job_status_t status;  // Job status
     int exit_status;        // Status of the job
+    pid_t *pids;            // Every process in the job; negated once reaped
+    int pid_count;
+    int running;            // Processes not yet reaped
+    struct timespec started; // CLOCK_MONOTONIC start time
+    amcsh_usage_t usage;    // Totals of the processes reaped so far
     struct amcsh_job *next; // Next job in list
 } amcsh_job_t;
 
 // Shell state
-typedef struct {
+typedef struct amcsh_state {
     bool interactive;       // Running interactively?
+    bool embedded;          // Running inside a host program through libamcsh
+    bool exit_requested;    // "exit" while embedded: stop the script
     int exit_status;       // Exit status of last command
     amcsh_job_t *jobs;     // List of active jobs
     pthread_mutex_t job_mutex;  // Mutex for job list
@@ -81,29 +225,132 @@ typedef struct {
     amcsh_thread_pool_t *thread_pool;  // Thread pool
 } amcsh_state_t;
 
+// State of the interpreter running on this thread: the shell's own, or an
+// embedder's amcsh_interp_t. Pool workers inherit their pool's owner.
+extern __thread amcsh_state_t *amcsh_current_state;
+#define shell_state (*amcsh_current_state)
+
+void amcsh_state_init(amcsh_state_t *state);
+void amcsh_state_destroy(amcsh_state_t *state);
+void amcsh_run_script(FILE *in, amcsh_output_t *capture);
+void amcsh_execute_captured(amcsh_command_t *cmd, amcsh_output_t *capture);
+
+// Lists (; & && ||) and ( ) / { } groups
+bool amcsh_list_needed(const char *line);
+char *amcsh_list_read(const char *line, amcsh_line_reader_t reader, void *ctx);
+void amcsh_list_run(const char *text, amcsh_output_t *capture);
+const char *amcsh_group_end(const char *open);
+int amcsh_group_run(amcsh_command_t *cmd, bool forked);
+
 // Function declarations
 void amcsh_init(void);
 void amcsh_cleanup(void);
+void amcsh_command_init(amcsh_command_t *cmd, char *raw_cmd);
+void amcsh_command_free(amcsh_command_t *cmd);
 void amcsh_parse_command(amcsh_command_t *cmd);
 int amcsh_execute(amcsh_command_t *cmd);
+pid_t amcsh_spawn(amcsh_command_t *cmd);
+void amcsh_child_enter(amcsh_child_t *child, int in);
+void amcsh_child_exit(amcsh_child_t *child, int status) __attribute__((noreturn));
 int amcsh_execute_builtin(amcsh_command_t *cmd);
+int amcsh_stderr_fd(const amcsh_command_t *cmd);
+void amcsh_resolve_command(amcsh_command_t *cmd);
 void amcsh_history_add(const char *line);
+void amcsh_history_add_lines(const char *text);
 void amcsh_history_load(void);
 void amcsh_history_save(void);
 void amcsh_completion_init(void);
 char **amcsh_complete(const char *line, int *num_matches);
+void amcsh_completion_index(void);
+int amcsh_completion_lookup(const char *word);
 void amcsh_free_completions(char **completions, int num_matches);
 void amcsh_setup_signals(void);
 void amcsh_handle_signal(int signo);
 void amcsh_update_jobs(void);
-void amcsh_thread_pool_init(amcsh_thread_pool_t *pool);
+void amcsh_job_add(pid_t pgid, const pid_t *pids, int count, const char *command);
+void amcsh_job_free(amcsh_job_t *job);
+pid_t amcsh_job_pgid(int number);
+int amcsh_job_number(pid_t pgid);
+int amcsh_job_kill(int number, int signo);
+
+// Resource accounting
+extern volatile sig_atomic_t amcsh_child_exited;
+extern volatile sig_atomic_t amcsh_interrupted;
+double amcsh_elapsed(const struct timespec *start);
+int amcsh_wait_process(pid_t pid, amcsh_usage_t *usage);
+void amcsh_usage_add(amcsh_usage_t *usage, const struct rusage *ru);
+void amcsh_usage_add_delta(amcsh_usage_t *usage, const struct rusage *before, const struct rusage *after);
+void amcsh_usage_report(const amcsh_usage_t *usage, bool posix);
+bool amcsh_usage_over_reporttime(const amcsh_usage_t *usage);
+void amcsh_thread_pool_init(amcsh_thread_pool_t *pool, struct amcsh_state *owner);
 void amcsh_thread_pool_shutdown(amcsh_thread_pool_t *pool);
 char *amcsh_cache_lookup(const char *cmd);
+bool amcsh_cache_contains(const char *cmd);
+int amcsh_command_path(const char *name, char *path, size_t size);
+
+// Speculative resolution and readahead of commands about to run
+void amcsh_prefetch_command(const char *name);
+void amcsh_prefetch_pipeline(const amcsh_command_t *cmd);
+void amcsh_prefetch_typed(const char *line, size_t len);
 void amcsh_cache_update(const char *cmd, const char *path);
 void amcsh_cache_cleanup(void);
 
+// Prompt segments; slow ones run on the thread pool
+void amcsh_prompt_init(void);
+int amcsh_prompt_wake_fd(void);
+void amcsh_prompt_wake(void);
+void amcsh_prompt_wake_drain(void);
+void amcsh_prompt_chdir(void);
+void amcsh_prompt_command_done(int status, double seconds);
+void amcsh_prompt_update(void);
+const char *amcsh_prompt_render(void);
+
+// Command cache shared by every amcsh on the host (AMCSH_SHARED_CACHE=1)
+int amcsh_shm_cache_lookup(const char *name, char *path, size_t size);
+void amcsh_shm_cache_store(const char *name, const char *path);
+
+// Arena allocation
+void *amcsh_arena_alloc(amcsh_arena_t *arena, size_t size);
+char *amcsh_arena_strndup(amcsh_arena_t *arena, const char *str, size_t len);
+void amcsh_arena_adopt(amcsh_arena_t *arena, void *ptr);
+void amcsh_arena_free(amcsh_arena_t *arena);
+
+// Redirections and here-documents
+int amcsh_redirect_open(const char *path, int flags);
+int amcsh_memfd_from_buffer(const char *name, const char *data, size_t len);
+int amcsh_heredoc_read(amcsh_command_t *cmd, amcsh_line_reader_t reader, void *ctx);
+
+// Pathname and brace expansion; quoted metacharacters are backslash-escaped
+int amcsh_glob_expand(const char *word, amcsh_arena_t *arena, char ***fields);
+bool amcsh_glob_has_meta(const char *pattern);
+char *amcsh_glob_unescape(amcsh_arena_t *arena, const char *word, size_t len);
+
+// Command substitution: returns NUL-terminated output owned by arena
+char *amcsh_subst_capture(const char *body, size_t len, amcsh_arena_t *arena, size_t *out_len);
+
+// Process substitution: <(list) and >(list) as /dev/fd paths
+char *amcsh_procsub_open(amcsh_command_t *cmd, const char *body, size_t len, bool output);
+void amcsh_procsub_close(amcsh_command_t *cmd);
+void amcsh_procsub_job_add(amcsh_command_t *head, pid_t pgid, const pid_t *pids, int count);
+
+// Background job output captured into rings (AMCSH_JOBLOG=1)
+int amcsh_joblog_open(int *read_fd);
+void amcsh_joblog_child(int fd, bool out);
+void amcsh_joblog_attach(pid_t pgid, int read_fd, const char *command);
+
+// Process creation backends
+void amcsh_spawn_init(void);
+int amcsh_spawn_backend_parse(const char *name, amcsh_spawn_backend_t *backend);
+const char *amcsh_spawn_backend_name(amcsh_spawn_backend_t backend);
+void amcsh_spawn_set_backend(amcsh_spawn_backend_t backend);
+amcsh_spawn_backend_t amcsh_spawn_get_backend(void);
+void amcsh_spawn_req_init(amcsh_spawn_req_t *req, char **argv);
+int amcsh_spawn_resolve(const char *name, char *path, size_t size);
+pid_t amcsh_spawn_process(const amcsh_spawn_req_t *req, int *pidfd);
+
 // Thread pool operations
 void amcsh_thread_pool_submit(amcsh_thread_pool_t *pool, void *(*task)(void *), void *args);
+bool amcsh_thread_pool_try_submit(amcsh_thread_pool_t *pool, void *(*task)(void *), void *args);
 
 // Built-in commands
 int amcsh_builtin_cd(char **args);
@@ -116,9 +363,50 @@ int amcsh_builtin_echo(char **args);
 int amcsh_builtin_help(char **args);
 int amcsh_builtin_clear(char **args);
 int amcsh_builtin_history(char **args);
+int amcsh_builtin_enable(char **args);
+int amcsh_builtin_stats(char **args);
+int amcsh_builtin_memo(char **args);
+int amcsh_prefix_command(struct amcsh_command *cmd);
+int amcsh_prefix_pin(struct amcsh_command *cmd);
+int amcsh_prefix_nice(struct amcsh_command *cmd);
+int amcsh_prefix_limit(struct amcsh_command *cmd);
+int amcsh_prefix_time(struct amcsh_command *cmd);
+
+// Native replacements for hot external utilities
+int amcsh_builtin_true(char **args);
+int amcsh_builtin_false(char **args);
+int amcsh_builtin_test(char **args);
+int amcsh_builtin_printf(char **args);
+int amcsh_builtin_cat(char **args);
+int amcsh_builtin_tee(char **args);
+int amcsh_builtin_coproc(char **args);
+int amcsh_builtin_joblog(char **args);
+int amcsh_builtin_basename(char **args);
+int amcsh_builtin_dirname(char **args);
+int amcsh_builtin_mkdir(char **args);
+int amcsh_builtin_sleep(char **args);
+int amcsh_builtin_read(char **args);
+int amcsh_builtin_kill(char **args);
+
+// Builtin output and input; follows redirections and pipeline stages per thread
+void amcsh_output_init(amcsh_output_t *out, int fd, char *buf, size_t cap);
+int amcsh_output_flush(amcsh_output_t *out);
+int amcsh_output_writev(amcsh_output_t *out, const struct iovec *iov, int count);
+char *amcsh_output_take(amcsh_output_t *out, size_t *len);
+void amcsh_io_enter(amcsh_output_t *out, int in, amcsh_io_t *saved);
+void amcsh_io_leave(const amcsh_io_t *saved);
+int amcsh_in_fd(void);
+int amcsh_out_fd(void);
+void amcsh_flush(void);
+int amcsh_copy_fd(int in, int out);
+int amcsh_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void amcsh_write(const void *data, size_t len);
+void amcsh_writev(const struct iovec *iov, int count);
+void amcsh_puts(const char *str);
+void amcsh_putc(int c);
 
 // History management
-char *amcsh_history_get(int index);
+char **amcsh_history_snapshot(int limit, int *count);
 char **amcsh_history_search(const char *pattern, int *num_results);
 
 // Completion system with trie-based suggestions
@@ -0,0 +1,50 @@
+#ifndef AMCSH_BUILTINS_H
+#define AMCSH_BUILTINS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Builtin flags
+#define AMCSH_BUILTIN_PURE     0x01  // Leaves shell state alone; safe to run in-process anywhere
+#define AMCSH_BUILTIN_KEYWORD  0x02  // Reserved word handled by the parser
+#define AMCSH_BUILTIN_OPTIONAL 0x04  // Replaces an external utility; can be disabled
+#define AMCSH_BUILTIN_PREFIX   0x08  // Modifies the command that follows it
+
+struct amcsh_command;
+
+typedef int (*amcsh_builtin_func_t)(char **args);
+
+// Prefix handler: consumes its words at argv[0..] and returns how many, or -1 on error
+typedef int (*amcsh_prefix_func_t)(struct amcsh_command *cmd);
+
+// Registry entry, generated from builtins.def
+typedef struct {
+    const char *name;
+    amcsh_builtin_func_t func;  // NULL for keywords and prefixes
+    amcsh_prefix_func_t prefix; // Set for prefixes only
+    unsigned int flags;
+    const char *summary;
+    const char *usage;          // Extra help text, may be NULL
+} amcsh_builtin_t;
+
+extern const amcsh_builtin_t amcsh_builtins[];
+extern const int amcsh_builtin_count;
+
+// Perfect-hash lookup; NULL if name is not a builtin or keyword
+const amcsh_builtin_t *amcsh_builtin_lookup(const char *name);
+
+// Optional builtins switched off with "enable -n" resolve as external commands
+bool amcsh_builtin_enabled(const amcsh_builtin_t *builtin);
+void amcsh_builtin_set_enabled(const amcsh_builtin_t *builtin, bool enabled);
+
+// Shared by the runtime lookup and the build-time table generator
+static inline uint32_t amcsh_builtin_hash(const char *name, uint32_t seed) {
+    uint32_t h = seed ^ 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+#endif /* AMCSH_BUILTINS_H */
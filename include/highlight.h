@@ -0,0 +1,71 @@
+#ifndef AMCSH_HIGHLIGHT_H
+#define AMCSH_HIGHLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// As-you-type syntax highlighting for the line editor. The line is kept as
+// tokens; an update re-lexes from the token before the first changed byte
+// until the new tokens line up with the old ones, and reports the byte range
+// whose colours need painting. Commands are looked up in the builtin table,
+// command cache and completion index; paths are checked in batches on the
+// thread pool, and a late result wakes the line editor like a prompt segment.
+
+typedef enum {
+    AMCSH_HL_PLAIN,        // Arguments, and words not looked up yet
+    AMCSH_HL_COMMAND,      // Builtin, keyword or command on PATH
+    AMCSH_HL_UNKNOWN,      // Command that does not resolve
+    AMCSH_HL_OPERATOR,     // | & ; ( ) && ||
+    AMCSH_HL_REDIRECT,     // < > >> << <<- <<<
+    AMCSH_HL_PATH,         // Path argument or input file that exists
+    AMCSH_HL_MISSING,      // Path argument or input file that does not
+} amcsh_hl_class_t;
+
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint8_t state;         // Lexer state the token started in
+    uint8_t kind;          // Word, operator or redirection
+    uint8_t cls;           // amcsh_hl_class_t
+} amcsh_hl_token_t;
+
+typedef struct {
+    char *text;            // Line as of the last update
+    size_t len, cap;
+    amcsh_hl_token_t *tokens;
+    size_t count, token_cap;
+    amcsh_hl_token_t *scratch;   // Re-lexed tokens before they are spliced in
+    size_t scratch_cap;
+    char **batch;          // Paths to check once the update is done
+    size_t batch_count, batch_cap;
+    unsigned generation;   // Lookup results the token classes reflect
+    bool invalid;          // The line was redrawn without colours
+    char *out;             // Last rendered text
+    size_t out_len, out_cap;
+} amcsh_highlight_t;
+
+void amcsh_highlight_init(amcsh_highlight_t *hl);
+void amcsh_highlight_free(amcsh_highlight_t *hl);
+
+// Before each new line: files come and go between commands
+void amcsh_highlight_reset(amcsh_highlight_t *hl);
+
+// The next update repaints the whole line
+void amcsh_highlight_invalidate(amcsh_highlight_t *hl);
+
+// Bring the tokens up to date with line; false when nothing needs painting,
+// else [from, to) is the byte range to repaint
+bool amcsh_highlight_update(amcsh_highlight_t *hl, const char *line, size_t len,
+                            size_t *from, size_t *to);
+
+// Bytes [from, to) of the line with colour escapes, ending in the default colour
+const char *amcsh_highlight_render(amcsh_highlight_t *hl, size_t from, size_t to, size_t *len);
+
+// Terminal columns taken by text, or -1 if it holds control characters
+long amcsh_highlight_columns(const char *text, size_t len);
+
+// Byte offset of the first character at or after a column of text
+size_t amcsh_highlight_offset(const char *text, size_t len, long column);
+
+#endif /* AMCSH_HIGHLIGHT_H */
@@ -0,0 +1,44 @@
+#ifndef LIBAMCSH_H
+#define LIBAMCSH_H
+
+// Embedding API: run shell snippets in-process instead of system()/popen().
+// Builtins run inside the caller; external commands are spawned directly,
+// never through an intermediate /bin/sh.
+//
+// An interpreter may be used by one thread at a time; separate interpreters
+// may run concurrently. The working directory, "enable -n" and history are
+// process-wide.
+
+#include <stddef.h>
+
+#ifndef AMCSH_API
+#define AMCSH_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct amcsh_interp amcsh_interp_t;
+
+// NULL when out of memory
+AMCSH_API amcsh_interp_t *amcsh_interp_create(void);
+AMCSH_API void amcsh_interp_destroy(amcsh_interp_t *interp);
+
+// Run a script (one command per line) with the host's standard streams;
+// returns the exit status of the last command. "exit" ends the script only.
+AMCSH_API int amcsh_interp_run(amcsh_interp_t *interp, const char *script);
+
+// Like amcsh_interp_run, with standard output collected into *output
+// (NUL-terminated, free() it). Redirected and background output is not captured.
+AMCSH_API int amcsh_interp_capture(amcsh_interp_t *interp, const char *script,
+                                   char **output, size_t *length);
+
+// Exit status of the last command run
+AMCSH_API int amcsh_interp_status(const amcsh_interp_t *interp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBAMCSH_H */
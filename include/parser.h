@@ -10,4 +10,7 @@ void amcsh_parse_command(amcsh_command_t *cmd);
 char *amcsh_unquote_token(char *token);
 char *amcsh_escape_token(const char *token);
 
+// Expand $ and ` in here-document text; result is owned by the command arena
+char *amcsh_expand_string(amcsh_command_t *cmd, const char *str, size_t len, size_t *out_len);
+
 #endif /* AMCSH_PARSER_H */
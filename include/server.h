@@ -0,0 +1,27 @@
+#ifndef AMCSH_SERVER_H
+#define AMCSH_SERVER_H
+
+#include <stdint.h>
+
+// Wire format between amcsh-client and "amcsh --server SOCKET".
+// The client sends a request header carrying its stdin, stdout, stderr and
+// working directory as SCM_RIGHTS, followed by length bytes of script. The
+// server answers with a status once the script has finished.
+
+#define AMCSH_SERVER_MAGIC 0x616d6331u   // "amc1"
+#define AMCSH_SERVER_FDS 4               // stdin, stdout, stderr, cwd
+#define AMCSH_SERVER_MAX_SCRIPT (1u << 20)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t length;       // Script bytes following the header
+} amcsh_server_request_t;
+
+typedef struct {
+    int32_t status;        // Exit status, or 128 + signal number
+} amcsh_server_reply_t;
+
+// Serve requests until SIGINT or SIGTERM; returns the shell's exit status
+int amcsh_server_run(const char *path);
+
+#endif /* AMCSH_SERVER_H */
@@ -0,0 +1,36 @@
+#ifndef AMCSH_TRACE_H
+#define AMCSH_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Phases of a command's trip through the REPL
+typedef enum {
+    AMCSH_PHASE_READ,      // Waiting for and reading the line
+    AMCSH_PHASE_PARSE,     // Tokenize, expand, resolve
+    AMCSH_PHASE_LOOKUP,    // Builtin registry lookup
+    AMCSH_PHASE_CACHE,     // Command cache lookup and PATH search
+    AMCSH_PHASE_SPAWN,     // Process creation
+    AMCSH_PHASE_WAIT,      // Waiting for a foreground process
+    AMCSH_PHASE_HISTORY,   // Recording the line in history
+    AMCSH_PHASE_COUNT
+} amcsh_phase_t;
+
+// Built with -DAMCSH_TRACE=OFF the macros compile to nothing
+#ifdef AMCSH_TRACE
+#define AMCSH_TRACE_BEGIN(var) uint64_t var = amcsh_trace_now()
+#define AMCSH_TRACE_END(phase, var) amcsh_trace_record((phase), amcsh_trace_now() - (var))
+#else
+#define AMCSH_TRACE_BEGIN(var) ((void)0)
+#define AMCSH_TRACE_END(phase, var) ((void)0)
+#endif
+
+uint64_t amcsh_trace_now(void);
+void amcsh_trace_record(amcsh_phase_t phase, uint64_t ns);
+
+// AMCSH_TRACE_FILE names a file that gets the histograms as JSON lines on exit
+void amcsh_trace_init(void);
+void amcsh_trace_reset(void);
+void amcsh_trace_write_json(FILE *out);
+
+#endif /* AMCSH_TRACE_H */
@@ -0,0 +1,77 @@
+#include "amcsh.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGN 16
+
+static amcsh_arena_block_t *new_block(size_t size) {
+    amcsh_arena_block_t *block = malloc(sizeof(amcsh_arena_block_t) + size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+void *amcsh_arena_alloc(amcsh_arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    amcsh_arena_block_t *block = arena->head;
+    if (!block || block->size - block->used < size) {
+        // Oversized requests get a dedicated block so the current one keeps its tail
+        block = new_block(size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE);
+        if (!block) {
+            return NULL;
+        }
+        if (size > ARENA_BLOCK_SIZE / 4 && arena->head) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+        }
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *amcsh_arena_strndup(amcsh_arena_t *arena, const char *str, size_t len) {
+    char *copy = amcsh_arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+void amcsh_arena_adopt(amcsh_arena_t *arena, void *ptr) {
+    amcsh_arena_owned_t *owned = amcsh_arena_alloc(arena, sizeof(amcsh_arena_owned_t));
+    if (!owned) {
+        free(ptr);
+        return;
+    }
+    owned->ptr = ptr;
+    owned->next = arena->owned;
+    arena->owned = owned;
+}
+
+void amcsh_arena_free(amcsh_arena_t *arena) {
+    // Owned list nodes live inside the blocks, so release them first
+    for (amcsh_arena_owned_t *owned = arena->owned; owned; owned = owned->next) {
+        free(owned->ptr);
+    }
+    arena->owned = NULL;
+
+    amcsh_arena_block_t *block = arena->head;
+    while (block) {
+        amcsh_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
@@ -4,8 +4,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
-
-extern amcsh_state_t shell_state;
+#include <ctype.h>
+#include <errno.h>
+#include <sys/resource.h>
 
 int amcsh_builtin_cd(char **args) {
     if (!args[1]) {
@@ -25,15 +26,24 @@ int amcsh_builtin_cd(char **args) {
             return 1;
         }
     }
+    amcsh_prompt_chdir();
     return 0;
 }
 
+// "jobs -l" adds the process group and the usage of processes reaped so far
 int amcsh_builtin_jobs(char **args) {
+    bool verbose = args[1] && strcmp(args[1], "-l") == 0;
+    if (args[1] && !verbose) {
+        fprintf(stderr, "amcsh: jobs: %s: invalid option\n", args[1]);
+        return 2;
+    }
+
+    amcsh_update_jobs();
     pthread_mutex_lock(&shell_state.job_mutex);
-    amcsh_job_t *job = shell_state.jobs;
-    int job_num = 1;
+    amcsh_job_t **link = &shell_state.jobs;
 
-    while (job) {
+    while (*link) {
+        amcsh_job_t *job = *link;
         const char *status_str;
         switch (job->status) {
             case JOB_RUNNING:
@@ -49,8 +59,25 @@ int amcsh_builtin_jobs(char **args) {
                 status_str = "Unknown";
         }
 
-        printf("[%d] %s\t%s\n", job_num++, status_str, job->command);
-        job = job->next;
+        if (!verbose) {
+            amcsh_printf("[%d] %s\t%s\n", job->number, status_str, job->command);
+        } else {
+            const amcsh_usage_t *usage = &job->usage;
+            double real = job->status == JOB_DONE ? usage->real : amcsh_elapsed(&job->started);
+            amcsh_printf("[%d] %d %s\t%s\n", job->number, (int)job->pgid, status_str, job->command);
+            amcsh_printf("      real %.3fs user %.3fs sys %.3fs maxrss %ldKB "
+                         "faults %ld/%ld ctxsw %ld/%ld\n",
+                         real, usage->user, usage->sys, usage->maxrss,
+                         usage->majflt, usage->minflt, usage->nvcsw, usage->nivcsw);
+        }
+
+        // A finished job is reported once
+        if (job->status == JOB_DONE) {
+            *link = job->next;
+            amcsh_job_free(job);
+        } else {
+            link = &job->next;
+        }
     }
     pthread_mutex_unlock(&shell_state.job_mutex);
     return 0;
@@ -67,6 +94,11 @@ int amcsh_builtin_bg(char **args) {
 }
 
 int amcsh_builtin_exit(char **args) {
+    // An embedded interpreter stops its script; the host process lives on
+    if (shell_state.embedded) {
+        shell_state.exit_requested = true;
+        return shell_state.exit_status;
+    }
     // TODO: Clean up resources before exit
     exit(shell_state.exit_status);
     return 0;
@@ -75,7 +107,7 @@ int amcsh_builtin_exit(char **args) {
 int amcsh_builtin_pwd(char **args) {
     char cwd[PATH_MAX];
     if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        printf("%s\n", cwd);
+        amcsh_printf("%s\n", cwd);
         return 0;
     } else {
         perror("amcsh: pwd");
@@ -93,87 +125,55 @@ int amcsh_builtin_echo(char **args) {
         i++;
     }
     
-    // Print all arguments with spaces between them
+    // Words and separators go out as one gather list, not a write per word
+    struct iovec iov[AMCSH_OUTPUT_MAX_IOV];
+    int count = 0;
     while (args[i]) {
-        printf("%s", args[i]);
+        iov[count].iov_base = args[i];
+        iov[count++].iov_len = strlen(args[i]);
         if (args[i+1]) {
-            printf(" ");
+            iov[count].iov_base = " ";
+            iov[count++].iov_len = 1;
+        }
+        if (count >= AMCSH_OUTPUT_MAX_IOV - 2) {
+            amcsh_writev(iov, count);
+            count = 0;
         }
         i++;
     }
     
     if (newline) {
-        printf("\n");
+        iov[count].iov_base = "\n";
+        iov[count++].iov_len = 1;
     }
+    amcsh_writev(iov, count);
     
     return 0;
 }
 
-// Help information for built-in commands
-static const struct {
-    const char *name;
-    const char *desc;
-} builtin_help[] = {
-    {"cd", "Change the current directory"},
-    {"clear", "Clear the terminal screen"},
-    {"echo", "Display a line of text"},
-    {"exit", "Exit the shell"},
-    {"fg", "Move job to foreground"},
-    {"bg", "Move job to background"},
-    {"help", "Display information about built-in commands"},
-    {"history", "Display command history"},
-    {"jobs", "List active jobs"},
-    {"pwd", "Print the current working directory"},
-    {NULL, NULL}
-};
-
 int amcsh_builtin_help(char **args) {
     if (!args[1]) {
         // No argument - list all built-in commands
-        printf("\033[1;36mamcsh %s\033[0m - High Performance Shell\n\n", AMCSH_VERSION);
-        printf("These shell commands are defined internally.\n");
-        printf("Type 'help name' to find out more about the function 'name'.\n\n");
+        amcsh_printf("\033[1;36mamcsh %s\033[0m - High Performance Shell\n\n", AMCSH_VERSION);
+        amcsh_printf("These shell commands are defined internally.\n");
+        amcsh_printf("Type 'help name' to find out more about the function 'name'.\n\n");
         
-        printf("Built-in commands:\n");
-        for (int i = 0; builtin_help[i].name; i++) {
-            printf("  \033[1;32m%-10s\033[0m %s\n", builtin_help[i].name, builtin_help[i].desc);
+        amcsh_printf("Built-in commands:\n");
+        for (int i = 0; i < amcsh_builtin_count; i++) {
+            amcsh_printf("  \033[1;32m%-10s\033[0m %s\n", amcsh_builtins[i].name, amcsh_builtins[i].summary);
         }
     } else {
         // Find specific command help
-        for (int i = 0; builtin_help[i].name; i++) {
-            if (strcmp(args[1], builtin_help[i].name) == 0) {
-                printf("%s: %s\n", builtin_help[i].name, builtin_help[i].desc);
-                
-                // Additional usage information for specific commands
-                if (strcmp(args[1], "cd") == 0) {
-                    printf("Usage: cd [directory]\n");
-                    printf("  Changes the current directory to [directory].\n");
-                    printf("  If no directory is specified, changes to the home directory.\n");
-                } else if (strcmp(args[1], "echo") == 0) {
-                    printf("Usage: echo [-n] [string...]\n");
-                    printf("  Display the STRING(s) on standard output.\n");
-                    printf("  -n    do not output the trailing newline\n");
-                } else if (strcmp(args[1], "jobs") == 0) {
-                    printf("Usage: jobs\n");
-                    printf("  Lists all jobs that are running in the background.\n");
-                } else if (strcmp(args[1], "fg") == 0) {
-                    printf("Usage: fg [job_id]\n");
-                    printf("  Brings the specified job to the foreground.\n");
-                } else if (strcmp(args[1], "bg") == 0) {
-                    printf("Usage: bg [job_id]\n");
-                    printf("  Continues the specified job in the background.\n");
-                } else if (strcmp(args[1], "history") == 0) {
-                    printf("Usage: history [n]\n");
-                    printf("  Display the command history list with line numbers.\n");
-                    printf("  An optional argument 'n' limits the number of entries shown.\n");
-                }
-                
-                return 0;
-            }
+        const amcsh_builtin_t *builtin = amcsh_builtin_lookup(args[1]);
+        if (!builtin) {
+            fprintf(stderr, "amcsh: help: no help topics match '%s'\n", args[1]);
+            return 1;
+        }
+
+        amcsh_printf("%s: %s\n", builtin->name, builtin->summary);
+        if (builtin->usage) {
+            amcsh_printf("%s", builtin->usage);
         }
-        
-        fprintf(stderr, "amcsh: help: no help topics match '%s'\n", args[1]);
-        return 1;
     }
     
     return 0;
@@ -181,7 +181,7 @@ int amcsh_builtin_help(char **args) {
 
 int amcsh_builtin_clear(char **args) {
     // ANSI escape sequence to clear screen and move cursor to home position
-    printf("\033[2J\033[H");
+    amcsh_printf("\033[2J\033[H");
     return 0;
 }
 
@@ -197,15 +197,301 @@ int amcsh_builtin_history(char **args) {
         }
     }
     
-    // Get history items
-    for (int i = 0; i < limit; i++) {
-        char *cmd = amcsh_history_get(i);
-        if (cmd) {
-            printf("%5d  %s\n", i + 1, cmd);
+    // Print from a copy so pool workers can keep adding while we write
+    int count;
+    char **items = amcsh_history_snapshot(limit, &count);
+    for (int i = 0; i < count; i++) {
+        amcsh_printf("%5d  %s\n", i + 1, items[i] ? items[i] : "");
+        free(items[i]);
+    }
+    free(items);
+    
+    return 0;
+}
+
+int amcsh_builtin_enable(char **args) {
+    bool enable = true;
+    int i = 1;
+
+    if (args[i] && strcmp(args[i], "-n") == 0) {
+        enable = false;
+        i++;
+    }
+
+    // With no names, list the optional builtins and their state
+    if (!args[i]) {
+        for (int b = 0; b < amcsh_builtin_count; b++) {
+            const amcsh_builtin_t *builtin = &amcsh_builtins[b];
+            if (builtin->flags & AMCSH_BUILTIN_OPTIONAL) {
+                amcsh_printf("enable %s%s\n", amcsh_builtin_enabled(builtin) ? "" : "-n ", builtin->name);
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (; args[i]; i++) {
+        const amcsh_builtin_t *builtin = amcsh_builtin_lookup(args[i]);
+        if (!builtin) {
+            fprintf(stderr, "amcsh: enable: %s: not a shell builtin\n", args[i]);
+            status = 1;
+        } else if (!(builtin->flags & AMCSH_BUILTIN_OPTIONAL)) {
+            fprintf(stderr, "amcsh: enable: %s: cannot be disabled\n", args[i]);
+            status = 1;
         } else {
+            amcsh_builtin_set_enabled(builtin, enable);
+        }
+    }
+    return status;
+}
+
+// "command [-p] name args...": consumes its own words and leaves name as argv[0]
+int amcsh_prefix_command(struct amcsh_command *cmd) {
+    bool default_path = false;
+    int i = 1;
+
+    for (; i < cmd->argc && cmd->argv[i][0] == '-' && cmd->argv[i][1]; i++) {
+        if (strcmp(cmd->argv[i], "--") == 0) {
+            i++;
             break;
+        } else if (strcmp(cmd->argv[i], "-p") == 0) {
+            default_path = true;
+        } else {
+            fprintf(stderr, "amcsh: command: %s: invalid option\n", cmd->argv[i]);
+            return -1;
         }
     }
-    
-    return 0;
+
+    if (!default_path || i >= cmd->argc) {
+        return i;
+    }
+
+    // -p runs the standard utility: skip optional builtins and search the default PATH
+    cmd->external_only = true;
+    const char *name = cmd->argv[i];
+    const amcsh_builtin_t *builtin = amcsh_builtin_lookup(name);
+    if (strchr(name, '/') || (builtin && !(builtin->flags & AMCSH_BUILTIN_OPTIONAL))) {
+        return i;
+    }
+
+    char search[PATH_MAX];
+    size_t len = confstr(_CS_PATH, search, sizeof(search));
+    if (len == 0 || len > sizeof(search)) {
+        strcpy(search, "/bin:/usr/bin");
+    }
+
+    char *saveptr;
+    for (char *dir = strtok_r(search, ":", &saveptr); dir; dir = strtok_r(NULL, ":", &saveptr)) {
+        char path[PATH_MAX];
+        int n = snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (n > 0 && (size_t)n < sizeof(path) && access(path, X_OK) == 0) {
+            cmd->argv[i] = amcsh_arena_strndup(&cmd->arena, path, n);
+            break;
+        }
+    }
+    return i;
+}
+
+// "time [-p] pipeline": marks the command; the executor measures and reports it
+int amcsh_prefix_time(struct amcsh_command *cmd) {
+    int used = 1;
+    if (used < cmd->argc && strcmp(cmd->argv[used], "-p") == 0) {
+        cmd->time_posix = true;
+        used++;
+    }
+    cmd->timed = true;
+    return used;
+}
+
+// Spawn settings shared by the pin, nice and limit prefixes
+static amcsh_spawn_attr_t *spawn_attr(amcsh_command_t *cmd) {
+    if (!cmd->spawn_attr) {
+        cmd->spawn_attr = amcsh_arena_alloc(&cmd->arena, sizeof(amcsh_spawn_attr_t));
+        memset(cmd->spawn_attr, 0, sizeof(amcsh_spawn_attr_t));
+    }
+    // Settings are applied in the child, so the command must not run in-process
+    cmd->external_only = true;
+    return cmd->spawn_attr;
+}
+
+// "pin 0-3,6 cmd": sched_setaffinity in the child before exec
+int amcsh_prefix_pin(struct amcsh_command *cmd) {
+    if (cmd->argc < 3) {
+        fprintf(stderr, "amcsh: pin: usage: pin CPULIST command [arg...]\n");
+        return -1;
+    }
+
+    amcsh_spawn_attr_t *attr = spawn_attr(cmd);
+    const size_t bits = 8 * sizeof(attr->affinity[0]);
+    const char *p = cmd->argv[1];
+
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end != p && *end == '-') {
+            const char *next = end + 1;
+            last = strtol(next, &end, 10);
+            if (end == next) end = (char *)p;
+        }
+        if (end == p || first < 0 || last < first || last >= AMCSH_SPAWN_MAX_CPUS ||
+            (*end && *end != ',')) {
+            fprintf(stderr, "amcsh: pin: %s: invalid CPU list\n", cmd->argv[1]);
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            attr->affinity[cpu / bits] |= 1UL << (cpu % bits);
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    attr->has_affinity = true;
+    return 2;
+}
+
+// "nice [-n N] cmd": the adjustment is relative to the shell's niceness
+int amcsh_prefix_nice(struct amcsh_command *cmd) {
+    int adjustment = 10;
+    int used = 1;
+    const char *value = NULL;
+
+    if (used < cmd->argc && strcmp(cmd->argv[used], "-n") == 0 && used + 1 < cmd->argc) {
+        value = cmd->argv[used + 1];
+        used += 2;
+    } else if (used < cmd->argc && cmd->argv[used][0] == '-' &&
+               (isdigit((unsigned char)cmd->argv[used][1]) || cmd->argv[used][1] == '-')) {
+        value = cmd->argv[used] + 1;
+        used++;
+    }
+    if (value) {
+        char *end;
+        adjustment = (int)strtol(value, &end, 10);
+        if (*value == '\0' || *end) {
+            fprintf(stderr, "amcsh: nice: %s: invalid adjustment\n", value);
+            return -1;
+        }
+    }
+    if (used >= cmd->argc) {
+        fprintf(stderr, "amcsh: nice: usage: nice [-n ADJUSTMENT] command [arg...]\n");
+        return -1;
+    }
+
+    amcsh_spawn_attr_t *attr = spawn_attr(cmd);
+    errno = 0;
+    int current = getpriority(PRIO_PROCESS, 0);
+    if (current == -1 && errno) {
+        current = 0;
+    }
+    int target = (attr->has_nice ? attr->nice : current) + adjustment;
+    attr->nice = target < -20 ? -20 : target > 19 ? 19 : target;
+    attr->has_nice = true;
+    return used;
+}
+
+static const struct {
+    const char *name;
+    int resource;
+    bool seconds;
+} limit_names[] = {
+    {"mem", RLIMIT_AS, false},
+    {"data", RLIMIT_DATA, false},
+    {"stack", RLIMIT_STACK, false},
+    {"rss", RLIMIT_RSS, false},
+    {"fsize", RLIMIT_FSIZE, false},
+    {"core", RLIMIT_CORE, false},
+    {"nofile", RLIMIT_NOFILE, false},
+    {"nproc", RLIMIT_NPROC, false},
+    {"cpu", RLIMIT_CPU, true},
+    {NULL, 0, false}
+};
+
+static bool parse_limit_value(const char *str, bool seconds, rlim_t *value) {
+    if (strcmp(str, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(str, &end, 10);
+    if (end == str || errno || *str == '-') {
+        return false;
+    }
+
+    unsigned long long scale = 1;
+    switch (*end) {
+        case '\0': break;
+        case 'K': case 'k': scale = seconds ? 0 : 1ULL << 10; break;
+        case 'M': scale = seconds ? 0 : 1ULL << 20; break;
+        case 'G': case 'g': scale = seconds ? 0 : 1ULL << 30; break;
+        case 'T': case 't': scale = seconds ? 0 : 1ULL << 40; break;
+        case 's': scale = seconds ? 1 : 0; break;
+        case 'm': scale = seconds ? 60 : 0; break;
+        case 'h': scale = seconds ? 3600 : 0; break;
+        default: scale = 0;
+    }
+    if (scale == 0 || (*end && end[1]) || n > (unsigned long long)RLIM_INFINITY / scale) {
+        return false;
+    }
+    *value = (rlim_t)(n * scale);
+    return true;
+}
+
+// "limit mem=2G cpu=60 cmd": setrlimit in the child before exec
+int amcsh_prefix_limit(struct amcsh_command *cmd) {
+    int used = 1;
+
+    while (used < cmd->argc && strchr(cmd->argv[used], '=')) {
+        const char *arg = cmd->argv[used];
+        size_t name_len = strchr(arg, '=') - arg;
+
+        int index = -1;
+        for (int i = 0; limit_names[i].name; i++) {
+            if (strlen(limit_names[i].name) == name_len &&
+                strncmp(limit_names[i].name, arg, name_len) == 0) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            fprintf(stderr, "amcsh: limit: %.*s: unknown resource\n", (int)name_len, arg);
+            return -1;
+        }
+
+        rlim_t value;
+        if (!parse_limit_value(arg + name_len + 1, limit_names[index].seconds, &value)) {
+            fprintf(stderr, "amcsh: limit: %s: invalid value\n", arg);
+            return -1;
+        }
+
+        amcsh_spawn_attr_t *attr = spawn_attr(cmd);
+        if (attr->rlimit_count >= AMCSH_SPAWN_MAX_RLIMITS) {
+            fprintf(stderr, "amcsh: limit: too many limits\n");
+            return -1;
+        }
+
+        // Only root may raise a hard limit, so a value above it is refused
+        // here rather than by setrlimit in the child
+        struct rlimit current;
+        getrlimit(limit_names[index].resource, &current);
+        if (current.rlim_max != RLIM_INFINITY && value > current.rlim_max) {
+            fprintf(stderr, "amcsh: limit: %s: above the hard limit of %llu\n", arg,
+                    (unsigned long long)current.rlim_max);
+            return -1;
+        }
+
+        // Lower the soft limit, and the hard limit with it
+        attr->rlimits[attr->rlimit_count].resource = limit_names[index].resource;
+        attr->rlimits[attr->rlimit_count].limit.rlim_cur = value;
+        attr->rlimits[attr->rlimit_count].limit.rlim_max =
+            value == RLIM_INFINITY ? current.rlim_max : value;
+        attr->rlimit_count++;
+        used++;
+    }
+
+    if (used == 1 || used >= cmd->argc) {
+        fprintf(stderr, "amcsh: limit: usage: limit RESOURCE=VALUE... command [arg...]\n");
+        return -1;
+    }
+    return used;
 }
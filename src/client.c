@@ -0,0 +1,107 @@
+// amcsh-client: run a script on a warm "amcsh --server" instead of starting a
+// shell. The script runs with this process's standard streams and working
+// directory, and this process exits with the script's status.
+// Usage: amcsh-client SOCKET COMMAND    (like sh -c COMMAND)
+#define _GNU_SOURCE
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: amcsh-client SOCKET COMMAND\n");
+        return 2;
+    }
+    const char *path = argv[1];
+    const char *script = argv[2];
+    size_t length = strlen(script);
+    if (length > AMCSH_SERVER_MAX_SCRIPT) {
+        fprintf(stderr, "amcsh-client: command too long\n");
+        return 2;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "amcsh-client: %s: path too long\n", path);
+        return 2;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "amcsh-client: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    // Closed standard streams are passed as /dev/null
+    int fds[AMCSH_SERVER_FDS];
+    for (int i = 0; i < 3; i++) {
+        fds[i] = fcntl(i, F_GETFD) >= 0 ? i : open("/dev/null", O_RDWR | O_CLOEXEC);
+    }
+    fds[3] = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fds[3] < 0) {
+        fprintf(stderr, "amcsh-client: working directory: %s\n", strerror(errno));
+        return 126;
+    }
+
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    amcsh_server_request_t req = {AMCSH_SERVER_MAGIC, (uint32_t)length};
+    struct iovec iov = {&req, sizeof(req)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent < 0 || write_full(sock, (char *)&req + sent, sizeof(req) - sent) != 0 ||
+        write_full(sock, script, length) != 0) {
+        fprintf(stderr, "amcsh-client: send: %s\n", strerror(errno));
+        return 126;
+    }
+
+    // The connection stays open until the script finishes; closing it early
+    // (this process being killed) makes the server stop the script
+    amcsh_server_reply_t reply;
+    size_t got = 0;
+    while (got < sizeof(reply)) {
+        ssize_t n = read(sock, (char *)&reply + got, sizeof(reply) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "amcsh-client: server closed the connection\n");
+            return 255;
+        }
+        got += n;
+    }
+    return reply.status;
+}
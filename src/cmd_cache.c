@@ -4,8 +4,6 @@
 #include <time.h>
 #include <limits.h>
 
-extern amcsh_state_t shell_state;
-
 static int find_cache_slot(const char *cmd) {
     // Simple hash function
     unsigned int hash = 0;
@@ -71,6 +69,16 @@ char *amcsh_cache_lookup(const char *cmd) {
     return NULL;
 }
 
+// Membership only: leaves the usage counts alone
+bool amcsh_cache_contains(const char *cmd) {
+    pthread_rwlock_rdlock(&shell_state.cache_lock);
+    int slot = find_cache_slot(cmd);
+    bool found = shell_state.cmd_cache[slot].cmd &&
+                 strcmp(shell_state.cmd_cache[slot].cmd, cmd) == 0;
+    pthread_rwlock_unlock(&shell_state.cache_lock);
+    return found;
+}
+
 void amcsh_cache_update(const char *cmd, const char *path) {
     pthread_rwlock_wrlock(&shell_state.cache_lock);
     
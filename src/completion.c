@@ -4,11 +4,15 @@
 #include <string.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 static amcsh_trie_node_t *root = NULL;
 static char **completion_results = NULL;
 static int completion_count = 0;
 static int completion_capacity = 0;
+static pthread_once_t completion_once = PTHREAD_ONCE_INIT;
+static atomic_bool completion_ready;
 
 static amcsh_trie_node_t *create_node(char c) {
     amcsh_trie_node_t *node = calloc(1, sizeof(amcsh_trie_node_t));
@@ -19,15 +23,9 @@ static amcsh_trie_node_t *create_node(char c) {
 void amcsh_completion_init(void) {
     root = create_node('\0');
     
-    // Add built-in commands to trie
-    const char *builtins[] = {
-        "cd", "exit", "jobs", "fg", "bg", "help",
-        "history", "alias", "unalias", "export",
-        "echo", "pwd", "source", NULL
-    };
-    
-    for (const char **cmd = builtins; *cmd; cmd++) {
-        amcsh_trie_insert(root, *cmd);
+    // Add built-in commands and keywords to trie
+    for (int i = 0; i < amcsh_builtin_count; i++) {
+        amcsh_trie_insert(root, amcsh_builtins[i].name);
     }
     
     // Add executables from PATH
@@ -52,6 +50,28 @@ void amcsh_completion_init(void) {
         
         free(path_copy);
     }
+    atomic_store_explicit(&completion_ready, true, memory_order_release);
+}
+
+// Build the index now; a no-op once built
+void amcsh_completion_index(void) {
+    pthread_once(&completion_once, amcsh_completion_init);
+}
+
+// Whether word is a builtin or a command on PATH: 1 or 0, or -1 while the
+// index is not built yet. Never scans PATH itself.
+int amcsh_completion_lookup(const char *word) {
+    if (!atomic_load_explicit(&completion_ready, memory_order_acquire)) {
+        return -1;
+    }
+    amcsh_trie_node_t *node = root;
+    for (; *word; word++) {
+        unsigned char idx = (unsigned char)*word;
+        if (idx >= 128 || !(node = node->children[idx])) {
+            return 0;
+        }
+    }
+    return node->is_end;
 }
 
 void amcsh_trie_insert(amcsh_trie_node_t *root, const char *word) {
@@ -126,6 +146,9 @@ char **amcsh_trie_search(amcsh_trie_node_t *root, const char *prefix, int *num_m
 }
 
 char **amcsh_complete(const char *line, int *num_matches) {
+    // PATH is scanned on the first completion rather than at startup
+    amcsh_completion_index();
+
     // Find the command word being completed
     const char *word_start = line;
     const char *word_end = line + strlen(line);
@@ -0,0 +1,1114 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define CAT_BUFFER_SIZE (128 * 1024)
+#define CAT_CHUNK (1 << 30)
+
+int amcsh_builtin_true(char **args) {
+    (void)args;
+    return 0;
+}
+
+int amcsh_builtin_false(char **args) {
+    (void)args;
+    return 1;
+}
+
+// test / [
+
+typedef struct {
+    char **argv;
+    int argc;
+    int pos;
+    bool error;
+} test_state_t;
+
+static bool test_or(test_state_t *t);
+
+static const char *test_peek(test_state_t *t) {
+    return t->pos < t->argc ? t->argv[t->pos] : NULL;
+}
+
+static bool test_integer(test_state_t *t, const char *str, long long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoll(str, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (errno || end == str || *end) {
+        fprintf(stderr, "amcsh: test: %s: integer expression expected\n", str);
+        t->error = true;
+        return false;
+    }
+    return true;
+}
+
+static bool is_unary_op(const char *op) {
+    return op[0] == '-' && op[1] && !op[2] && strchr("edfrwxsLhbcpSnzt", op[1]);
+}
+
+static bool is_binary_op(const char *op) {
+    static const char *ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+    for (const char **o = ops; *o; o++) {
+        if (strcmp(op, *o) == 0) return true;
+    }
+    return false;
+}
+
+static bool test_unary(char op, const char *arg) {
+    struct stat st;
+
+    switch (op) {
+        case 'n': return *arg != '\0';
+        case 'z': return *arg == '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'L':
+        case 'h': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if (stat(arg, &st) != 0) {
+        return false;
+    }
+    switch (op) {
+        case 'e': return true;
+        case 'f': return S_ISREG(st.st_mode);
+        case 'd': return S_ISDIR(st.st_mode);
+        case 's': return st.st_size > 0;
+        case 'b': return S_ISBLK(st.st_mode);
+        case 'c': return S_ISCHR(st.st_mode);
+        case 'p': return S_ISFIFO(st.st_mode);
+        case 'S': return S_ISSOCK(st.st_mode);
+    }
+    return false;
+}
+
+static bool test_binary(test_state_t *t, const char *a, const char *op, const char *b) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0) return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0) return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0) return strcmp(a, b) > 0;
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        bool ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+        if (op[1] == 'e') return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if (!ha || !hb) return op[1] == 'n' ? ha : hb;
+        bool newer = sa.st_mtim.tv_sec > sb.st_mtim.tv_sec ||
+                     (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec > sb.st_mtim.tv_nsec);
+        bool older = sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ||
+                     (sa.st_mtim.tv_sec == sb.st_mtim.tv_sec && sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec);
+        return op[1] == 'n' ? newer : older;
+    }
+
+    long long x, y;
+    if (!test_integer(t, a, &x) || !test_integer(t, b, &y)) {
+        return false;
+    }
+    if (strcmp(op, "-eq") == 0) return x == y;
+    if (strcmp(op, "-ne") == 0) return x != y;
+    if (strcmp(op, "-lt") == 0) return x < y;
+    if (strcmp(op, "-le") == 0) return x <= y;
+    if (strcmp(op, "-gt") == 0) return x > y;
+    return x >= y;
+}
+
+static bool test_primary(test_state_t *t) {
+    const char *arg = test_peek(t);
+    if (!arg) {
+        t->error = true;
+        return false;
+    }
+
+    // A binary operator in second position wins over a leading operator-looking string
+    if (t->pos + 2 < t->argc && is_binary_op(t->argv[t->pos + 1])) {
+        const char *a = t->argv[t->pos], *op = t->argv[t->pos + 1], *b = t->argv[t->pos + 2];
+        t->pos += 3;
+        return test_binary(t, a, op, b);
+    }
+
+    if (strcmp(arg, "(") == 0) {
+        t->pos++;
+        bool result = test_or(t);
+        if (!test_peek(t) || strcmp(test_peek(t), ")") != 0) {
+            fprintf(stderr, "amcsh: test: missing ')'\n");
+            t->error = true;
+        }
+        t->pos++;
+        return result;
+    }
+
+    if (is_unary_op(arg) && t->pos + 1 < t->argc) {
+        t->pos += 2;
+        return test_unary(arg[1], t->argv[t->pos - 1]);
+    }
+
+    t->pos++;
+    return *arg != '\0';
+}
+
+static bool test_not(test_state_t *t) {
+    const char *arg = test_peek(t);
+    if (arg && strcmp(arg, "!") == 0 && t->pos + 1 < t->argc) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool test_and(test_state_t *t) {
+    bool result = test_not(t);
+    while (test_peek(t) && strcmp(test_peek(t), "-a") == 0) {
+        t->pos++;
+        bool rhs = test_not(t);
+        result = result && rhs;
+    }
+    return result;
+}
+
+static bool test_or(test_state_t *t) {
+    bool result = test_and(t);
+    while (test_peek(t) && strcmp(test_peek(t), "-o") == 0) {
+        t->pos++;
+        bool rhs = test_and(t);
+        result = result || rhs;
+    }
+    return result;
+}
+
+int amcsh_builtin_test(char **args) {
+    int argc = 0;
+    while (args[argc]) argc++;
+
+    if (strcmp(args[0], "[") == 0) {
+        if (strcmp(args[argc - 1], "]") != 0) {
+            fprintf(stderr, "amcsh: [: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    test_state_t t = {args, argc, 1, false};
+    if (argc == 1) {
+        return 1;
+    }
+    bool result = test_or(&t);
+    if (!t.error && t.pos < argc) {
+        fprintf(stderr, "amcsh: test: %s: unexpected argument\n", args[t.pos]);
+        t.error = true;
+    }
+    return t.error ? 2 : (result ? 0 : 1);
+}
+
+// printf
+
+// Print one backslash escape at str; returns characters consumed, 0 for "\c"
+static int print_escape(const char *str, bool octal_zero) {
+    int value = 0, used = 1;
+
+    switch (*str) {
+        case 'n': amcsh_putc('\n'); return 1;
+        case 't': amcsh_putc('\t'); return 1;
+        case 'r': amcsh_putc('\r'); return 1;
+        case 'a': amcsh_putc('\a'); return 1;
+        case 'b': amcsh_putc('\b'); return 1;
+        case 'f': amcsh_putc('\f'); return 1;
+        case 'v': amcsh_putc('\v'); return 1;
+        case 'e': amcsh_putc('\033'); return 1;
+        case '\\': amcsh_putc('\\'); return 1;
+        case 'c': return 0;
+        case 'x':
+            while (used < 3 && isxdigit((unsigned char)str[used])) {
+                value = value * 16 + (isdigit((unsigned char)str[used]) ? str[used] - '0'
+                                      : tolower((unsigned char)str[used]) - 'a' + 10);
+                used++;
+            }
+            if (used == 1) {
+                amcsh_puts("\\x");
+                return 1;
+            }
+            amcsh_putc(value);
+            return used;
+    }
+
+    // Octal: \NNN in formats, \0NNN in %b arguments
+    if (*str >= '0' && *str <= '7') {
+        int max = octal_zero && *str == '0' ? 4 : 3;
+        used = 0;
+        while (used < max && str[used] >= '0' && str[used] <= '7') {
+            value = value * 8 + (str[used] - '0');
+            used++;
+        }
+        amcsh_putc(value);
+        return used;
+    }
+
+    amcsh_putc('\\');
+    if (*str) amcsh_putc(*str);
+    return *str ? 1 : 0;
+}
+
+static long long printf_integer(const char *arg, int *status) {
+    if ((arg[0] == '\'' || arg[0] == '"') && arg[1]) {
+        return (unsigned char)arg[1];
+    }
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if (*arg && (errno || *end)) {
+        fprintf(stderr, "amcsh: printf: %s: invalid number\n", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+int amcsh_builtin_printf(char **args) {
+    if (!args[1]) {
+        fprintf(stderr, "amcsh: printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = args[1];
+    char **arg = args + 2;
+    int status = 0;
+
+    // The format is reused until every argument has been consumed
+    do {
+        char **start = arg;
+        for (const char *p = format; *p; p++) {
+            if (*p == '\\') {
+                int used = print_escape(p + 1, false);
+                if (used == 0) return status;
+                p += used;
+                continue;
+            }
+            if (*p != '%') {
+                amcsh_putc(*p);
+                continue;
+            }
+            if (p[1] == '%') {
+                amcsh_putc('%');
+                p++;
+                continue;
+            }
+
+            // Copy "%[flags][width][.precision]" into spec, resolving '*'
+            char spec[64];
+            size_t n = 0;
+            spec[n++] = *p++;
+            while (*p && strchr("-+ #0", *p) && n < 40) spec[n++] = *p++;
+            for (int part = 0; part < 2; part++) {
+                if (*p == '*') {
+                    n += snprintf(spec + n, sizeof(spec) - n - 8, "%d",
+                                  *arg ? (int)printf_integer(*arg++, &status) : 0);
+                    p++;
+                } else {
+                    while (isdigit((unsigned char)*p) && n < 50) spec[n++] = *p++;
+                }
+                if (part == 0 && *p == '.') {
+                    spec[n++] = *p++;
+                } else {
+                    break;
+                }
+            }
+
+            const char *value = *arg ? *arg++ : NULL;
+            char conv = *p;
+            switch (conv) {
+                case 's':
+                    spec[n++] = 's';
+                    spec[n] = '\0';
+                    amcsh_printf(spec, value ? value : "");
+                    break;
+                case 'b':
+                    for (const char *v = value ? value : ""; *v; v++) {
+                        if (*v == '\\') {
+                            int used = print_escape(v + 1, true);
+                            if (used == 0) return status;
+                            v += used;
+                        } else {
+                            amcsh_putc(*v);
+                        }
+                    }
+                    break;
+                case 'c':
+                    if (value && *value) amcsh_putc(*value);
+                    break;
+                case 'd': case 'i':
+                    memcpy(spec + n, "lld", 4);
+                    amcsh_printf(spec, value ? printf_integer(value, &status) : 0LL);
+                    break;
+                case 'u': case 'o': case 'x': case 'X':
+                    spec[n++] = 'l';
+                    spec[n++] = 'l';
+                    spec[n++] = conv;
+                    spec[n] = '\0';
+                    amcsh_printf(spec, (unsigned long long)(value ? printf_integer(value, &status) : 0));
+                    break;
+                case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                    spec[n++] = conv;
+                    spec[n] = '\0';
+                    amcsh_printf(spec, value ? strtod(value, NULL) : 0.0);
+                    break;
+                default:
+                    fprintf(stderr, "amcsh: printf: %%%c: invalid directive\n", conv ? conv : ' ');
+                    return 1;
+            }
+        }
+        if (arg == start) break;
+    } while (*arg);
+
+    return status;
+}
+
+// cat
+
+// Move everything from in to out inside the kernel when the fd types allow it.
+// Each fast path leaves the offsets where it stopped, so on any error
+// (O_APPEND output, unsupported filesystem) the next method carries on.
+static int copy_fd(int in, int out) {
+#ifdef __linux__
+    struct stat in_st, out_st;
+    bool in_reg = fstat(in, &in_st) == 0 && S_ISREG(in_st.st_mode);
+    bool out_reg = fstat(out, &out_st) == 0 && S_ISREG(out_st.st_mode);
+    bool in_pipe = !in_reg && S_ISFIFO(in_st.st_mode);
+    bool out_pipe = !out_reg && S_ISFIFO(out_st.st_mode);
+    ssize_t n;
+
+    if (in_reg && out_reg) {
+        while ((n = copy_file_range(in, NULL, out, NULL, CAT_CHUNK, 0)) > 0);
+        if (n == 0) return 0;
+    }
+    if (in_pipe || out_pipe) {
+        while ((n = splice(in, NULL, out, NULL, CAT_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0);
+        if (n == 0) return 0;
+    }
+    if (in_reg) {
+        while ((n = sendfile(out, in, NULL, CAT_CHUNK)) > 0);
+        if (n == 0) return 0;
+    }
+#endif
+
+    // Ctrl-C stops a copy, as it would an external cat
+    static __thread char buf[CAT_BUFFER_SIZE]; // Per thread: cat stages run concurrently
+    ssize_t len;
+    while (!amcsh_interrupted && (len = read(in, buf, sizeof(buf))) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        for (ssize_t done = 0; done < len;) {
+            ssize_t w = write(out, buf + done, len - done);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            done += w;
+        }
+    }
+    if (amcsh_interrupted) {
+        errno = EINTR;
+        return -1;
+    }
+    return 0;
+}
+
+// Output captured in memory (command substitution) has no fd to copy into
+static int copy_fd_memory(int in) {
+    char buf[8192];
+    ssize_t n;
+    for (;;) {
+        n = read(in, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR && !amcsh_interrupted) continue;
+        if (n <= 0) break;
+        amcsh_write(buf, n);
+    }
+    return n < 0 ? -1 : 0;
+}
+
+// Copy in to a builtin output fd from amcsh_out_fd(), which is -1 for memory
+int amcsh_copy_fd(int in, int out) {
+    return out >= 0 ? copy_fd(in, out) : copy_fd_memory(in);
+}
+
+int amcsh_builtin_cat(char **args) {
+    int status = 0;
+    int out = amcsh_out_fd();
+    amcsh_flush();
+    amcsh_interrupted = 0;
+
+    int i = 1;
+    if (args[i] && strcmp(args[i], "--") == 0) i++;
+    bool from_stdin = !args[i];
+
+    for (; from_stdin || args[i]; i++) {
+        const char *name = from_stdin ? "-" : args[i];
+        bool is_stdin = strcmp(name, "-") == 0;
+        int in = is_stdin ? amcsh_in_fd() : open(name, O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            fprintf(stderr, "amcsh: cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        int result = amcsh_copy_fd(in, out);
+        if (!is_stdin) close(in);
+        if (result != 0 && errno == EPIPE) {
+            // The reader went away, as with "cat big | head"
+            return 1;
+        }
+        if (result != 0 && errno == EINTR) {
+            return 130;
+        }
+        if (result != 0) {
+            fprintf(stderr, "amcsh: cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+        }
+        if (from_stdin) break;
+    }
+    return status;
+}
+
+// tee
+
+#define TEE_PIPE_SIZE (1 << 20)
+#define TEE_MAX_OUTPUTS 64
+
+typedef enum {
+    TEE_PIPE,              // tee(2) straight from the chunk
+    TEE_SPLICE,            // splice(2) from a copy of the chunk
+    TEE_WRITE,             // read the copy and write(2) it
+} tee_mode_t;
+
+typedef struct {
+    int fd;
+    const char *name;
+    tee_mode_t mode;
+    bool failed;
+} tee_output_t;
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= w;
+    }
+    return 0;
+}
+
+static void tee_error(tee_output_t *o, int *status) {
+    // A reader that went away is not worth a message, as with cat
+    if (errno != EPIPE) {
+        fprintf(stderr, "amcsh: tee: %s: %s\n", o->name, strerror(errno));
+    }
+    o->failed = true;
+    *status = 1;
+}
+
+#ifdef __linux__
+typedef struct {
+    int chunk[2];          // The bytes being fanned out; consumed once all have them
+    int spare[2];          // A second reference to them, for partial and non-pipe outputs
+    int devnull;
+    size_t size;
+} tee_pipes_t;
+
+static bool tee_pipes_open(tee_pipes_t *t) {
+    t->chunk[0] = t->chunk[1] = t->spare[0] = t->spare[1] = -1;
+    t->devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (t->devnull < 0 || pipe2(t->chunk, O_CLOEXEC) != 0 || pipe2(t->spare, O_CLOEXEC) != 0) {
+        return false;
+    }
+    // spare must hold everything chunk can, so both get the same size
+    fcntl(t->chunk[1], F_SETPIPE_SZ, TEE_PIPE_SIZE);
+    fcntl(t->spare[1], F_SETPIPE_SZ, TEE_PIPE_SIZE);
+    int a = fcntl(t->chunk[1], F_GETPIPE_SZ), b = fcntl(t->spare[1], F_GETPIPE_SZ);
+    if (a <= 0 || b <= 0) {
+        return false;
+    }
+    if (a != b) {
+        fcntl(a > b ? t->chunk[1] : t->spare[1], F_SETPIPE_SZ, a < b ? a : b);
+    }
+    t->size = a < b ? a : b;
+    return true;
+}
+
+static void tee_pipes_close(tee_pipes_t *t) {
+    int fds[] = {t->chunk[0], t->chunk[1], t->spare[0], t->spare[1], t->devnull};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+}
+
+// Give out the n bytes waiting in the chunk pipe without consuming them. A
+// pipe output takes references to the pages with tee(2). When it has room
+// for only part of them, or is not a pipe, a second tee into the spare pipe
+// makes a copy that can be consumed from the right offset.
+static int tee_send(tee_pipes_t *t, tee_output_t *o, size_t n) {
+    ssize_t sent = 0;
+    if (o->mode == TEE_PIPE) {
+        while ((sent = tee(t->chunk[0], o->fd, n, 0)) < 0 && errno == EINTR);
+        if (sent < 0) {
+            return -1;
+        }
+        if ((size_t)sent == n) {
+            return 0;
+        }
+    }
+    if (tee(t->chunk[0], t->spare[1], n, 0) != (ssize_t)n) {
+        return -1;
+    }
+    if (sent > 0 && splice(t->spare[0], NULL, t->devnull, NULL, sent, 0) != sent) {
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t left = n - sent; left > 0;) {
+        ssize_t m = -1;
+        if (o->mode != TEE_WRITE) {
+            m = splice(t->spare[0], NULL, o->fd, NULL, left, SPLICE_F_MORE);
+            if (m < 0 && errno == EINVAL) {
+                o->mode = TEE_WRITE; // O_APPEND file, tty, or no splice support
+                continue;
+            }
+        } else {
+            static __thread char buf[CAT_BUFFER_SIZE];
+            m = read(t->spare[0], buf, left < sizeof(buf) ? left : sizeof(buf));
+            if (m > 0 && write_all(o->fd, buf, m) != 0) {
+                m = -1;
+            }
+        }
+        if (m < 0 && errno == EINTR) {
+            continue;
+        }
+        if (m <= 0) {
+            result = -1;
+            break;
+        }
+        left -= m;
+    }
+
+    // Whatever an output refused must not be left for the next one
+    int saved = errno;
+    while (splice(t->spare[0], NULL, t->devnull, NULL, t->size, SPLICE_F_NONBLOCK) > 0);
+    errno = saved;
+    return result;
+}
+
+// Returns 1 if the input cannot be spliced, before anything was consumed
+static int tee_splice(int in, tee_output_t *outputs, int count, int *status) {
+    tee_pipes_t t;
+    if (!tee_pipes_open(&t)) {
+        tee_pipes_close(&t);
+        return 1;
+    }
+
+    bool first = true;
+    for (;;) {
+        ssize_t n = splice(in, NULL, t.chunk[1], NULL, t.size, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && first && errno == EINVAL) {
+            tee_pipes_close(&t);
+            return 1;
+        }
+        if (n < 0) {
+            fprintf(stderr, "amcsh: tee: read error: %s\n", strerror(errno));
+            *status = 1;
+        }
+        if (n <= 0) {
+            break;
+        }
+        first = false;
+
+        int live = 0;
+        for (int i = 0; i < count; i++) {
+            if (outputs[i].failed) continue;
+            if (tee_send(&t, &outputs[i], n) != 0) {
+                tee_error(&outputs[i], status);
+            } else {
+                live++;
+            }
+        }
+        if (splice(t.chunk[0], NULL, t.devnull, NULL, n, 0) != n || live == 0) {
+            break;
+        }
+    }
+    tee_pipes_close(&t);
+    return 0;
+}
+#endif
+
+static void tee_copy(int in, tee_output_t *outputs, int count, int *status) {
+    static __thread char buf[CAT_BUFFER_SIZE];
+    for (;;) {
+        ssize_t n = read(in, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "amcsh: tee: read error: %s\n", strerror(errno));
+            *status = 1;
+        }
+        if (n <= 0) {
+            return;
+        }
+        int live = 0;
+        for (int i = 0; i < count; i++) {
+            if (outputs[i].failed) continue;
+            int result = 0;
+            if (outputs[i].fd < 0) {
+                amcsh_write(buf, n); // Captured in memory
+            } else {
+                result = write_all(outputs[i].fd, buf, n);
+            }
+            if (result != 0) {
+                tee_error(&outputs[i], status);
+            } else {
+                live++;
+            }
+        }
+        if (live == 0) {
+            return;
+        }
+    }
+}
+
+// Every output gets the input by reference: tee(2) into pipes, splice(2)
+// into files, so fanning a stream out to several readers copies nothing in
+// user space. Slow readers hold the others back, as with any tee.
+int amcsh_builtin_tee(char **args) {
+    bool append = false;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-a") == 0) {
+            append = true;
+        } else {
+            fprintf(stderr, "amcsh: tee: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+
+    tee_output_t outputs[TEE_MAX_OUTPUTS];
+    int count = 0, status = 0;
+    amcsh_flush();
+    outputs[count++] = (tee_output_t){amcsh_out_fd(), "standard output", TEE_SPLICE, false};
+    for (; args[i]; i++) {
+        if (count == TEE_MAX_OUTPUTS) {
+            fprintf(stderr, "amcsh: tee: too many files\n");
+            status = 1;
+            break;
+        }
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+        int fd = open(args[i], flags, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "amcsh: tee: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        outputs[count++] = (tee_output_t){fd, args[i], TEE_SPLICE, false};
+    }
+
+    int in = amcsh_in_fd();
+    bool memory = outputs[0].fd < 0;
+#ifdef __linux__
+    for (int j = 0; j < count; j++) {
+        struct stat st;
+        if (outputs[j].fd >= 0 && fstat(outputs[j].fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            outputs[j].mode = TEE_PIPE;
+        }
+    }
+    if (memory || tee_splice(in, outputs, count, &status) != 0) {
+        tee_copy(in, outputs, count, &status);
+    }
+#else
+    tee_copy(in, outputs, count, &status);
+#endif
+
+    for (int j = 1; j < count; j++) {
+        close(outputs[j].fd);
+    }
+    return status;
+}
+
+// basename / dirname
+
+int amcsh_builtin_basename(char **args) {
+    if (!args[1]) {
+        fprintf(stderr, "amcsh: basename: missing operand\n");
+        return 1;
+    }
+
+    const char *name = args[1];
+    size_t len = strlen(name);
+    while (len > 1 && name[len - 1] == '/') len--;
+
+    const char *start = name;
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (name[i] == '/') start = name + i + 1;
+    }
+    len -= start - name;
+
+    if (args[2]) {
+        size_t suffix_len = strlen(args[2]);
+        if (suffix_len < len && memcmp(start + len - suffix_len, args[2], suffix_len) == 0) {
+            len -= suffix_len;
+        }
+    }
+    amcsh_printf("%.*s\n", (int)len, start);
+    return 0;
+}
+
+int amcsh_builtin_dirname(char **args) {
+    if (!args[1]) {
+        fprintf(stderr, "amcsh: dirname: missing operand\n");
+        return 1;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        const char *name = args[i];
+        size_t len = strlen(name);
+
+        // Drop trailing slashes, the last component, then the slashes before it
+        while (len > 1 && name[len - 1] == '/') len--;
+        while (len > 0 && name[len - 1] != '/') len--;
+        while (len > 1 && name[len - 1] == '/') len--;
+
+        if (len == 0) {
+            amcsh_printf(".\n");
+        } else {
+            amcsh_printf("%.*s\n", (int)len, name);
+        }
+    }
+    return 0;
+}
+
+// mkdir
+
+static int make_parents(char *path, mode_t mode) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        int result = mkdir(path, 0777);
+        *p = '/';
+        if (result != 0 && errno != EEXIST) return -1;
+    }
+    if (mkdir(path, mode) != 0) {
+        struct stat st;
+        if (errno == EEXIST && stat(path, &st) == 0 && S_ISDIR(st.st_mode)) return 0;
+        return -1;
+    }
+    return 0;
+}
+
+int amcsh_builtin_mkdir(char **args) {
+    bool parents = false;
+    mode_t mode = 0777;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-p") == 0) {
+            parents = true;
+        } else if (strcmp(args[i], "-m") == 0 && args[i + 1]) {
+            mode = (mode_t)strtol(args[++i], NULL, 8);
+        } else {
+            fprintf(stderr, "amcsh: mkdir: %s: invalid option\n", args[i]);
+            return 1;
+        }
+    }
+    if (!args[i]) {
+        fprintf(stderr, "amcsh: mkdir: missing operand\n");
+        return 1;
+    }
+
+    int status = 0;
+    for (; args[i]; i++) {
+        int result;
+        if (parents) {
+            char *path = strdup(args[i]);
+            result = make_parents(path, mode);
+            free(path);
+        } else {
+            result = mkdir(args[i], mode);
+        }
+        if (result != 0) {
+            fprintf(stderr, "amcsh: mkdir: %s: %s\n", args[i], strerror(errno));
+            status = 1;
+        } else if (mode != 0777) {
+            chmod(args[i], mode);
+        }
+    }
+    return status;
+}
+
+// sleep
+
+int amcsh_builtin_sleep(char **args) {
+    if (!args[1]) {
+        fprintf(stderr, "amcsh: sleep: missing operand\n");
+        return 1;
+    }
+
+    double seconds = 0;
+    for (int i = 1; args[i]; i++) {
+        char *end;
+        double value = strtod(args[i], &end);
+        double scale = 1;
+        switch (*end) {
+            case '\0': case 's': break;
+            case 'm': scale = 60; break;
+            case 'h': scale = 3600; break;
+            case 'd': scale = 86400; break;
+            default: end = NULL;
+        }
+        if (!end || end == args[i] || (*end && end[1]) || value < 0) {
+            fprintf(stderr, "amcsh: sleep: invalid time interval '%s'\n", args[i]);
+            return 1;
+        }
+        seconds += value * scale;
+    }
+
+    // Other signals (SIGCHLD) resume the sleep; Ctrl-C ends it
+    struct timespec req, rem;
+    req.tv_sec = (time_t)seconds;
+    req.tv_nsec = (long)((seconds - (double)req.tv_sec) * 1e9);
+    amcsh_interrupted = 0;
+    while (nanosleep(&req, &rem) != 0 && errno == EINTR) {
+        if (amcsh_interrupted) {
+            return 130;
+        }
+        req = rem;
+    }
+    return 0;
+}
+
+// read
+
+// Read one line from stdin without consuming input that belongs to later commands
+static char *read_line_fd(int fd, bool *eof) {
+    size_t len = 0, cap = 128;
+    char *line = malloc(cap);
+    struct stat st;
+    bool seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    *eof = false;
+    while (line) {
+        char chunk[512];
+        // Regular files can be over-read and rewound; pipes and ttys go byte by byte
+        ssize_t n = read(fd, chunk, seekable ? sizeof(chunk) : 1);
+        if (n < 0 && errno == EINTR && !amcsh_interrupted) continue;
+        if (n <= 0) {
+            *eof = true;
+            break;
+        }
+
+        ssize_t used = n;
+        char *newline = memchr(chunk, '\n', n);
+        if (newline) used = newline - chunk + 1;
+        if (seekable && used < n) {
+            lseek(fd, used - n, SEEK_CUR);
+        }
+
+        if (len + used + 1 > cap) {
+            while (len + used + 1 > cap) cap *= 2;
+            line = realloc(line, cap);
+            if (!line) break;
+        }
+        memcpy(line + len, chunk, used);
+        len += used;
+        if (newline) break;
+    }
+
+    if (line) {
+        if (len > 0 && line[len - 1] == '\n') len--;
+        line[len] = '\0';
+    }
+    return line;
+}
+
+int amcsh_builtin_read(char **args) {
+    bool raw = false;
+    const char *prompt = NULL;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "-r") == 0) {
+            raw = true;
+        } else if (strcmp(args[i], "-p") == 0 && args[i + 1]) {
+            prompt = args[++i];
+        } else if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            fprintf(stderr, "amcsh: read: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+
+    if (prompt && isatty(amcsh_in_fd())) {
+        fputs(prompt, stderr);
+    }
+
+    bool eof;
+    amcsh_interrupted = 0;
+    char *line = read_line_fd(amcsh_in_fd(), &eof);
+    if (!line) {
+        return 1;
+    }
+    if (amcsh_interrupted) {
+        free(line);
+        return 130;
+    }
+
+    // Without -r a backslash escapes the next character
+    if (!raw) {
+        char *dst = line;
+        for (char *src = line; *src; src++) {
+            if (*src == '\\' && src[1]) src++;
+            *dst++ = *src;
+        }
+        *dst = '\0';
+    }
+
+    char *names_default[] = {"REPLY", NULL};
+    char **names = args[i] ? args + i : names_default;
+    char *field = line;
+    bool default_var = !args[i];
+
+    for (int n = 0; names[n]; n++) {
+        if (!default_var) {
+            while (isspace((unsigned char)*field)) field++;
+        }
+        char *value = field;
+        if (names[n + 1]) {
+            while (*field && !isspace((unsigned char)*field)) field++;
+            if (*field) *field++ = '\0';
+        } else if (!default_var) {
+            // The last variable takes the rest, minus trailing whitespace
+            char *end = value + strlen(value);
+            while (end > value && isspace((unsigned char)end[-1])) end--;
+            *end = '\0';
+        }
+        setenv(names[n], value, 1);
+    }
+
+    bool empty = eof && line[0] == '\0';
+    free(line);
+    return empty ? 1 : 0;
+}
+
+// kill
+
+static const struct {
+    const char *name;
+    int signo;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+    {"TERM", SIGTERM}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM},
+    {"PIPE", SIGPIPE}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH},
+    {NULL, 0}
+};
+
+static int parse_signal(const char *name) {
+    if (isdigit((unsigned char)*name)) {
+        return atoi(name);
+    }
+    if (strncasecmp(name, "SIG", 3) == 0) {
+        name += 3;
+    }
+    for (int i = 0; signal_names[i].name; i++) {
+        if (strcasecmp(name, signal_names[i].name) == 0) {
+            return signal_names[i].signo;
+        }
+    }
+    return -1;
+}
+
+int amcsh_builtin_kill(char **args) {
+    int signo = SIGTERM;
+    int i = 1;
+
+    if (args[1] && strcmp(args[1], "-l") == 0) {
+        for (int s = 0; signal_names[s].name; s++) {
+            amcsh_printf("%2d) SIG%s\n", signal_names[s].signo, signal_names[s].name);
+        }
+        return 0;
+    }
+
+    if (args[i] && strcmp(args[i], "-s") == 0 && args[i + 1]) {
+        signo = parse_signal(args[i + 1]);
+        i += 2;
+    } else if (args[i] && args[i][0] == '-' && args[i][1] && strcmp(args[i], "--") != 0) {
+        signo = parse_signal(args[i] + 1);
+        i++;
+    }
+    if (args[i] && strcmp(args[i], "--") == 0) i++;
+
+    if (signo < 0) {
+        fprintf(stderr, "amcsh: kill: %s: invalid signal specification\n", args[i - 1]);
+        return 1;
+    }
+    if (!args[i]) {
+        fprintf(stderr, "amcsh: kill: usage: kill [-s sigspec | -sigspec] pid | %%job ...\n");
+        return 2;
+    }
+
+    int status = 0;
+    for (; args[i]; i++) {
+        char *end;
+        if (args[i][0] == '%') {
+            // "%N" names a job as listed by "jobs"
+            if (amcsh_job_kill(atoi(args[i] + 1), signo) != 0) {
+                if (errno == ESRCH) {
+                    fprintf(stderr, "amcsh: kill: %s: no such job\n", args[i]);
+                } else {
+                    fprintf(stderr, "amcsh: kill: (%s) - %s\n", args[i], strerror(errno));
+                }
+                status = 1;
+            }
+            continue;
+        }
+        pid_t pid = (pid_t)strtol(args[i], &end, 10);
+        if (*end || end == args[i]) {
+            fprintf(stderr, "amcsh: kill: %s: arguments must be process or job IDs\n", args[i]);
+            status = 1;
+            continue;
+        }
+        if (kill(pid, signo) != 0) {
+            fprintf(stderr, "amcsh: kill: (%s) - %s\n", args[i], strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
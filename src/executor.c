@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "amcsh.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,141 +6,567 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/wait.h>
-#include <spawn.h>
+#include <limits.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include "trace.h"
+#include "amcsh_builtin_hash.h"
 
-extern char **environ;
-extern amcsh_state_t shell_state;
+// Registry generated from builtins.def; slots come from the build-time perfect hash
+const amcsh_builtin_t amcsh_builtins[] = {
+#define AMCSH_BUILTIN(name, func, flags, summary, usage) \
+    {name, func, NULL, flags, summary, usage},
+#define AMCSH_PREFIX(name, func, flags, summary, usage) \
+    {name, NULL, func, (flags) | AMCSH_BUILTIN_PREFIX, summary, usage},
+#include "builtins.def"
+#undef AMCSH_BUILTIN
+#undef AMCSH_PREFIX
+};
 
-// Built-in command function type
-typedef int (*builtin_func)(char **);
+const int amcsh_builtin_count = sizeof(amcsh_builtins) / sizeof(amcsh_builtins[0]);
 
-// Built-in command structure
-typedef struct {
-    const char *name;
-    builtin_func func;
-} builtin_cmd_t;
-
-// List of built-in commands
-static builtin_cmd_t builtins[] = {
-    {"cd", amcsh_builtin_cd},
-    {"clear", amcsh_builtin_clear},
-    {"exit", amcsh_builtin_exit},
-    {"history", amcsh_builtin_history},
-    {"jobs", amcsh_builtin_jobs},
-    {"fg", amcsh_builtin_fg},
-    {"bg", amcsh_builtin_bg},
-    {"pwd", amcsh_builtin_pwd},
-    {"echo", amcsh_builtin_echo},
-    {"help", amcsh_builtin_help},
-    {NULL, NULL}
-};
+// Optional builtins turned off with "enable -n"
+static bool builtin_disabled[sizeof(amcsh_builtins) / sizeof(amcsh_builtins[0])];
+
+bool amcsh_builtin_enabled(const amcsh_builtin_t *builtin) {
+    return !builtin_disabled[builtin - amcsh_builtins];
+}
+
+void amcsh_builtin_set_enabled(const amcsh_builtin_t *builtin, bool enabled) {
+    builtin_disabled[builtin - amcsh_builtins] = !enabled;
+}
+
+// One hash and one string compare per command name
+const amcsh_builtin_t *amcsh_builtin_lookup(const char *name) {
+    uint32_t slot = amcsh_builtin_hash(name, AMCSH_BUILTIN_HASH_SEED) & (AMCSH_BUILTIN_HASH_SIZE - 1);
+    int index = amcsh_builtin_slots[slot];
+    if (index < 0 || strcmp(amcsh_builtins[index].name, name) != 0) {
+        return NULL;
+    }
+    return &amcsh_builtins[index];
+}
+
+// Resolve argv[0] against the registry, applying prefix builtins such as "command"
+void amcsh_resolve_command(amcsh_command_t *cmd) {
+    cmd->builtin = NULL;
+
+    while (cmd->argc > 0) {
+        AMCSH_TRACE_BEGIN(lookup_start);
+        const amcsh_builtin_t *builtin = amcsh_builtin_lookup(cmd->argv[0]);
+        AMCSH_TRACE_END(AMCSH_PHASE_LOOKUP, lookup_start);
+        if (builtin && (builtin->flags & AMCSH_BUILTIN_OPTIONAL) &&
+            (cmd->external_only || !amcsh_builtin_enabled(builtin))) {
+            builtin = NULL; // Fall through to the external utility
+        }
+        if (!builtin || !(builtin->flags & AMCSH_BUILTIN_PREFIX)) {
+            cmd->builtin = builtin;
+            return;
+        }
 
-// Find built-in command
-builtin_func get_builtin(const char *cmd) {
-    for (builtin_cmd_t *builtin = builtins; builtin->name; builtin++) {
-        if (strcmp(cmd, builtin->name) == 0) {
-            return builtin->func;
+        int used = builtin->prefix(cmd);
+        if (used < 0) {
+            cmd->argc = 0;
+            cmd->argv[0] = NULL;
+            shell_state.exit_status = 2;
+            return;
         }
+        cmd->argv += used;
+        cmd->argc -= used;
     }
-    return NULL;
 }
 
-// Fast path for built-in commands
+// Where a command's stderr goes: its 2> redirection, or for 2>&1 the stage's
+// pipe or the inherited stdout; -1 leaves it alone
+int amcsh_stderr_fd(const amcsh_command_t *cmd) {
+    if (cmd->redirect_err >= 0) {
+        return cmd->redirect_err;
+    }
+    if (cmd->err_to_out) {
+        return cmd->pipe_write >= 0 ? cmd->pipe_write : STDOUT_FILENO;
+    }
+    return -1;
+}
+
+// Run a builtin with its redirections or pipe ends as its standard streams.
+// The fds are consumed; the status is returned without touching shell state.
+static int run_builtin(amcsh_command_t *cmd) {
+    int in = cmd->redirect_in >= 0 ? cmd->redirect_in : cmd->pipe_read;
+    int out_fd = cmd->redirect_out >= 0 ? cmd->redirect_out : cmd->pipe_write;
+
+    // A memory capture set up by the caller stays in place unless redirected
+    amcsh_output_t out;
+    char buf[AMCSH_OUTPUT_BUFFER_SIZE];
+    bool own_output = out_fd >= 0 || amcsh_out_fd() >= 0;
+    if (own_output) {
+        amcsh_output_init(&out, out_fd >= 0 ? out_fd : STDOUT_FILENO, buf, sizeof(buf));
+    }
+
+    // Anything the shell itself printed must come out first
+    fflush(stdout);
+
+    // Builtins report errors on fd 2, so a redirected stderr is swapped in.
+    // 2>&1 into a memory capture has no fd to point at and is left alone.
+    int err_fd = amcsh_stderr_fd(cmd);
+    if (err_fd == STDOUT_FILENO && out_fd < 0) {
+        err_fd = amcsh_out_fd();
+    }
+    int saved_err = err_fd >= 0 ? fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 10) : -1;
+    if (saved_err >= 0) {
+        dup2(err_fd, STDERR_FILENO);
+    }
+
+    amcsh_io_t saved;
+    amcsh_io_enter(own_output ? &out : NULL, in, &saved);
+    int status = cmd->builtin->func(cmd->argv);
+    amcsh_io_leave(&saved);
+
+    if (saved_err >= 0) {
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_err);
+    }
+    if (cmd->redirect_in >= 0) close(cmd->redirect_in);
+    if (cmd->pipe_read >= 0) close(cmd->pipe_read);
+    if (cmd->redirect_out >= 0) close(cmd->redirect_out);
+    if (cmd->redirect_err >= 0) close(cmd->redirect_err);
+    if (cmd->pipe_write >= 0) close(cmd->pipe_write);
+    cmd->redirect_in = cmd->redirect_out = cmd->redirect_err = -1;
+    cmd->pipe_read = cmd->pipe_write = -1;
+    return status;
+}
+
+// Run a builtin resolved by the parser
 int amcsh_execute_builtin(amcsh_command_t *cmd) {
-    // Use the generic builtin lookup function instead of hardcoding
-    builtin_func builtin = get_builtin(cmd->argv[0]);
-    if (builtin) {
-        return builtin(cmd->argv);
+    if (!cmd->builtin || !cmd->builtin->func) {
+        return -1; // Not a builtin
+    }
+    if (cmd->redirect_failed) {
+        return shell_state.exit_status; // Set by the parser
     }
-    return -1; // Not a builtin
+    shell_state.exit_status = run_builtin(cmd);
+    return shell_state.exit_status;
 }
 
-int amcsh_execute(amcsh_command_t *cmd)
-{
-    if (!cmd || !cmd->argv[0]) {
-        return -1;
+// Look argv[0] up in the command cache, then the shared cache, falling back
+// to a PATH search
+int amcsh_command_path(const char *name, char *path, size_t size) {
+    char *cached = strchr(name, '/') ? NULL : amcsh_cache_lookup(name);
+    if (cached) {
+        size_t len = strlen(cached);
+        bool usable = len < size && access(cached, X_OK) == 0;
+        if (usable) {
+            memcpy(path, cached, len + 1);
+        }
+        free(cached);
+        if (usable) {
+            return 0;
+        }
     }
 
-    // Check for built-in commands
-    builtin_func builtin = get_builtin(cmd->argv[0]);
-    if (builtin) {
-        return builtin(cmd->argv);
+    if (strchr(name, '/')) {
+        return amcsh_spawn_resolve(name, path, size);
     }
 
-    // Setup file actions for redirection
-    posix_spawn_file_actions_t actions;
-    posix_spawn_file_actions_init(&actions);
+    // Another shell on the host may already have searched PATH for it
+    if (amcsh_shm_cache_lookup(name, path, size) == 0) {
+        amcsh_cache_update(name, path);
+        return 0;
+    }
 
-    if (cmd->redirect_in >= 0) {
-        posix_spawn_file_actions_adddup2(&actions, cmd->redirect_in, STDIN_FILENO);
-        posix_spawn_file_actions_addclose(&actions, cmd->redirect_in);
+    int err = amcsh_spawn_resolve(name, path, size);
+    if (err == 0) {
+        amcsh_cache_update(name, path);
+        amcsh_shm_cache_store(name, path);
     }
-    if (cmd->redirect_out >= 0) {
-        posix_spawn_file_actions_adddup2(&actions, cmd->redirect_out, STDOUT_FILENO);
-        posix_spawn_file_actions_addclose(&actions, cmd->redirect_out);
+    return err;
+}
+
+// Start an external command; the parent's copies of its fds are closed
+pid_t amcsh_spawn(amcsh_command_t *cmd)
+{
+    // Output written so far must reach the terminal before the child's
+    fflush(stdout);
+    amcsh_flush();
+
+    amcsh_spawn_req_t req;
+    amcsh_spawn_req_init(&req, cmd->argv);
+
+    // Explicit redirections take precedence over pipe ends
+    req.fds[STDIN_FILENO] = cmd->redirect_in >= 0 ? cmd->redirect_in : cmd->pipe_read;
+    req.fds[STDOUT_FILENO] = cmd->redirect_out >= 0 ? cmd->redirect_out : cmd->pipe_write;
+
+    // Affinity, priority and limits from pin/nice/limit prefixes
+    req.attr = cmd->spawn_attr;
+
+    // A captured background job writes both streams into its log
+    if (cmd->job_log >= 0) {
+        req.fds[STDERR_FILENO] = cmd->job_log;
+        if (req.fds[STDOUT_FILENO] < 0) {
+            req.fds[STDOUT_FILENO] = cmd->job_log;
+        }
     }
-    if (cmd->pipe_read >= 0) {
-        posix_spawn_file_actions_adddup2(&actions, cmd->pipe_read, STDIN_FILENO);
-        posix_spawn_file_actions_addclose(&actions, cmd->pipe_read);
+
+    // Descriptors are moved in order, so "2>&1 >file" needs a copy of the
+    // stdout it had before fd 1 is replaced
+    int err_fd = amcsh_stderr_fd(cmd);
+    int err_copy = -1;
+    if (err_fd == STDOUT_FILENO && cmd->job_log >= 0) {
+        err_fd = cmd->job_log;
+    } else if (err_fd == STDOUT_FILENO && req.fds[STDOUT_FILENO] >= 0) {
+        err_fd = err_copy = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
     }
-    if (cmd->pipe_write >= 0) {
-        posix_spawn_file_actions_adddup2(&actions, cmd->pipe_write, STDOUT_FILENO);
-        posix_spawn_file_actions_addclose(&actions, cmd->pipe_write);
+    if (err_fd >= 0) {
+        req.fds[STDERR_FILENO] = err_fd;
     }
 
-    // Setup spawn attributes
-    posix_spawnattr_t attr;
-    posix_spawnattr_init(&attr);
+    // Pipes of process substitutions are passed as /dev/fd/N arguments
+    req.inherit = cmd->procsub_fds;
+    req.inherit_count = cmd->procsub_count;
 
     // Set the process group
     if (shell_state.interactive) {
-        posix_spawnattr_setpgroup(&attr, 0);
-        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        req.set_pgid = true;
+        req.pgid = cmd->pgid;
     }
 
-    // Spawn the process
-    pid_t pid;
-    int status = posix_spawnp(&pid, cmd->argv[0], &actions, &attr, cmd->argv, environ);
-
-    // Cleanup
-    posix_spawn_file_actions_destroy(&actions);
-    posix_spawnattr_destroy(&attr);
+    char path[PATH_MAX];
+    pid_t pid = -1;
+    AMCSH_TRACE_BEGIN(cache_start);
+    int err = amcsh_command_path(cmd->argv[0], path, sizeof(path));
+    AMCSH_TRACE_END(AMCSH_PHASE_CACHE, cache_start);
+    if (err == 0) {
+        req.path = path;
+        AMCSH_TRACE_BEGIN(spawn_start);
+        pid = amcsh_spawn_process(&req, NULL);
+        err = pid < 0 ? errno : 0;
+        AMCSH_TRACE_END(AMCSH_PHASE_SPAWN, spawn_start);
+    }
 
-    if (status != 0) {
-        fprintf(stderr, "amcsh: command not found: %s\n", cmd->argv[0]);
-        shell_state.exit_status = 127;
-        return -1;
+    if (pid < 0) {
+        if (err == ENOENT) {
+            fprintf(stderr, "amcsh: command not found: %s\n", cmd->argv[0]);
+        } else {
+            fprintf(stderr, "amcsh: %s: %s\n", cmd->argv[0], strerror(err));
+        }
+        shell_state.exit_status = err == ENOENT ? 127 : 126;
     }
 
     // Close pipe/redirect file descriptors in parent
+    if (err_copy >= 0) close(err_copy);
     if (cmd->redirect_in >= 0) close(cmd->redirect_in);
     if (cmd->redirect_out >= 0) close(cmd->redirect_out);
+    if (cmd->redirect_err >= 0) close(cmd->redirect_err);
+    if (cmd->pipe_read >= 0) close(cmd->pipe_read);
+    if (cmd->pipe_write >= 0) close(cmd->pipe_write);
+    cmd->redirect_in = cmd->redirect_out = cmd->redirect_err = -1;
+    cmd->pipe_read = cmd->pipe_write = -1;
+
+    return pid;
+}
+
+// Pipeline stage bookkeeping; builtin stages report back through done
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int running;           // Builtin stages still on worker threads
+} pipeline_t;
+
+typedef struct {
+    amcsh_command_t *cmd;
+    pipeline_t *pipeline;
+    pid_t pid;             // Process running the stage, 0 for in-process builtins
+    int status;
+    struct rusage before;  // Thread usage around an in-process stage
+    struct rusage after;
+} pipeline_stage_t;
+
+// A builtin writing into a pipe whose reader has exited gets EPIPE
+// instead of a SIGPIPE that would kill the whole shell
+static int run_stage_builtin(amcsh_command_t *cmd, struct rusage *before, struct rusage *after) {
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+
+    getrusage(RUSAGE_THREAD, before);
+    int status = run_builtin(cmd);
+    getrusage(RUSAGE_THREAD, after);
+
+    struct timespec poll = {0, 0};
+    while (sigtimedwait(&pipe_set, NULL, &poll) > 0);
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return status;
+}
+
+static void *stage_task(void *arg) {
+    pipeline_stage_t *stage = arg;
+    stage->status = run_stage_builtin(stage->cmd, &stage->before, &stage->after);
+
+    pthread_mutex_lock(&stage->pipeline->lock);
+    stage->pipeline->running--;
+    pthread_cond_signal(&stage->pipeline->done);
+    pthread_mutex_unlock(&stage->pipeline->lock);
+    return NULL;
+}
+
+// First thing in a forked subshell, after any process group change. Pool
+// workers do not survive fork, the child never owns the terminal, signals
+// blocked by the forking thread are unblocked, and builtins write to fd 1
+// (or read from in, when it is not -1) rather than to whatever the parent
+// was capturing.
+void amcsh_child_enter(amcsh_child_t *child, int in) {
+    shell_state.thread_pool = NULL;
+    shell_state.interactive = false;
+
+    sigset_t none;
+    sigemptyset(&none);
+    pthread_sigmask(SIG_SETMASK, &none, NULL);
+
+    amcsh_output_init(&child->out, STDOUT_FILENO, child->buf, sizeof(child->buf));
+    amcsh_io_enter(&child->out, in, &child->saved);
+}
+
+void amcsh_child_exit(amcsh_child_t *child, int status) {
+    amcsh_io_leave(&child->saved);
+    fflush(stdout);
+    _exit(status);
+}
+
+// Builtins that change shell state (cd, exit, read) and groups run in a child
+// like any subshell
+static pid_t fork_builtin(amcsh_command_t *head, amcsh_command_t *cmd) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Only this stage's ends may stay open, or readers never see EOF
+        for (amcsh_command_t *other = head; other; other = other->next) {
+            if (other == cmd) continue;
+            if (other->pipe_read >= 0) close(other->pipe_read);
+            if (other->pipe_write >= 0) close(other->pipe_write);
+        }
+        if (shell_state.interactive) {
+            setpgid(0, cmd->pgid);
+        }
+        amcsh_child_t child;
+        amcsh_child_enter(&child, -1);
+        if (cmd->job_log >= 0) {
+            amcsh_joblog_child(cmd->job_log, true);
+        }
+        int err_fd = amcsh_stderr_fd(cmd);
+        if (err_fd >= 0) {
+            dup2(err_fd, STDERR_FILENO);
+        }
+        amcsh_child_exit(&child, cmd->group ? amcsh_group_run(cmd, true) : run_builtin(cmd));
+    }
+    if (pid < 0) {
+        perror("amcsh: fork");
+    } else if (shell_state.interactive) {
+        setpgid(pid, cmd->pgid ? cmd->pgid : pid);
+    }
+
     if (cmd->pipe_read >= 0) close(cmd->pipe_read);
     if (cmd->pipe_write >= 0) close(cmd->pipe_write);
+    cmd->pipe_read = cmd->pipe_write = -1;
+    return pid;
+}
+
+// Run every stage concurrently. Pure builtins stay in this process: the first
+// one runs on the shell thread once the others have started, the rest on idle
+// pool workers, writing straight into their pipes with the kernel providing
+// flow control. The last stage's status becomes the pipeline's.
+static int execute_pipeline(amcsh_command_t *head, amcsh_usage_t *usage) {
+    int count = 0;
+    for (amcsh_command_t *c = head; c; c = c->next) count++;
+
+    pipeline_stage_t *stages = calloc(count, sizeof(pipeline_stage_t));
+    pipeline_t pipeline = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+    pipeline_stage_t *inline_stage = NULL;
+    pid_t pgid = 0;
+    int prev_read = -1;
+    int log_read = -1;
+    int log = head->background ? amcsh_joblog_open(&log_read) : -1;
+
+    int i = 0;
+    for (amcsh_command_t *c = head; c; c = c->next, i++) {
+        pipeline_stage_t *stage = &stages[i];
+        stage->cmd = c;
+        stage->pipeline = &pipeline;
+        c->job_log = log;
+
+        c->pipe_read = prev_read;
+        prev_read = -1;
+        if (c->next) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                perror("amcsh: pipe");
+                stage->status = 1;
+                break;
+            }
+            c->pipe_write = fds[1];
+            prev_read = fds[0];
+        }
+        c->pgid = pgid;
+
+        if ((c->argc == 0 && !c->group) || c->redirect_failed) {
+            stage->status = c->redirect_failed ? 1 : 0;
+            if (c->pipe_read >= 0) close(c->pipe_read);
+            if (c->pipe_write >= 0) close(c->pipe_write);
+            c->pipe_read = c->pipe_write = -1;
+            continue;
+        }
+
+        bool in_process = c->builtin && c->builtin->func &&
+                          (c->builtin->flags & AMCSH_BUILTIN_PURE) && !head->background &&
+                          amcsh_stderr_fd(c) < 0; // fd 2 is shared by the whole shell
+        if (in_process && !inline_stage) {
+            inline_stage = stage;
+            continue;
+        }
+        if (in_process) {
+            pthread_mutex_lock(&pipeline.lock);
+            pipeline.running++;
+            pthread_mutex_unlock(&pipeline.lock);
+            if (amcsh_thread_pool_try_submit(shell_state.thread_pool, stage_task, stage)) {
+                continue;
+            }
+            pthread_mutex_lock(&pipeline.lock);
+            pipeline.running--;
+            pthread_mutex_unlock(&pipeline.lock);
+        }
+
+        stage->pid = c->group || (c->builtin && c->builtin->func) ? fork_builtin(head, c) : amcsh_spawn(c);
+        if (stage->pid < 0) {
+            stage->status = 127;
+        } else if (pgid == 0) {
+            pgid = stage->pid;
+        }
+    }
+    if (prev_read >= 0) {
+        close(prev_read);
+    }
+    if (log >= 0) {
+        close(log);
+        for (amcsh_command_t *c = head; c; c = c->next) c->job_log = -1;
+    }
+
+    if (inline_stage) {
+        inline_stage->status = run_stage_builtin(inline_stage->cmd, &inline_stage->before,
+                                                  &inline_stage->after);
+    }
+
+    pthread_mutex_lock(&pipeline.lock);
+    while (pipeline.running > 0) {
+        pthread_cond_wait(&pipeline.done, &pipeline.lock);
+    }
+    pthread_mutex_unlock(&pipeline.lock);
+
+    if (head->background) {
+        pid_t *pids = malloc(count * sizeof(pid_t));
+        int started = 0;
+        for (i = 0; i < count; i++) {
+            if (stages[i].pid > 0) {
+                pids[started++] = stages[i].pid;
+            }
+        }
+        if (started > 0) {
+            amcsh_procsub_job_add(head, pgid, pids, started);
+            if (log_read >= 0) {
+                amcsh_joblog_attach(pgid, log_read, head->raw_cmd);
+                log_read = -1;
+            }
+        }
+        if (log_read >= 0) {
+            close(log_read);
+        }
+        free(pids);
+    } else {
+        for (i = 0; i < count; i++) {
+            if (stages[i].pid > 0) {
+                stages[i].status = amcsh_wait_process(stages[i].pid, usage);
+            } else {
+                // Zeroed for stages that never ran
+                amcsh_usage_add_delta(usage, &stages[i].before, &stages[i].after);
+            }
+        }
+        shell_state.exit_status = stages[count - 1].status;
+    }
+
+    free(stages);
+    return 0;
+}
+
+static int execute_command(amcsh_command_t *cmd, amcsh_usage_t *usage) {
+    if (cmd->next) {
+        return execute_pipeline(cmd, usage);
+    }
+    if (cmd->redirect_failed) {
+        return 0; // The parser set the status
+    }
+    if (cmd->group) {
+        amcsh_group_run(cmd, false);
+        return 0;
+    }
+
+    // Check for built-in commands; with & they run in a child like a pipeline stage
+    bool builtin = cmd->builtin && cmd->builtin->func;
+    if (builtin && !cmd->background) {
+        struct rusage before, after;
+        getrusage(RUSAGE_THREAD, &before);
+        amcsh_execute_builtin(cmd);
+        getrusage(RUSAGE_THREAD, &after);
+        amcsh_usage_add_delta(usage, &before, &after);
+        return 0;
+    }
+
+    int log_read = -1;
+    if (cmd->background) {
+        cmd->job_log = amcsh_joblog_open(&log_read);
+    }
+    pid_t pid = builtin ? fork_builtin(cmd, cmd) : amcsh_spawn(cmd);
+    if (cmd->job_log >= 0) {
+        close(cmd->job_log);
+        cmd->job_log = -1;
+    }
+    if (pid < 0) {
+        if (log_read >= 0) close(log_read);
+        return -1;
+    }
 
     // Wait for the command to finish if not background
     if (!cmd->background) {
-        int wstatus;
-        waitpid(pid, &wstatus, 0);
-        shell_state.exit_status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+        shell_state.exit_status = amcsh_wait_process(pid, usage);
     } else {
-        // Add to job list
-        amcsh_job_t *job = malloc(sizeof(amcsh_job_t));
-        job->pgid = pid;
-        job->command = strdup(cmd->raw_cmd);
-        job->status = JOB_RUNNING;
-        job->next = NULL;
-
-        pthread_mutex_lock(&shell_state.job_mutex);
-        if (!shell_state.jobs) {
-            shell_state.jobs = job;
-        } else {
-            job->next = shell_state.jobs;
-            shell_state.jobs = job;
+        amcsh_procsub_job_add(cmd, pid, &pid, 1);
+        if (log_read >= 0) {
+            amcsh_joblog_attach(pid, log_read, cmd->raw_cmd);
         }
-        pthread_mutex_unlock(&shell_state.job_mutex);
     }
 
     return 0;
 }
+
+int amcsh_execute(amcsh_command_t *cmd)
+{
+    if (!cmd || (!cmd->argv[0] && !cmd->timed && !cmd->group && !cmd->next)) {
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    amcsh_usage_t usage = {0};
+
+    // A bare "time" reports the (empty) cost of nothing, as in bash
+    int result = cmd->argv[0] || cmd->group || cmd->next ? execute_command(cmd, &usage) : 0;
+
+    if (!cmd->background) {
+        usage.real = amcsh_elapsed(&start);
+        bool timed = false;
+        for (amcsh_command_t *c = cmd; c; c = c->next) {
+            timed |= c->timed;
+        }
+        if (timed || amcsh_usage_over_reporttime(&usage)) {
+            amcsh_usage_report(&usage, cmd->time_posix);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,809 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#define GLOB_DIRENT_BUF 32768
+#define GLOB_MAX_PENDING (AMCSH_MAX_THREADS * 4)
+#define GLOB_MAX_BRACE_WORDS 100000
+
+// Compiled pattern element
+typedef enum {
+    GLOB_OP_CHAR,
+    GLOB_OP_ANY,
+    GLOB_OP_STAR,
+    GLOB_OP_CLASS
+} glob_op_type_t;
+
+typedef struct {
+    glob_op_type_t type;
+    unsigned char c;
+    uint8_t bits[32];       // Class membership bitmap
+} glob_op_t;
+
+typedef enum {
+    SEG_LITERAL,            // No metacharacters: no directory read needed
+    SEG_PATTERN,
+    SEG_GLOBSTAR            // "**": any number of directories
+} glob_seg_kind_t;
+
+// One path component of a pattern
+typedef struct {
+    glob_seg_kind_t kind;
+    char *literal;          // Unescaped text; also the tail for suffix patterns
+    size_t literal_len;
+    glob_op_t *ops;
+    int nops;
+    bool suffix_only;       // "*suffix": compare the tail only
+    bool match_dot;         // Starts with a literal '.'
+} glob_seg_t;
+
+// Matches found by one traversal task, packed NUL-separated
+typedef struct glob_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t count;
+    struct glob_buf *next;
+} glob_buf_t;
+
+typedef struct {
+    glob_seg_t *segs;
+    int nsegs;
+    bool dirs_only;         // Pattern ended in '/'
+    bool parallel;          // Subtrees of "**" go to the thread pool
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    int pending;            // Tasks not yet finished
+    glob_buf_t *results;
+} glob_ctx_t;
+
+typedef struct {
+    glob_ctx_t *ctx;
+    char *path;
+    int seg;
+} glob_task_t;
+
+// Directory reader: getdents64 hands back d_type for many entries per syscall
+typedef struct {
+    int fd;
+#ifdef __linux__
+    char *buf;
+    long pos;
+    long end;
+#else
+    DIR *dir;
+#endif
+} dir_iter_t;
+
+#ifdef __linux__
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static bool dir_open(dir_iter_t *it, const char *path) {
+    it->fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (it->fd < 0) {
+        return false;
+    }
+#ifdef __linux__
+    it->buf = malloc(GLOB_DIRENT_BUF);
+    it->pos = it->end = 0;
+    if (!it->buf) {
+        close(it->fd);
+        return false;
+    }
+#else
+    it->dir = fdopendir(it->fd);
+    if (!it->dir) {
+        close(it->fd);
+        return false;
+    }
+#endif
+    return true;
+}
+
+static bool dir_next(dir_iter_t *it, const char **name, unsigned char *type) {
+#ifdef __linux__
+    if (it->pos >= it->end) {
+        long n = syscall(SYS_getdents64, it->fd, it->buf, GLOB_DIRENT_BUF);
+        if (n <= 0) {
+            return false;
+        }
+        it->pos = 0;
+        it->end = n;
+    }
+    struct linux_dirent64 *d = (struct linux_dirent64 *)(it->buf + it->pos);
+    it->pos += d->d_reclen;
+    *name = d->d_name;
+    *type = d->d_type;
+    return true;
+#else
+    struct dirent *d = readdir(it->dir);
+    if (!d) {
+        return false;
+    }
+    *name = d->d_name;
+    *type = d->d_type;
+    return true;
+#endif
+}
+
+static void dir_close(dir_iter_t *it) {
+#ifdef __linux__
+    free(it->buf);
+    close(it->fd);
+#else
+    closedir(it->dir);
+#endif
+}
+
+// Resolve DT_UNKNOWN and (optionally) symlinks with a single stat
+static bool entry_is_dir(int dirfd, const char *name, unsigned char type, bool follow) {
+    if (type == DT_DIR) return true;
+    if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) return false;
+
+    struct stat st;
+    return fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool is_pattern_meta(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+// Parse "[...]" at str into op; returns bytes consumed or 0 if unterminated
+static size_t compile_class(const char *str, size_t len, glob_op_t *op) {
+    size_t i = 1;
+    bool negate = false;
+    bool first = true;
+
+    memset(op->bits, 0, sizeof(op->bits));
+    if (i < len && (str[i] == '!' || str[i] == '^')) {
+        negate = true;
+        i++;
+    }
+
+    while (i < len) {
+        unsigned char lo = str[i];
+        if (lo == ']' && !first) {
+            if (negate) {
+                for (int b = 0; b < 32; b++) op->bits[b] = ~op->bits[b];
+            }
+            op->type = GLOB_OP_CLASS;
+            return i + 1;
+        }
+        if (lo == '\\' && i + 1 < len) {
+            lo = str[++i];
+        }
+        unsigned char hi = lo;
+        if (i + 2 < len && str[i + 1] == '-' && str[i + 2] != ']') {
+            i += 2;
+            if (str[i] == '\\' && i + 1 < len) i++;
+            hi = str[i];
+        }
+        for (unsigned int c = lo; c <= hi; c++) {
+            op->bits[c >> 3] |= 1 << (c & 7);
+        }
+        first = false;
+        i++;
+    }
+    return 0;
+}
+
+static bool compile_segment(glob_seg_t *seg, const char *text, size_t len) {
+    seg->ops = malloc((len + 1) * sizeof(glob_op_t));
+    seg->literal = malloc(len + 1);
+    if (!seg->ops || !seg->literal) {
+        return false;
+    }
+
+    bool meta = false;
+    int n = 0;
+    size_t lit = 0;
+    size_t i = 0;
+    while (i < len) {
+        glob_op_t *op = &seg->ops[n];
+        char c = text[i];
+        size_t used;
+
+        if (c == '\\' && i + 1 < len) {
+            op->type = GLOB_OP_CHAR;
+            op->c = text[i + 1];
+            seg->literal[lit++] = text[i + 1];
+            i += 2;
+        } else if (c == '*') {
+            meta = true;
+            i++;
+            if (n > 0 && seg->ops[n - 1].type == GLOB_OP_STAR) {
+                continue;
+            }
+            op->type = GLOB_OP_STAR;
+        } else if (c == '?') {
+            meta = true;
+            op->type = GLOB_OP_ANY;
+            i++;
+        } else if (c == '[' && (used = compile_class(text + i, len - i, op)) > 0) {
+            meta = true;
+            i += used;
+        } else {
+            op->type = GLOB_OP_CHAR;
+            op->c = c;
+            seg->literal[lit++] = c;
+            i++;
+        }
+        n++;
+    }
+    seg->literal[lit] = '\0';
+    seg->literal_len = lit;
+    seg->nops = n;
+
+    if (!meta) {
+        seg->kind = SEG_LITERAL;
+    } else if (len == 2 && text[0] == '*' && text[1] == '*') {
+        seg->kind = SEG_GLOBSTAR;
+    } else {
+        seg->kind = SEG_PATTERN;
+        // "*.o" and friends: one leading star, then plain characters
+        seg->suffix_only = seg->ops[0].type == GLOB_OP_STAR;
+        for (int j = 1; j < n && seg->suffix_only; j++) {
+            seg->suffix_only = seg->ops[j].type == GLOB_OP_CHAR;
+        }
+    }
+    seg->match_dot = n > 0 && seg->ops[0].type == GLOB_OP_CHAR && seg->ops[0].c == '.';
+    return true;
+}
+
+static bool op_matches(const glob_op_t *op, unsigned char c) {
+    switch (op->type) {
+        case GLOB_OP_CHAR:
+            return op->c == c;
+        case GLOB_OP_ANY:
+            return true;
+        case GLOB_OP_CLASS:
+            return op->bits[c >> 3] & (1 << (c & 7));
+        default:
+            return false;
+    }
+}
+
+static bool seg_matches(const glob_seg_t *seg, const char *name, size_t len) {
+    if (name[0] == '.' && !seg->match_dot) {
+        return false;
+    }
+    if (seg->suffix_only) {
+        return len >= seg->literal_len &&
+               memcmp(name + len - seg->literal_len, seg->literal, seg->literal_len) == 0;
+    }
+
+    // Iterative matcher: on mismatch, let the most recent star absorb one more char
+    const glob_op_t *ops = seg->ops;
+    int oi = 0, star_oi = -1;
+    const char *s = name, *star_s = NULL;
+    while (*s) {
+        if (oi < seg->nops) {
+            if (ops[oi].type == GLOB_OP_STAR) {
+                star_oi = oi++;
+                star_s = s;
+                continue;
+            }
+            if (op_matches(&ops[oi], (unsigned char)*s)) {
+                oi++;
+                s++;
+                continue;
+            }
+        }
+        if (star_oi < 0) {
+            return false;
+        }
+        oi = star_oi + 1;
+        s = ++star_s;
+    }
+    while (oi < seg->nops && ops[oi].type == GLOB_OP_STAR) oi++;
+    return oi == seg->nops;
+}
+
+// Append name to path in place; returns the new length or 0 if too long
+static size_t path_join(char *path, size_t path_len, const char *name, size_t name_len) {
+    size_t sep = path_len > 0 && path[path_len - 1] != '/';
+    if (path_len + sep + name_len + 2 > PATH_MAX) {
+        return 0;
+    }
+    if (sep) path[path_len] = '/';
+    memcpy(path + path_len + sep, name, name_len);
+    path[path_len + sep + name_len] = '\0';
+    return path_len + sep + name_len;
+}
+
+static void add_match(glob_ctx_t *ctx, glob_buf_t *out, const char *path, size_t len) {
+    size_t need = len + 1 + ctx->dirs_only;
+    if (out->len + need > out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 4096;
+        while (cap < out->len + need) cap *= 2;
+        char *data = realloc(out->data, cap);
+        if (!data) {
+            return;
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, path, len);
+    out->len += len;
+    if (ctx->dirs_only) out->data[out->len++] = '/';
+    out->data[out->len++] = '\0';
+    out->count++;
+}
+
+static void *walk_task(void *arg);
+
+// Hand a "**" subtree to the pool while it has capacity; otherwise walk it here
+static bool submit_subtree(glob_ctx_t *ctx, const char *path, int seg) {
+    if (!ctx->parallel) {
+        return false;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    bool room = ctx->pending < GLOB_MAX_PENDING;
+    if (room) ctx->pending++;
+    pthread_mutex_unlock(&ctx->lock);
+    if (!room) {
+        return false;
+    }
+
+    // Only an idle worker takes a subtree: queued behind a pipeline stage or
+    // a prompt segment it would stall the expansion, so walk it here instead
+    glob_task_t *task = malloc(sizeof(glob_task_t));
+    char *copy = strdup(path);
+    if (task && copy) {
+        task->ctx = ctx;
+        task->path = copy;
+        task->seg = seg;
+        if (amcsh_thread_pool_try_submit(shell_state.thread_pool, walk_task, task)) {
+            return true;
+        }
+    }
+    free(copy);
+    free(task);
+    pthread_mutex_lock(&ctx->lock);
+    ctx->pending--;
+    pthread_mutex_unlock(&ctx->lock);
+    return false;
+}
+
+// Match segments [seg_idx, nsegs) below path; path is a PATH_MAX buffer restored on return
+static void walk(glob_ctx_t *ctx, glob_buf_t *out, char *path, size_t path_len, int seg_idx) {
+    glob_seg_t *seg = &ctx->segs[seg_idx];
+    bool last = seg_idx == ctx->nsegs - 1;
+
+    if (seg->kind == SEG_LITERAL) {
+        size_t n = path_join(path, path_len, seg->literal, seg->literal_len);
+        if (n == 0) return;
+        if (!last) {
+            walk(ctx, out, path, n, seg_idx + 1);
+        } else {
+            struct stat st;
+            int flags = ctx->dirs_only ? 0 : AT_SYMLINK_NOFOLLOW;
+            if (fstatat(AT_FDCWD, path, &st, flags) == 0 && (!ctx->dirs_only || S_ISDIR(st.st_mode))) {
+                add_match(ctx, out, path, n);
+            }
+        }
+        path[path_len] = '\0';
+        return;
+    }
+
+    // "a/**/b" also matches "a/b"
+    if (seg->kind == SEG_GLOBSTAR && !last) {
+        walk(ctx, out, path, path_len, seg_idx + 1);
+    }
+
+    dir_iter_t it;
+    if (!dir_open(&it, path)) {
+        return;
+    }
+
+    const char *name;
+    unsigned char type;
+    while (dir_next(&it, &name, &type)) {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        size_t name_len = strlen(name);
+
+        if (seg->kind == SEG_GLOBSTAR) {
+            // Hidden directories and symlinks are not descended into
+            if (name[0] == '.') continue;
+            bool is_dir = entry_is_dir(it.fd, name, type, false);
+            size_t n = path_join(path, path_len, name, name_len);
+            if (n == 0) continue;
+            if (last && (!ctx->dirs_only || is_dir)) {
+                add_match(ctx, out, path, n);
+            }
+            if (is_dir && !submit_subtree(ctx, path, seg_idx)) {
+                walk(ctx, out, path, n, seg_idx);
+            }
+            path[path_len] = '\0';
+            continue;
+        }
+
+        if (!seg_matches(seg, name, name_len)) {
+            continue;
+        }
+        if ((!last || ctx->dirs_only) && !entry_is_dir(it.fd, name, type, true)) {
+            continue;
+        }
+
+        size_t n = path_join(path, path_len, name, name_len);
+        if (n == 0) continue;
+        if (last) {
+            add_match(ctx, out, path, n);
+        } else {
+            walk(ctx, out, path, n, seg_idx + 1);
+        }
+        path[path_len] = '\0';
+    }
+
+    dir_close(&it);
+}
+
+static void *walk_task(void *arg) {
+    glob_task_t *task = arg;
+    glob_ctx_t *ctx = task->ctx;
+    glob_buf_t *out = calloc(1, sizeof(glob_buf_t));
+    char path[PATH_MAX];
+
+    size_t len = strlen(task->path);
+    memcpy(path, task->path, len + 1);
+    if (out) {
+        walk(ctx, out, path, len, task->seg);
+    }
+    free(task->path);
+    free(task);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (out && out->count > 0) {
+        out->next = ctx->results;
+        ctx->results = out;
+    } else if (out) {
+        free(out->data);
+        free(out);
+    }
+    if (--ctx->pending == 0) {
+        pthread_cond_broadcast(&ctx->idle);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Expand one brace-free pattern; matches are sorted and live in a single arena block
+static int glob_pattern(const char *pattern, amcsh_arena_t *arena, char ***matches) {
+    glob_ctx_t ctx = {0};
+    size_t len = strlen(pattern);
+    int count = 0;
+
+    ctx.segs = calloc(len + 1, sizeof(glob_seg_t));
+    if (!ctx.segs) {
+        return 0;
+    }
+
+    const char *p = pattern;
+    if (*p == '/') {
+        while (*p == '/') p++;
+    }
+    while (*p) {
+        const char *end = strchr(p, '/');
+        if (!end) end = p + strlen(p);
+        if (!compile_segment(&ctx.segs[ctx.nsegs++], p, end - p)) {
+            goto out;
+        }
+        if (ctx.segs[ctx.nsegs - 1].kind == SEG_GLOBSTAR) {
+            ctx.parallel = shell_state.thread_pool != NULL;
+        }
+        p = end;
+        while (*p == '/') p++;
+        if (!*p && end[0] == '/') ctx.dirs_only = true;
+    }
+    if (ctx.nsegs == 0) {
+        goto out;
+    }
+
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.idle, NULL);
+    ctx.pending = 1;
+
+    glob_task_t *root = malloc(sizeof(glob_task_t));
+    root->ctx = &ctx;
+    root->path = strdup(pattern[0] == '/' ? "/" : "");
+    root->seg = 0;
+    walk_task(root);
+
+    pthread_mutex_lock(&ctx.lock);
+    while (ctx.pending > 0) {
+        pthread_cond_wait(&ctx.idle, &ctx.lock);
+    }
+    pthread_mutex_unlock(&ctx.lock);
+    pthread_mutex_destroy(&ctx.lock);
+    pthread_cond_destroy(&ctx.idle);
+
+    size_t total = 0, n = 0;
+    for (glob_buf_t *buf = ctx.results; buf; buf = buf->next) {
+        total += buf->len;
+        n += buf->count;
+    }
+
+    if (n > 0) {
+        char **list = amcsh_arena_alloc(arena, (n + 1) * sizeof(char *) + total);
+        char *strings = (char *)(list + n + 1);
+        size_t k = 0;
+        for (glob_buf_t *buf = ctx.results; buf; buf = buf->next) {
+            memcpy(strings, buf->data, buf->len);
+            for (size_t off = 0; off < buf->len; off += strlen(strings + off) + 1) {
+                list[k++] = strings + off;
+            }
+            strings += buf->len;
+        }
+        list[n] = NULL;
+        qsort(list, n, sizeof(char *), compare_paths);
+        *matches = list;
+        count = (int)n;
+    }
+
+    glob_buf_t *buf = ctx.results;
+    while (buf) {
+        glob_buf_t *next = buf->next;
+        free(buf->data);
+        free(buf);
+        buf = next;
+    }
+
+out:
+    for (int i = 0; i < ctx.nsegs; i++) {
+        free(ctx.segs[i].ops);
+        free(ctx.segs[i].literal);
+    }
+    free(ctx.segs);
+    return count;
+}
+
+// Growable list of malloc'd words produced by brace expansion
+typedef struct {
+    char **items;
+    int count;
+    int cap;
+} word_list_t;
+
+// False once the list is full or cannot grow; word is freed either way
+static bool list_push(word_list_t *list, char *word) {
+    if (!word || list->count >= GLOB_MAX_BRACE_WORDS) {
+        free(word);
+        errno = word ? E2BIG : ENOMEM;
+        return false;
+    }
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 8;
+        char **items = realloc(list->items, cap * sizeof(char *));
+        if (!items) {
+            free(word);
+            errno = ENOMEM;
+            return false;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->count++] = word;
+    return true;
+}
+
+static char *concat3(const char *a, size_t alen, const char *b, size_t blen, const char *c) {
+    size_t clen = strlen(c);
+    char *word = malloc(alen + blen + clen + 1);
+    if (!word) return NULL;
+    memcpy(word, a, alen);
+    memcpy(word + alen, b, blen);
+    memcpy(word + alen + blen, c, clen + 1);
+    return word;
+}
+
+// Parse "x..y" (integers or single characters) for sequence expansion
+static bool parse_range(const char *str, size_t len, long *from, long *to, bool *chars) {
+    const char *dots = NULL;
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (str[i] == '.' && str[i + 1] == '.') {
+            dots = str + i;
+            break;
+        }
+    }
+    if (!dots || dots == str || dots + 2 == str + len) {
+        return false;
+    }
+
+    size_t left = dots - str, right = len - left - 2;
+    if (left == 1 && right == 1 && !isdigit((unsigned char)str[0])) {
+        *chars = true;
+        *from = (unsigned char)str[0];
+        *to = (unsigned char)dots[2];
+        return true;
+    }
+
+    char *end;
+    *chars = false;
+    *from = strtol(str, &end, 10);
+    if (end != dots) return false;
+    *to = strtol(dots + 2, &end, 10);
+    return end == str + len;
+}
+
+// False when the expansion would exceed GLOB_MAX_BRACE_WORDS words
+static bool brace_expand(const char *word, word_list_t *out) {
+    if (!word) {
+        errno = ENOMEM;
+        return false;
+    }
+    for (const char *open = word; *open; open++) {
+        if (*open == '\\' && open[1]) {
+            open++;
+            continue;
+        }
+        if (*open != '{') {
+            continue;
+        }
+
+        // Find the matching brace and the top-level commas
+        int depth = 0;
+        bool comma = false;
+        const char *close = NULL;
+        for (const char *p = open; *p; p++) {
+            if (*p == '\\' && p[1]) {
+                p++;
+            } else if (*p == '{') {
+                depth++;
+            } else if (*p == '}' && --depth == 0) {
+                close = p;
+                break;
+            } else if (*p == ',' && depth == 1) {
+                comma = true;
+            }
+        }
+        if (!close) {
+            break;
+        }
+
+        bool ok = true;
+        const char *body = open + 1;
+        size_t prefix_len = open - word;
+        long from, to;
+        bool chars;
+
+        if (comma) {
+            const char *alt = body;
+            depth = 0;
+            for (const char *p = body; p <= close; p++) {
+                if (*p == '\\' && p < close) {
+                    p++;
+                } else if (*p == '{') {
+                    depth++;
+                } else if (*p == '}' && depth > 0) {
+                    depth--;
+                } else if ((*p == ',' && depth == 0) || p == close) {
+                    char *prefixed = concat3(word, prefix_len, alt, p - alt, close + 1);
+                    ok = brace_expand(prefixed, out);
+                    free(prefixed);
+                    if (!ok) break;
+                    alt = p + 1;
+                }
+            }
+            return ok;
+        }
+
+        if (parse_range(body, close - body, &from, &to, &chars)) {
+            long step = from <= to ? 1 : -1;
+            for (long v = from; ok; v += step) {
+                char item[32];
+                int len = chars ? snprintf(item, sizeof(item), "%c", (char)v)
+                                : snprintf(item, sizeof(item), "%ld", v);
+                char *expanded = concat3(word, prefix_len, item, len, close + 1);
+                ok = brace_expand(expanded, out);
+                free(expanded);
+                if (v == to) break;
+            }
+            return ok;
+        }
+    }
+
+    return list_push(out, strdup(word));
+}
+
+bool amcsh_glob_has_meta(const char *pattern) {
+    for (const char *p = pattern; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+        } else if (is_pattern_meta(*p)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+char *amcsh_glob_unescape(amcsh_arena_t *arena, const char *word, size_t len) {
+    char *result = amcsh_arena_alloc(arena, len + 1);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (word[i] == '\\' && i + 1 < len) i++;
+        result[n++] = word[i];
+    }
+    result[n] = '\0';
+    return result;
+}
+
+int amcsh_glob_expand(const char *word, amcsh_arena_t *arena, char ***fields) {
+    word_list_t words = {0};
+    if (!brace_expand(word, &words)) {
+        int err = errno;
+        for (int i = 0; i < words.count; i++) {
+            free(words.items[i]);
+        }
+        free(words.items);
+        errno = err;
+        return -1;
+    }
+    if (words.count == 0) {
+        return 0;
+    }
+
+    // Sorted matches per brace alternative; unmatched patterns stay literal
+    char ***parts = malloc(words.count * sizeof(char **));
+    int *part_counts = malloc(words.count * sizeof(int));
+    int total = 0;
+    for (int i = 0; i < words.count; i++) {
+        part_counts[i] = 0;
+        if (amcsh_glob_has_meta(words.items[i])) {
+            part_counts[i] = glob_pattern(words.items[i], arena, &parts[i]);
+        }
+        if (part_counts[i] == 0) {
+            parts[i] = amcsh_arena_alloc(arena, sizeof(char *));
+            parts[i][0] = amcsh_glob_unescape(arena, words.items[i], strlen(words.items[i]));
+            part_counts[i] = 1;
+        }
+        total += part_counts[i];
+    }
+
+    if (words.count == 1) {
+        *fields = parts[0];
+    } else {
+        char **list = amcsh_arena_alloc(arena, (total + 1) * sizeof(char *));
+        int k = 0;
+        for (int i = 0; i < words.count; i++) {
+            memcpy(list + k, parts[i], part_counts[i] * sizeof(char *));
+            k += part_counts[i];
+        }
+        list[k] = NULL;
+        *fields = list;
+    }
+
+    for (int i = 0; i < words.count; i++) {
+        free(words.items[i]);
+    }
+    free(words.items);
+    free(parts);
+    free(part_counts);
+    return total;
+}
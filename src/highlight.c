@@ -0,0 +1,831 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "highlight.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <sys/stat.h>
+
+// Token kinds
+enum { TOKEN_WORD, TOKEN_OPERATOR, TOKEN_REDIRECT };
+
+// Lexer state between tokens: whether the next word is a command, and
+// whether it is the target of a redirection and of which sort
+#define STATE_COMMAND       0x01
+#define STATE_TARGET_INPUT  0x02   // < file: must exist
+#define STATE_TARGET_OUTPUT 0x04   // > file, >> file
+#define STATE_TARGET_TEXT   0x06   // << delimiter, <<< string
+#define STATE_TARGET_MASK   0x06
+#define STATE_AFTER_PREFIX  0x08   // Command position after time, nice, ...
+
+// Longest word looked up; longer ones stay plain
+#define WORD_MAX 1024
+
+// SGR colours by class, and for quoted text and expansions inside words
+static const char *const class_colours[] = {
+    [AMCSH_HL_PLAIN] = "\033[0m",
+    [AMCSH_HL_COMMAND] = "\033[0;32m",
+    [AMCSH_HL_UNKNOWN] = "\033[0;31m",
+    [AMCSH_HL_OPERATOR] = "\033[0;35m",
+    [AMCSH_HL_REDIRECT] = "\033[0;35m",
+    [AMCSH_HL_PATH] = "\033[0;4m",
+    [AMCSH_HL_MISSING] = "\033[0;4;31m",
+};
+#define COLOUR_STRING "\033[0;33m"
+#define COLOUR_EXPANSION "\033[0;36m"
+
+// Path checks, shared by the line editor and the workers checking them.
+// Entries last for one line; a result for an earlier line is dropped.
+#define PATH_SLOTS 256
+#define PATH_PENDING 0x01
+#define PATH_EXISTS  0x02
+#define PATH_EXEC    0x04   // Regular file we may execute
+
+typedef struct {
+    char *path;
+    uint8_t status;
+} path_entry_t;
+
+typedef struct {
+    unsigned epoch;
+    size_t count;
+    char *paths[];
+} path_batch_t;
+
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+static path_entry_t path_table[PATH_SLOTS];
+static size_t path_used;
+static unsigned path_epoch;
+
+// Bumped when a lookup result arrives; classes are recomputed when it moves
+static atomic_uint results_generation;
+static atomic_bool index_requested;
+
+static size_t path_slot(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path; path++) {
+        hash = (hash ^ (unsigned char)*path) * 16777619u;
+    }
+    return hash % PATH_SLOTS;
+}
+
+// Called with path_lock held; NULL when the path is not in the table
+static path_entry_t *path_find(const char *path) {
+    for (size_t i = path_slot(path), n = 0; n < PATH_SLOTS; i = (i + 1) % PATH_SLOTS, n++) {
+        if (!path_table[i].path) {
+            return NULL;
+        }
+        if (strcmp(path_table[i].path, path) == 0) {
+            return &path_table[i];
+        }
+    }
+    return NULL;
+}
+
+static void *path_task(void *arg) {
+    path_batch_t *batch = arg;
+    uint8_t status[batch->count];
+    for (size_t i = 0; i < batch->count; i++) {
+        struct stat st;
+        status[i] = 0;
+        if (stat(batch->paths[i], &st) == 0) {
+            status[i] = PATH_EXISTS;
+            if (S_ISREG(st.st_mode) && access(batch->paths[i], X_OK) == 0) {
+                status[i] |= PATH_EXEC;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&path_lock);
+    if (batch->epoch == path_epoch) {
+        for (size_t i = 0; i < batch->count; i++) {
+            path_entry_t *entry = path_find(batch->paths[i]);
+            if (entry) {
+                entry->status = status[i];
+            }
+        }
+    }
+    pthread_mutex_unlock(&path_lock);
+
+    for (size_t i = 0; i < batch->count; i++) {
+        free(batch->paths[i]);
+    }
+    free(batch);
+    atomic_fetch_add(&results_generation, 1);
+    amcsh_prompt_wake();
+    return NULL;
+}
+
+// Status of a path, queueing it for the next batch if never seen
+static uint8_t path_status(amcsh_highlight_t *hl, const char *path) {
+    pthread_mutex_lock(&path_lock);
+    path_entry_t *entry = path_find(path);
+    if (entry) {
+        uint8_t status = entry->status;
+        pthread_mutex_unlock(&path_lock);
+        return status;
+    }
+    // A full table stops checking rather than evicting
+    if (path_used >= PATH_SLOTS * 3 / 4) {
+        pthread_mutex_unlock(&path_lock);
+        return PATH_PENDING;
+    }
+    char *copy = strdup(path);
+    if (copy && hl->batch_count == hl->batch_cap) {
+        size_t cap = hl->batch_cap ? hl->batch_cap * 2 : 16;
+        char **batch = realloc(hl->batch, cap * sizeof(char *));
+        if (!batch) {
+            free(copy);
+            copy = NULL;
+        } else {
+            hl->batch = batch;
+            hl->batch_cap = cap;
+        }
+    }
+    if (copy) {
+        size_t i = path_slot(path);
+        while (path_table[i].path) {
+            i = (i + 1) % PATH_SLOTS;
+        }
+        path_table[i].path = copy;
+        path_table[i].status = PATH_PENDING;
+        path_used++;
+        hl->batch[hl->batch_count++] = copy;
+    }
+    pthread_mutex_unlock(&path_lock);
+    return PATH_PENDING;
+}
+
+// Hand the paths queued by this update to an idle worker. If none is idle
+// they are forgotten and queued again by the next update.
+static void path_flush(amcsh_highlight_t *hl) {
+    if (hl->batch_count == 0) {
+        return;
+    }
+    pthread_mutex_lock(&path_lock);
+    path_batch_t *batch = malloc(sizeof(path_batch_t) + hl->batch_count * sizeof(char *));
+    bool submitted = false;
+    if (batch) {
+        batch->epoch = path_epoch;
+        batch->count = hl->batch_count;
+        for (size_t i = 0; i < hl->batch_count; i++) {
+            batch->paths[i] = strdup(hl->batch[i]);
+            if (!batch->paths[i]) {
+                batch->count = i;
+                break;
+            }
+        }
+        submitted = batch->count == hl->batch_count &&
+                    amcsh_thread_pool_try_submit(shell_state.thread_pool, path_task, batch);
+    }
+    if (!submitted) {
+        // Removing entries from the probe sequence means rebuilding it
+        path_entry_t old[PATH_SLOTS];
+        memcpy(old, path_table, sizeof(old));
+        memset(path_table, 0, sizeof(path_table));
+        path_used = 0;
+        for (size_t i = 0; i < PATH_SLOTS; i++) {
+            if (!old[i].path) {
+                continue;
+            }
+            if (old[i].status == PATH_PENDING) {
+                free(old[i].path);
+                continue;
+            }
+            size_t slot = path_slot(old[i].path);
+            while (path_table[slot].path) {
+                slot = (slot + 1) % PATH_SLOTS;
+            }
+            path_table[slot] = old[i];
+            path_used++;
+        }
+        if (batch) {
+            for (size_t i = 0; i < batch->count; i++) {
+                free(batch->paths[i]);
+            }
+            free(batch);
+        }
+    }
+    pthread_mutex_unlock(&path_lock);
+    hl->batch_count = 0;
+}
+
+static void *index_task(void *arg) {
+    (void)arg;
+    amcsh_completion_index();
+    atomic_fetch_add(&results_generation, 1);
+    amcsh_prompt_wake();
+    return NULL;
+}
+
+void amcsh_highlight_init(amcsh_highlight_t *hl) {
+    memset(hl, 0, sizeof(*hl));
+    hl->generation = atomic_load(&results_generation);
+}
+
+void amcsh_highlight_free(amcsh_highlight_t *hl) {
+    amcsh_highlight_reset(hl);
+    free(hl->text);
+    free(hl->tokens);
+    free(hl->scratch);
+    free(hl->batch);
+    free(hl->out);
+    memset(hl, 0, sizeof(*hl));
+}
+
+void amcsh_highlight_reset(amcsh_highlight_t *hl) {
+    pthread_mutex_lock(&path_lock);
+    for (size_t i = 0; i < PATH_SLOTS; i++) {
+        free(path_table[i].path);
+        path_table[i].path = NULL;
+    }
+    path_used = 0;
+    path_epoch++;
+    pthread_mutex_unlock(&path_lock);
+    hl->len = 0;
+    hl->count = 0;
+    hl->batch_count = 0;
+}
+
+void amcsh_highlight_invalidate(amcsh_highlight_t *hl) {
+    hl->invalid = true;
+}
+
+static bool is_operator_char(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '(' || c == ')' || c == '<' || c == '>';
+}
+
+// End of a quoted or nested section starting at i, or len if unterminated
+static size_t skip_quoted(const char *s, size_t len, size_t i) {
+    char open = s[i];
+    if (open == '\'' || open == '`') {
+        const char *end = memchr(s + i + 1, open, len - i - 1);
+        return end ? (size_t)(end - s) + 1 : len;
+    }
+    if (open == '"') {
+        for (i++; i < len; i++) {
+            if (s[i] == '\\' && i + 1 < len) {
+                i++;
+            } else if (s[i] == '"') {
+                return i + 1;
+            }
+        }
+        return len;
+    }
+    // $( ... ) or ${ ... }, nesting and quotes inside
+    char close = s[i + 1] == '(' ? ')' : '}';
+    int depth = 0;
+    for (i++; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len) {
+            i++;
+        } else if (s[i] == '\'' || s[i] == '"' || s[i] == '`') {
+            i = skip_quoted(s, len, i) - 1;
+        } else if (s[i] == (close == ')' ? '(' : '{')) {
+            depth++;
+        } else if (s[i] == close && --depth == 0) {
+            return i + 1;
+        }
+    }
+    return len;
+}
+
+// Lex one token at i (not whitespace); returns its end and the state after it
+static size_t lex_token(const char *s, size_t len, size_t i, uint8_t state,
+                        uint8_t *kind, uint8_t *next) {
+    char c = s[i];
+    if (c == '<' || c == '>') {
+        *kind = TOKEN_REDIRECT;
+        uint8_t target = STATE_TARGET_OUTPUT;
+        i++;
+        if (c == '>' && i < len && s[i] == '>') {
+            i++;
+        } else if (c == '<' && i < len && s[i] == '<') {
+            i++;
+            if (i < len && (s[i] == '<' || s[i] == '-')) {
+                i++;
+            }
+            target = STATE_TARGET_TEXT;
+        } else if (c == '<') {
+            target = STATE_TARGET_INPUT;
+        }
+        *next = (state & ~STATE_TARGET_MASK) | target;
+        return i;
+    }
+    if (is_operator_char(c)) {
+        *kind = TOKEN_OPERATOR;
+        i++;
+        if ((c == '|' || c == '&') && i < len && s[i] == c) {
+            i++;
+        }
+        *next = STATE_COMMAND;
+        return i;
+    }
+
+    *kind = TOKEN_WORD;
+    while (i < len && s[i] != ' ' && s[i] != '\t' && s[i] != '\n' && !is_operator_char(s[i])) {
+        if (s[i] == '\\') {
+            i = i + 2 < len ? i + 2 : len;
+        } else if (s[i] == '\'' || s[i] == '"' || s[i] == '`' ||
+                   (s[i] == '$' && i + 1 < len && (s[i + 1] == '(' || s[i + 1] == '{'))) {
+            i = skip_quoted(s, len, i);
+        } else {
+            i++;
+        }
+    }
+    *next = state & ~STATE_TARGET_MASK;
+    return i;
+}
+
+// The word with quotes removed, false if it expands to something unknown
+// until run time (parameters, substitutions, globs) or is too long
+static bool unquote(const char *s, size_t len, char *out) {
+    size_t n = 0;
+    char quote = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (c == '$' || c == '`' || (!quote && (c == '*' || c == '?' || c == '['))) {
+            if (quote != '\'') {
+                return false;
+            }
+        }
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+                continue;
+            }
+            if (quote == '"' && c == '\\' && i + 1 < len &&
+                strchr("\"\\$`", s[i + 1])) {
+                c = s[++i];
+            }
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            continue;
+        } else if (c == '\\' && i + 1 < len) {
+            c = s[++i];
+        }
+        if (n + 1 >= WORD_MAX) {
+            return false;
+        }
+        out[n++] = c;
+    }
+    out[n] = '\0';
+    return true;
+}
+
+// ~ and ~/... against $HOME; false for ~user
+static bool expand_tilde(const char *word, char *out, size_t size) {
+    if (word[0] != '~') {
+        return snprintf(out, size, "%s", word) < (int)size;
+    }
+    const char *home = getenv("HOME");
+    if (!home || (word[1] && word[1] != '/')) {
+        return false;
+    }
+    return snprintf(out, size, "%s%s", home, word + 1) < (int)size;
+}
+
+// Command words that keep the next word in command position
+static bool is_prefix_word(const char *word) {
+    const amcsh_builtin_t *builtin = amcsh_builtin_lookup(word);
+    return builtin && (builtin->flags & (AMCSH_BUILTIN_PREFIX | AMCSH_BUILTIN_KEYWORD));
+}
+
+// NAME=value before the command
+static bool is_assignment(const char *s, size_t len) {
+    size_t i = 0;
+    while (i < len && (s[i] == '_' || (s[i] >= 'a' && s[i] <= 'z') ||
+                       (s[i] >= 'A' && s[i] <= 'Z') || (i > 0 && s[i] >= '0' && s[i] <= '9'))) {
+        i++;
+    }
+    return i > 0 && i < len && s[i] == '=';
+}
+
+// Options and counts after a prefix ("nice -n 5 make") are not the command
+static bool is_option_word(const char *word) {
+    if (word[0] == '-') {
+        return true;
+    }
+    for (; *word; word++) {
+        if (*word < '0' || *word > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint8_t classify_path(amcsh_highlight_t *hl, const char *word, bool command) {
+    char path[PATH_MAX];
+    if (!expand_tilde(word, path, sizeof(path))) {
+        return AMCSH_HL_PLAIN;
+    }
+    uint8_t status = path_status(hl, path);
+    if (status & PATH_PENDING) {
+        return AMCSH_HL_PLAIN;
+    }
+    if (command) {
+        return status & PATH_EXEC ? AMCSH_HL_COMMAND : AMCSH_HL_UNKNOWN;
+    }
+    return status & PATH_EXISTS ? AMCSH_HL_PATH : AMCSH_HL_MISSING;
+}
+
+// Builtins first, then the command cache, then the completion index. The
+// index is built on the pool the first time it is wanted; words stay plain
+// until it is ready.
+static uint8_t classify_command(amcsh_highlight_t *hl, const char *word) {
+    if (strchr(word, '/')) {
+        return classify_path(hl, word, true);
+    }
+    if (amcsh_builtin_lookup(word) || amcsh_cache_contains(word)) {
+        return AMCSH_HL_COMMAND;
+    }
+    int known = amcsh_completion_lookup(word);
+    if (known < 0) {
+        if (!atomic_exchange(&index_requested, true) &&
+            !amcsh_thread_pool_try_submit(shell_state.thread_pool, index_task, NULL)) {
+            atomic_store(&index_requested, false);
+        }
+        return AMCSH_HL_PLAIN;
+    }
+    return known ? AMCSH_HL_COMMAND : AMCSH_HL_UNKNOWN;
+}
+
+static uint8_t classify(amcsh_highlight_t *hl, const amcsh_hl_token_t *tok) {
+    if (tok->kind == TOKEN_OPERATOR) {
+        return AMCSH_HL_OPERATOR;
+    }
+    if (tok->kind == TOKEN_REDIRECT) {
+        return AMCSH_HL_REDIRECT;
+    }
+
+    const char *s = hl->text + tok->start;
+    size_t len = tok->end - tok->start;
+    char word[WORD_MAX];
+    uint8_t target = tok->state & STATE_TARGET_MASK;
+    if (target) {
+        if (target == STATE_TARGET_INPUT && unquote(s, len, word)) {
+            return classify_path(hl, word, false);
+        }
+        return AMCSH_HL_PLAIN;
+    }
+    if (tok->state & STATE_COMMAND) {
+        if (is_assignment(s, len) || !unquote(s, len, word) || !*word) {
+            return AMCSH_HL_PLAIN;
+        }
+        // After a prefix, its options stay plain until the command
+        if ((tok->state & STATE_AFTER_PREFIX) && is_option_word(word)) {
+            return AMCSH_HL_PLAIN;
+        }
+        return classify_command(hl, word);
+    }
+    // Arguments are checked when they look like paths
+    if (unquote(s, len, word) && (word[0] == '~' || strchr(word, '/'))) {
+        return classify_path(hl, word, false);
+    }
+    return AMCSH_HL_PLAIN;
+}
+
+// State after a word, which may keep the command position
+static uint8_t word_next_state(const char *s, size_t len, uint8_t state, uint8_t next) {
+    if ((state & STATE_COMMAND) && !(state & STATE_TARGET_MASK)) {
+        char word[WORD_MAX];
+        if (is_assignment(s, len)) {
+            return next;
+        }
+        if (unquote(s, len, word)) {
+            if (is_prefix_word(word)) {
+                return next | STATE_AFTER_PREFIX;
+            }
+            if ((state & STATE_AFTER_PREFIX) && is_option_word(word)) {
+                return next;
+            }
+        }
+        return next & ~(STATE_COMMAND | STATE_AFTER_PREFIX);
+    }
+    return next;
+}
+
+static bool reserve(void **array, size_t *cap, size_t need, size_t size) {
+    if (need <= *cap) {
+        return true;
+    }
+    size_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    void *grown = realloc(*array, new_cap * size);
+    if (!grown) {
+        return false;
+    }
+    *array = grown;
+    *cap = new_cap;
+    return true;
+}
+
+// First token ending at or after pos
+static size_t token_at(const amcsh_highlight_t *hl, size_t pos) {
+    size_t lo = 0, hi = hl->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (hl->tokens[mid].end < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Re-lex after the old text's bytes [prefix, old_len - suffix) became the new
+// text's [prefix, len - suffix). hl->text already holds the new text.
+static bool relex(amcsh_highlight_t *hl, size_t old_len, size_t prefix, size_t suffix,
+                  size_t *from, size_t *to) {
+    const char *s = hl->text;
+    size_t len = hl->len;
+    long delta = (long)len - (long)old_len;
+    size_t edit_end = len - suffix;
+
+    // Restart at the token before the edit: a change can join it to the next
+    size_t first = token_at(hl, prefix);
+    size_t pos = 0;
+    uint8_t state = STATE_COMMAND;
+    if (first > 0) {
+        first--;
+        pos = hl->tokens[first].start;
+        state = hl->tokens[first].state;
+    }
+
+    size_t made = 0;
+    size_t old = first;
+    bool synced = false;
+    for (;;) {
+        while (pos < len && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n')) {
+            pos++;
+        }
+        if (pos >= len) {
+            break;
+        }
+        // Past the edit, an old token starting here in the same state lexes
+        // the same from here on
+        if (pos >= edit_end) {
+            while (old < hl->count && (long)hl->tokens[old].start + delta < (long)pos) {
+                old++;
+            }
+            if (old < hl->count && (long)hl->tokens[old].start + delta == (long)pos &&
+                hl->tokens[old].state == state) {
+                synced = true;
+                break;
+            }
+        }
+        if (!reserve((void **)&hl->scratch, &hl->scratch_cap, made + 1, sizeof(amcsh_hl_token_t))) {
+            return false;
+        }
+        amcsh_hl_token_t *tok = &hl->scratch[made++];
+        uint8_t next;
+        tok->start = pos;
+        tok->state = state;
+        pos = lex_token(s, len, pos, state, &tok->kind, &next);
+        tok->end = pos;
+        if (tok->kind == TOKEN_WORD) {
+            next = word_next_state(s + tok->start, tok->end - tok->start, state, next);
+        }
+        tok->cls = classify(hl, tok);
+        state = next;
+    }
+
+    // Splice: tokens before the restart, the re-lexed ones, the shifted tail
+    size_t tail = synced ? hl->count - old : 0;
+    if (!reserve((void **)&hl->tokens, &hl->token_cap, first + made + tail, sizeof(amcsh_hl_token_t))) {
+        return false;
+    }
+    if (tail) {
+        memmove(&hl->tokens[first + made], &hl->tokens[old], tail * sizeof(amcsh_hl_token_t));
+        for (size_t i = first + made; i < first + made + tail; i++) {
+            hl->tokens[i].start += delta;
+            hl->tokens[i].end += delta;
+        }
+    }
+    memcpy(&hl->tokens[first], hl->scratch, made * sizeof(amcsh_hl_token_t));
+    hl->count = first + made + tail;
+
+    // The line editor redrew everything after an insertion or deletion
+    *from = made ? hl->scratch[0].start : prefix;
+    if (*from > prefix) {
+        *from = prefix;
+    }
+    if (delta != 0) {
+        *to = len;
+    } else {
+        *to = made ? hl->scratch[made - 1].end : prefix;
+        if (*to < edit_end) {
+            *to = edit_end;
+        }
+    }
+    return true;
+}
+
+bool amcsh_highlight_update(amcsh_highlight_t *hl, const char *line, size_t len,
+                            size_t *from, size_t *to) {
+    // Read before any lookup: a result landing during the update repaints again
+    unsigned generation = atomic_load(&results_generation);
+
+    size_t old_len = hl->len;
+    size_t prefix = 0, suffix = 0;
+    size_t common = old_len < len ? old_len : len;
+    while (prefix < common && hl->text[prefix] == line[prefix]) {
+        prefix++;
+    }
+    while (suffix < common - prefix &&
+           hl->text[old_len - 1 - suffix] == line[len - 1 - suffix]) {
+        suffix++;
+    }
+    bool changed = len != old_len || prefix != len;
+    if (!changed && generation == hl->generation && !hl->invalid) {
+        return false;
+    }
+
+    if (len > UINT32_MAX || !reserve((void **)&hl->text, &hl->cap, len + 1, 1)) {
+        return false;
+    }
+    memcpy(hl->text, line, len);
+    hl->text[len] = '\0';
+    hl->len = len;
+
+    *from = *to = 0;
+    if (changed && !relex(hl, old_len, prefix, suffix, from, to)) {
+        hl->count = 0;
+        hl->len = 0;
+        return false;
+    }
+
+    // New lookup results can change any word's class
+    if (generation != hl->generation) {
+        for (size_t i = 0; i < hl->count; i++) {
+            hl->tokens[i].cls = classify(hl, &hl->tokens[i]);
+        }
+    }
+    if (generation != hl->generation || hl->invalid) {
+        *from = 0;
+        *to = len;
+    }
+    hl->generation = generation;
+    hl->invalid = false;
+    path_flush(hl);
+    return *from < *to;
+}
+
+static bool out_append(amcsh_highlight_t *hl, const char *data, size_t len) {
+    if (!reserve((void **)&hl->out, &hl->out_cap, hl->out_len + len + 1, 1)) {
+        return false;
+    }
+    memcpy(hl->out + hl->out_len, data, len);
+    hl->out_len += len;
+    return true;
+}
+
+// Switch colour only where it changes
+static void out_colour(amcsh_highlight_t *hl, const char **current, const char *colour) {
+    if (*current != colour) {
+        out_append(hl, colour, strlen(colour));
+        *current = colour;
+    }
+}
+
+// A word's bytes from start to end: quoted text and expansions have their
+// own colours. The word is scanned from its beginning, word, so a range
+// starting inside a quote is still coloured as one.
+static void render_word(amcsh_highlight_t *hl, const char **current, const char *base,
+                        size_t word, size_t start, size_t end) {
+    const char *s = hl->text;
+    size_t i = word;
+    while (i < end) {
+        size_t next;
+        const char *colour = base;
+        if (s[i] == '\'' || s[i] == '"' || s[i] == '`') {
+            next = skip_quoted(s, hl->len, i);
+            colour = s[i] == '`' ? COLOUR_EXPANSION : COLOUR_STRING;
+        } else if (s[i] == '$' && i + 1 < end && (s[i + 1] == '(' || s[i + 1] == '{')) {
+            next = skip_quoted(s, hl->len, i);
+            colour = COLOUR_EXPANSION;
+        } else if (s[i] == '$') {
+            next = i + 1;
+            while (next < end && (s[next] == '_' || (s[next] >= 'a' && s[next] <= 'z') ||
+                                  (s[next] >= 'A' && s[next] <= 'Z') ||
+                                  (s[next] >= '0' && s[next] <= '9'))) {
+                next++;
+            }
+            if (next == i + 1 && next < end && strchr("?$!#@*-", s[next])) {
+                next++;
+            }
+            colour = next > i + 1 ? COLOUR_EXPANSION : base;
+        } else {
+            next = i + 1;
+            if (s[i] == '\\' && next < end) {
+                next++;
+            }
+            while (next < end && !strchr("'\"`$\\", s[next])) {
+                next++;
+            }
+        }
+        if (next > end) {
+            next = end;
+        }
+        if (next > start) {
+            size_t from = i > start ? i : start;
+            out_colour(hl, current, colour);
+            out_append(hl, s + from, next - from);
+        }
+        i = next;
+    }
+}
+
+const char *amcsh_highlight_render(amcsh_highlight_t *hl, size_t from, size_t to, size_t *len) {
+    hl->out_len = 0;
+    const char *plain = class_colours[AMCSH_HL_PLAIN];
+    const char *current = NULL;
+    if (to > hl->len) {
+        to = hl->len;
+    }
+
+    size_t pos = from;
+    for (size_t i = token_at(hl, from + 1); i < hl->count && hl->tokens[i].start < to; i++) {
+        const amcsh_hl_token_t *tok = &hl->tokens[i];
+        size_t start = tok->start > pos ? tok->start : pos;
+        size_t end = tok->end < to ? tok->end : to;
+        if (start > pos) {
+            out_colour(hl, &current, plain);
+            out_append(hl, hl->text + pos, start - pos);
+        }
+        const char *colour = class_colours[tok->cls];
+        if (tok->kind == TOKEN_WORD) {
+            render_word(hl, &current, colour, tok->start, start, end);
+        } else {
+            out_colour(hl, &current, colour);
+            out_append(hl, hl->text + start, end - start);
+        }
+        pos = end;
+    }
+    if (pos < to) {
+        out_colour(hl, &current, plain);
+        out_append(hl, hl->text + pos, to - pos);
+    }
+    if (current != plain) {
+        out_append(hl, plain, strlen(plain));
+    }
+    *len = hl->out_len;
+    return hl->out;
+}
+
+// Byte offset of the first character at or after column, for a line that
+// amcsh_highlight_columns accepts
+size_t amcsh_highlight_offset(const char *text, size_t len, long column) {
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    size_t i = 0;
+    while (i < len && column > 0) {
+        wchar_t wc;
+        size_t used = 1;
+        int width = 1;
+        if ((unsigned char)text[i] >= 0x80) {
+            used = mbrtowc(&wc, text + i, len - i, &state);
+            if (used == (size_t)-1 || used == (size_t)-2 || used == 0) {
+                break;
+            }
+            width = wcwidth(wc);
+        }
+        column -= width;
+        i += used;
+    }
+    return i;
+}
+
+long amcsh_highlight_columns(const char *text, size_t len) {
+    long columns = 0;
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    for (size_t i = 0; i < len;) {
+        unsigned char c = (unsigned char)text[i];
+        if (c < 0x80) {
+            if (c < 0x20 || c == 0x7f) {
+                return -1;
+            }
+            columns++;
+            i++;
+            continue;
+        }
+        wchar_t wc;
+        size_t used = mbrtowc(&wc, text + i, len - i, &state);
+        if (used == (size_t)-1 || used == (size_t)-2 || used == 0) {
+            return -1;
+        }
+        int width = wcwidth(wc);
+        if (width < 0) {
+            return -1;
+        }
+        columns += width;
+        i += used;
+    }
+    return columns;
+}
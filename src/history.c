@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #define AMCSH_HISTORY_FILE "/.amcsh_history"
@@ -11,9 +12,42 @@
 static char **history_items = NULL;
 static int history_count = 0;
 static int history_capacity = 0;
+static pthread_once_t history_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t history_lock = PTHREAD_MUTEX_INITIALIZER; // Adds come from pool workers
+
+static void history_append(const char *cmd);
+static void history_read_file(void);
 
 // Add a command to history
 void amcsh_history_add(const char *cmd) {
+    amcsh_history_load();
+    pthread_mutex_lock(&history_lock);
+    history_append(cmd);
+    pthread_mutex_unlock(&history_lock);
+}
+
+// Add every line of a pasted script at once
+void amcsh_history_add_lines(const char *text) {
+    amcsh_history_load();
+    pthread_mutex_lock(&history_lock);
+    while (*text) {
+        const char *end = strchr(text, '\n');
+        if (!end) {
+            end = text + strlen(text);
+        }
+        size_t len = end - text;
+        if (len > 0 && len < AMCSH_MAX_CMD_LENGTH) {
+            char line[AMCSH_MAX_CMD_LENGTH];
+            memcpy(line, text, len);
+            line[len] = '\0';
+            history_append(line);
+        }
+        text = *end ? end + 1 : end;
+    }
+    pthread_mutex_unlock(&history_lock);
+}
+
+static void history_append(const char *cmd) {
     // Skip empty commands
     if (!cmd || !*cmd || (*cmd == '\n' && *(cmd+1) == '\0')) {
         return;
@@ -34,7 +68,8 @@ void amcsh_history_add(const char *cmd) {
     
     // Initialize history if needed
     if (!history_items) {
-        history_capacity = AMCSH_HISTORY_SIZE;
+        const char *size = getenv("AMCSH_HISTORY_SIZE");
+        history_capacity = size && atoi(size) > 0 ? atoi(size) : AMCSH_HISTORY_SIZE;
         history_items = calloc(history_capacity, sizeof(char*));
         if (!history_items) {
             free(cmd_copy);
@@ -53,20 +88,26 @@ void amcsh_history_add(const char *cmd) {
     history_items[history_count++] = cmd_copy;
 }
 
-// Get a command from history by index
-char *amcsh_history_get(int index) {
-    if (index < 0 || index >= history_count) {
-        return NULL;
-    }
-    return history_items[index];
+// Copy the oldest limit entries; the caller frees the copies and the array.
+// Entries are copied under the lock because workers may evict them.
+char **amcsh_history_snapshot(int limit, int *count) {
+    amcsh_history_load();
+    pthread_mutex_lock(&history_lock);
+    int n = history_count < limit ? history_count : limit;
+    char **items = n > 0 ? calloc(n, sizeof(char *)) : NULL;
+    if (!items) {
+        n = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        items[i] = strdup(history_items[i]);
+    }
+    pthread_mutex_unlock(&history_lock);
+    *count = n;
+    return items;
 }
 
 // Save history to file
 void amcsh_history_save(void) {
-    if (!history_items || history_count == 0) {
-        return;
-    }
-    
     char *home = getenv("HOME");
     if (!home) {
         return;
@@ -75,20 +116,23 @@ void amcsh_history_save(void) {
     char history_path[AMCSH_MAX_CMD_LENGTH];
     snprintf(history_path, sizeof(history_path), "%s%s", home, AMCSH_HISTORY_FILE);
     
-    FILE *fp = fopen(history_path, "w");
-    if (!fp) {
-        return;
-    }
-    
-    for (int i = 0; i < history_count; i++) {
-        fprintf(fp, "%s\n", history_items[i]);
+    pthread_mutex_lock(&history_lock);
+    FILE *fp = history_count > 0 ? fopen(history_path, "w") : NULL;
+    if (fp) {
+        for (int i = 0; i < history_count; i++) {
+            fprintf(fp, "%s\n", history_items[i]);
+        }
+        fclose(fp);
     }
-    
-    fclose(fp);
+    pthread_mutex_unlock(&history_lock);
 }
 
-// Load history from file
+// The file is read the first time history is used, not at startup
 void amcsh_history_load(void) {
+    pthread_once(&history_once, history_read_file);
+}
+
+static void history_read_file(void) {
     char *home = getenv("HOME");
     if (!home) {
         return;
@@ -110,7 +154,7 @@ void amcsh_history_load(void) {
     
     char line[AMCSH_MAX_CMD_LENGTH];
     while (fgets(line, sizeof(line), fp)) {
-        amcsh_history_add(line);
+        history_append(line);
     }
     
     fclose(fp);
@@ -118,11 +162,15 @@ void amcsh_history_load(void) {
 
 // Search history for a pattern
 char **amcsh_history_search(const char *pattern, int *num_results) {
-    if (!pattern || !history_items || history_count == 0) {
-        *num_results = 0;
+    amcsh_history_load();
+    *num_results = 0;
+    if (!pattern) {
         return NULL;
     }
-    
+
+    pthread_mutex_lock(&history_lock);
+    char **results = NULL;
+
     // Count matches
     int count = 0;
     for (int i = 0; i < history_count; i++) {
@@ -131,26 +179,17 @@ char **amcsh_history_search(const char *pattern, int *num_results) {
         }
     }
     
-    if (count == 0) {
-        *num_results = 0;
-        return NULL;
-    }
-    
-    // Allocate result array
-    char **results = calloc(count, sizeof(char*));
-    if (!results) {
-        *num_results = 0;
-        return NULL;
-    }
-    
-    // Fill results
-    int j = 0;
-    for (int i = 0; i < history_count; i++) {
-        if (strstr(history_items[i], pattern)) {
-            results[j++] = strdup(history_items[i]);
+    // Allocate and fill the result array
+    if (count > 0 && (results = calloc(count, sizeof(char*)))) {
+        int j = 0;
+        for (int i = 0; i < history_count; i++) {
+            if (strstr(history_items[i], pattern)) {
+                results[j++] = strdup(history_items[i]);
+            }
         }
+        *num_results = count;
     }
-    
-    *num_results = count;
+
+    pthread_mutex_unlock(&history_lock);
     return results;
 }
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "libamcsh.h"
+#include "parser.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+__thread amcsh_state_t *amcsh_current_state = NULL;
+
+struct amcsh_interp {
+    amcsh_state_t state;
+};
+
+void amcsh_state_init(amcsh_state_t *state) {
+    memset(state, 0, sizeof(*state));
+
+    // Initialize locks with default attributes
+    pthread_mutex_init(&state->job_mutex, NULL);
+    pthread_rwlock_init(&state->cache_lock, NULL);
+
+    // Pre-allocate command cache with a power of 2 size for faster modulo
+    state->cmd_cache = calloc(AMCSH_CMD_CACHE_SIZE, sizeof(amcsh_cmd_cache_entry_t));
+    state->cmd_cache_size = AMCSH_CMD_CACHE_SIZE;
+
+    // Workers start on first submit
+    state->thread_pool = malloc(sizeof(amcsh_thread_pool_t));
+    amcsh_thread_pool_init(state->thread_pool, state);
+}
+
+void amcsh_state_destroy(amcsh_state_t *state) {
+    amcsh_state_t *saved = amcsh_current_state;
+    amcsh_current_state = state;
+
+    amcsh_thread_pool_shutdown(state->thread_pool);
+    free(state->thread_pool);
+    state->thread_pool = NULL;
+
+    amcsh_cache_cleanup();
+
+    while (state->jobs) {
+        amcsh_job_t *job = state->jobs;
+        state->jobs = job->next;
+        amcsh_job_free(job);
+    }
+    pthread_mutex_destroy(&state->job_mutex);
+
+    amcsh_current_state = saved;
+}
+
+// Here-document lines from a script, in a buffer of their own
+static const char *read_script_line(void *ctx) {
+    static __thread char *line = NULL;
+    static __thread size_t capacity = 0;
+    return getline(&line, &capacity, (FILE *)ctx) < 0 ? NULL : line;
+}
+
+typedef struct {
+    int fd;
+    amcsh_output_t *out;
+} drain_t;
+
+static void *drain_task(void *arg) {
+    drain_t *drain = arg;
+    sigset_t interrupt; // Ctrl-C is for the shell thread
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &interrupt, NULL);
+    char buf[65536];
+    for (;;) {
+        ssize_t n = read(drain->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        struct iovec iov = {buf, (size_t)n};
+        amcsh_output_writev(drain->out, &iov, 1);
+    }
+    return NULL;
+}
+
+// Builtins and { } groups already write into the capture; the last stage of
+// anything else writes into a pipe that a reader thread drains while the
+// command runs
+void amcsh_execute_captured(amcsh_command_t *cmd, amcsh_output_t *capture) {
+    amcsh_command_t *last = cmd;
+    while (last->next) last = last->next;
+
+    bool single = !cmd->next && ((cmd->builtin && cmd->builtin->func) ||
+                                 (cmd->group && !cmd->subshell));
+    bool direct = single || last->redirect_out >= 0 || cmd->background;
+    int fds[2];
+    if (direct || pipe2(fds, O_CLOEXEC) != 0) {
+        amcsh_execute(cmd);
+        return;
+    }
+
+    drain_t drain = {fds[0], capture};
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, drain_task, &drain) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        amcsh_execute(cmd);
+        return;
+    }
+
+    last->pipe_write = fds[1];
+    amcsh_execute(cmd);
+    if (last->pipe_write >= 0) {
+        close(last->pipe_write); // Not consumed when nothing ran
+        last->pipe_write = -1;
+    }
+    pthread_join(reader, NULL);
+    close(fds[0]);
+}
+
+// read and external commands take their input from the script's own file
+// when it is stdin: put the file offset back to the end of the command
+// before it runs. Pipes cannot seek, so they are read unbuffered instead.
+static void sync_input(FILE *in) {
+    if (fileno(in) >= 0) {
+        fflush(in);
+    }
+}
+
+// Non-interactive mode: no line editing, history or prompt
+void amcsh_run_script(FILE *in, amcsh_output_t *capture) {
+    // Lines have no length limit: pasted text and -c strings can be long
+    char *buffer = NULL;
+    size_t capacity = 0;
+    while (!shell_state.exit_requested) {
+        AMCSH_TRACE_BEGIN(read_start);
+        ssize_t len = getline(&buffer, &capacity, in);
+        AMCSH_TRACE_END(AMCSH_PHASE_READ, read_start);
+        if (len < 0) {
+            break;
+        }
+
+        // A host installs no SIGCHLD handler of ours, so always look for finished jobs
+        if (shell_state.embedded) {
+            amcsh_child_exited = 1;
+        }
+        amcsh_update_jobs();
+
+        if (amcsh_list_needed(buffer)) {
+            char *text = amcsh_list_read(buffer, read_script_line, in);
+            sync_input(in);
+            if (text) {
+                amcsh_list_run(text, capture);
+                free(text);
+            }
+            continue;
+        }
+
+        amcsh_command_t cmd;
+        amcsh_command_init(&cmd, buffer);
+        AMCSH_TRACE_BEGIN(parse_start);
+        amcsh_parse_command(&cmd);
+        AMCSH_TRACE_END(AMCSH_PHASE_PARSE, parse_start);
+        amcsh_prefetch_pipeline(&cmd);
+        amcsh_heredoc_read(&cmd, read_script_line, in);
+        sync_input(in);
+        if (cmd.argc > 0 || cmd.timed || cmd.group || cmd.next) {
+            if (capture) {
+                amcsh_execute_captured(&cmd, capture);
+            } else {
+                amcsh_execute(&cmd);
+            }
+        }
+        amcsh_command_free(&cmd);
+    }
+    free(buffer);
+}
+
+amcsh_interp_t *amcsh_interp_create(void) {
+    amcsh_interp_t *interp = malloc(sizeof(amcsh_interp_t));
+    if (!interp) {
+        return NULL;
+    }
+    amcsh_state_init(&interp->state);
+    interp->state.embedded = true;
+    if (!interp->state.cmd_cache || !interp->state.thread_pool) {
+        amcsh_interp_destroy(interp);
+        return NULL;
+    }
+    return interp;
+}
+
+void amcsh_interp_destroy(amcsh_interp_t *interp) {
+    if (interp) {
+        amcsh_state_destroy(&interp->state);
+        free(interp);
+    }
+}
+
+static int interp_run(amcsh_interp_t *interp, const char *script, amcsh_output_t *capture) {
+    FILE *in = fmemopen((void *)script, strlen(script), "r");
+    if (!in) {
+        return interp->state.exit_status = 1;
+    }
+
+    amcsh_state_t *saved = amcsh_current_state;
+    amcsh_current_state = &interp->state;
+    interp->state.exit_requested = false;
+
+    amcsh_run_script(in, capture);
+
+    amcsh_current_state = saved;
+    fclose(in);
+    return interp->state.exit_status;
+}
+
+int amcsh_interp_run(amcsh_interp_t *interp, const char *script) {
+    // Anything the host buffered must come out before the commands' output
+    fflush(stdout);
+    return interp_run(interp, script, NULL);
+}
+
+int amcsh_interp_capture(amcsh_interp_t *interp, const char *script,
+                         char **output, size_t *length) {
+    amcsh_output_t capture;
+    amcsh_output_init(&capture, -1, NULL, 0);
+
+    amcsh_io_t saved;
+    amcsh_io_enter(&capture, -1, &saved);
+    int status = interp_run(interp, script, &capture);
+    amcsh_io_leave(&saved);
+
+    size_t len;
+    char *text = amcsh_output_take(&capture, &len);
+    if (!text) {
+        text = calloc(1, 1);
+        len = 0;
+    }
+    *output = text;
+    if (length) {
+        *length = len;
+    }
+    return status;
+}
+
+int amcsh_interp_status(const amcsh_interp_t *interp) {
+    return interp->state.exit_status;
+}
@@ -1,3 +1,253 @@
+#define _GNU_SOURCE
 #include "amcsh.h"
-// Placeholder for job control implementation
-void amcsh_update_jobs(void) {}
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// Set by the SIGCHLD handler; jobs are reaped outside the handler
+volatile sig_atomic_t amcsh_child_exited = 0;
+
+// Set by the SIGINT handler for builtins that wait, such as joblog -f
+volatile sig_atomic_t amcsh_interrupted = 0;
+
+static double timeval_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+double amcsh_elapsed(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Fold one reaped process into a job's totals
+void amcsh_usage_add(amcsh_usage_t *usage, const struct rusage *ru) {
+    usage->user += timeval_seconds(&ru->ru_utime);
+    usage->sys += timeval_seconds(&ru->ru_stime);
+    if (ru->ru_maxrss > usage->maxrss) {
+        usage->maxrss = ru->ru_maxrss;
+    }
+    usage->minflt += ru->ru_minflt;
+    usage->majflt += ru->ru_majflt;
+    usage->nvcsw += ru->ru_nvcsw;
+    usage->nivcsw += ru->ru_nivcsw;
+}
+
+// Work done by an in-process builtin: the difference of two RUSAGE_THREAD samples
+void amcsh_usage_add_delta(amcsh_usage_t *usage, const struct rusage *before, const struct rusage *after) {
+    usage->user += timeval_seconds(&after->ru_utime) - timeval_seconds(&before->ru_utime);
+    usage->sys += timeval_seconds(&after->ru_stime) - timeval_seconds(&before->ru_stime);
+    usage->minflt += after->ru_minflt - before->ru_minflt;
+    usage->majflt += after->ru_majflt - before->ru_majflt;
+    usage->nvcsw += after->ru_nvcsw - before->ru_nvcsw;
+    usage->nivcsw += after->ru_nivcsw - before->ru_nivcsw;
+}
+
+static int exit_code(int wstatus) {
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+}
+
+// Wait for one child and add its resource usage; returns its shell exit status
+int amcsh_wait_process(pid_t pid, amcsh_usage_t *usage) {
+    int wstatus;
+    struct rusage ru;
+    AMCSH_TRACE_BEGIN(wait_start);
+    while (wait4(pid, &wstatus, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+    AMCSH_TRACE_END(AMCSH_PHASE_WAIT, wait_start);
+    if (usage) {
+        amcsh_usage_add(usage, &ru);
+    }
+    return exit_code(wstatus);
+}
+
+static void print_seconds(const char *label, double seconds) {
+    int minutes = (int)(seconds / 60);
+    fprintf(stderr, "%-7s %dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+// Report in the style of bash's time; -p selects the POSIX format
+void amcsh_usage_report(const amcsh_usage_t *usage, bool posix) {
+    if (posix) {
+        fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", usage->real, usage->user, usage->sys);
+        return;
+    }
+    fprintf(stderr, "\n");
+    print_seconds("real", usage->real);
+    print_seconds("user", usage->user);
+    print_seconds("sys", usage->sys);
+    fprintf(stderr, "%-7s %ld KB\n", "maxrss", usage->maxrss);
+    fprintf(stderr, "%-7s %ld major, %ld minor\n", "faults", usage->majflt, usage->minflt);
+    fprintf(stderr, "%-7s %ld voluntary, %ld involuntary\n", "ctxsw", usage->nvcsw, usage->nivcsw);
+}
+
+// AMCSH_REPORTTIME=N reports any command using more than N seconds of CPU
+bool amcsh_usage_over_reporttime(const amcsh_usage_t *usage) {
+    const char *threshold = getenv("AMCSH_REPORTTIME");
+    if (!threshold || !*threshold) {
+        return false;
+    }
+    char *end;
+    double seconds = strtod(threshold, &end);
+    return *end == '\0' && seconds >= 0 && usage->user + usage->sys > seconds;
+}
+
+void amcsh_job_add(pid_t pgid, const pid_t *pids, int count, const char *command) {
+    amcsh_job_t *job = calloc(1, sizeof(amcsh_job_t));
+    job->pgid = pgid;
+    job->command = strndup(command, strcspn(command, "\n"));
+    job->status = JOB_RUNNING;
+    job->pids = malloc(count * sizeof(pid_t));
+    memcpy(job->pids, pids, count * sizeof(pid_t));
+    job->pid_count = count;
+    job->running = count;
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+
+    // Oldest first; a new job takes the number after the highest in use
+    pthread_mutex_lock(&shell_state.job_mutex);
+    amcsh_job_t **link = &shell_state.jobs;
+    int number = 0;
+    while (*link) {
+        number = (*link)->number;
+        link = &(*link)->next;
+    }
+    job->number = number + 1;
+    *link = job;
+    pthread_mutex_unlock(&shell_state.job_mutex);
+}
+
+// The process group of job %number, or 0
+pid_t amcsh_job_pgid(int number) {
+    pid_t pgid = 0;
+    pthread_mutex_lock(&shell_state.job_mutex);
+    for (amcsh_job_t *job = shell_state.jobs; job; job = job->next) {
+        if (job->number == number) {
+            pgid = job->pgid;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shell_state.job_mutex);
+    return pgid;
+}
+
+// The number of the job led by pgid, or 0
+int amcsh_job_number(pid_t pgid) {
+    int number = 0;
+    pthread_mutex_lock(&shell_state.job_mutex);
+    for (amcsh_job_t *job = shell_state.jobs; job; job = job->next) {
+        if (job->pgid == pgid) {
+            number = job->number;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shell_state.job_mutex);
+    return number;
+}
+
+// Signal job %number. Only interactive shells give a job a process group of
+// its own; otherwise each process not yet reaped is signalled. Returns -1
+// with errno set on failure (ESRCH for no such job).
+int amcsh_job_kill(int number, int signo) {
+    pthread_mutex_lock(&shell_state.job_mutex);
+    amcsh_job_t *job = shell_state.jobs;
+    while (job && job->number != number) {
+        job = job->next;
+    }
+    int result = -1;
+    errno = ESRCH;
+    if (job && job->status != JOB_DONE) {
+        result = kill(-job->pgid, signo);
+        if (result != 0 && errno == ESRCH) {
+            for (int i = 0; i < job->pid_count; i++) {
+                if (job->pids[i] > 0 && kill(job->pids[i], signo) == 0) {
+                    result = 0;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&shell_state.job_mutex);
+    return result;
+}
+
+void amcsh_job_free(amcsh_job_t *job) {
+    free(job->command);
+    free(job->pids);
+    free(job);
+}
+
+// Reap finished background processes and total their usage per job
+void amcsh_update_jobs(void) {
+    if (!amcsh_child_exited) {
+        return;
+    }
+    amcsh_child_exited = 0;
+
+    pthread_mutex_lock(&shell_state.job_mutex);
+    int done = 0;
+    amcsh_job_t **link = &shell_state.jobs;
+    while (*link) {
+        amcsh_job_t *job = *link;
+
+        for (int i = 0; i < job->pid_count && job->running > 0; i++) {
+            if (job->pids[i] <= 0) {
+                continue;
+            }
+            int wstatus;
+            struct rusage ru;
+            pid_t pid = wait4(job->pids[i], &wstatus, WNOHANG, &ru);
+            if (pid == job->pids[i] || (pid < 0 && errno == ECHILD)) {
+                if (pid > 0) {
+                    amcsh_usage_add(&job->usage, &ru);
+                    // Like a pipeline, the job's status is its last process's
+                    if (i == job->pid_count - 1) {
+                        job->exit_status = exit_code(wstatus);
+                    }
+                }
+                job->pids[i] = -job->pids[i];
+                job->running--;
+            }
+        }
+
+        if (job->running == 0 && job->status != JOB_DONE) {
+            job->status = JOB_DONE;
+            job->usage.real = amcsh_elapsed(&job->started);
+
+            if (amcsh_usage_over_reporttime(&job->usage)) {
+                fprintf(stderr, "[%d] %s", job->number, job->command);
+                amcsh_usage_report(&job->usage, false);
+            }
+
+            // Interactive shells announce and forget finished jobs
+            if (shell_state.interactive) {
+                fprintf(stderr, "[%d] Done\t%s\n", job->number, job->command);
+                *link = job->next;
+                amcsh_job_free(job);
+                continue;
+            }
+        }
+
+        done += job->status == JOB_DONE;
+        link = &job->next;
+    }
+
+    // Scripts keep finished jobs for "jobs" to report, but only the newest
+    // few: a loop that backgrounds work would otherwise grow the list forever
+    for (link = &shell_state.jobs; *link && done > AMCSH_MAX_DONE_JOBS;) {
+        amcsh_job_t *job = *link;
+        if (job->status == JOB_DONE) {
+            *link = job->next;
+            amcsh_job_free(job);
+            done--;
+        } else {
+            link = &job->next;
+        }
+    }
+    pthread_mutex_unlock(&shell_state.job_mutex);
+}
@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+// Background job output capture (AMCSH_JOBLOG=1). Each job started with &
+// gets a pipe as its stdout and stderr instead of the terminal. A drain
+// thread moves whatever arrives into that job's ring, which overwrites its
+// oldest bytes, so a chatty job costs one ring however much it writes. The
+// joblog builtin prints a ring or follows it. Logs outlive their jobs so the
+// tail can still be read; the oldest finished ones are dropped.
+
+#define JOBLOG_DEFAULT_SIZE (64 * 1024)
+#define JOBLOG_MIN_SIZE 4096
+#define JOBLOG_MAX_SIZE (64 << 20)
+#define JOBLOG_KEEP 16         // Finished logs kept for reading
+#define JOBLOG_EVENTS 16
+#define JOBLOG_POLL_MS 200     // How often joblog -f looks for Ctrl-C
+
+typedef struct joblog {
+    pid_t pgid;
+    char *command;
+    char *ring;
+    size_t size;
+    uint64_t total;        // Bytes ever written; the ring holds the last min(total, size)
+    int fd;                // Read end, -1 once every writer has closed it
+    int readers;           // joblog calls using this log; it is not freed under them
+    struct joblog *next;   // Newest first
+} joblog_t;
+
+static pthread_mutex_t joblog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t joblog_changed = PTHREAD_COND_INITIALIZER;
+static joblog_t *logs;
+static int epoll_fd = -1;
+static pid_t owner;            // Process the drain thread runs in
+static int enabled = -1;       // AMCSH_JOBLOG, read on first use
+static size_t ring_size;
+
+static void read_settings(void) {
+    const char *setting = getenv("AMCSH_JOBLOG");
+    enabled = setting && strcmp(setting, "1") == 0;
+
+    ring_size = JOBLOG_DEFAULT_SIZE;
+    const char *size = getenv("AMCSH_JOBLOG_SIZE");
+    if (size && *size) {
+        char *end;
+        unsigned long long n = strtoull(size, &end, 10);
+        if (*end == 'K' || *end == 'k') n <<= 10, end++;
+        else if (*end == 'M' || *end == 'm') n <<= 20, end++;
+        if (*end == '\0' && n >= JOBLOG_MIN_SIZE && n <= JOBLOG_MAX_SIZE) {
+            ring_size = n;
+        } else {
+            fprintf(stderr, "amcsh: AMCSH_JOBLOG_SIZE: '%s' is not a size from 4K to 64M\n", size);
+        }
+    }
+}
+
+static void ring_append(joblog_t *log, const char *data, size_t len) {
+    if (len > log->size) {
+        data += len - log->size; // Only the tail survives
+        log->total += len - log->size;
+        len = log->size;
+    }
+    size_t at = log->total % log->size;
+    size_t first = len < log->size - at ? len : log->size - at;
+    memcpy(log->ring + at, data, first);
+    memcpy(log->ring, data + first, len - first);
+    log->total += len;
+}
+
+// Bytes [from, total) into out; from must still be in the ring
+static size_t ring_copy(const joblog_t *log, uint64_t from, char *out) {
+    size_t len = log->total - from;
+    size_t at = from % log->size;
+    size_t first = len < log->size - at ? len : log->size - at;
+    memcpy(out, log->ring + at, first);
+    memcpy(out + first, log->ring, len - first);
+    return len;
+}
+
+static void *drain_task(void *arg) {
+    (void)arg;
+    struct epoll_event events[JOBLOG_EVENTS];
+    char buf[65536];
+    for (;;) {
+        int n = epoll_wait(epoll_fd, events, JOBLOG_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            joblog_t *log = events[i].data.ptr;
+            ssize_t len = read(log->fd, buf, sizeof(buf));
+            if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            pthread_mutex_lock(&joblog_lock);
+            if (len > 0) {
+                ring_append(log, buf, len);
+            } else {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, log->fd, NULL);
+                close(log->fd);
+                log->fd = -1;
+            }
+            pthread_cond_broadcast(&joblog_changed);
+            pthread_mutex_unlock(&joblog_lock);
+        }
+    }
+}
+
+// The drain thread takes no signals: the shell's handlers expect the main thread
+static bool start_drain(void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        return false;
+    }
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, drain_task, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+        return false;
+    }
+    pthread_detach(thread);
+    owner = getpid();
+    return true;
+}
+
+// Returns the write end to give a background job's processes, keeping the
+// read end in *read_fd for amcsh_joblog_attach; -1 when capture is off. A
+// forked child of a capturing shell writes to its job's pipe already.
+int amcsh_joblog_open(int *read_fd) {
+    if (enabled < 0) {
+        read_settings();
+    }
+    if (!enabled || (epoll_fd >= 0 && getpid() != owner)) {
+        return -1;
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    *read_fd = fds[0];
+    return fds[1];
+}
+
+// In a forked job process: stderr, and stdout unless it already goes
+// somewhere, into the log
+void amcsh_joblog_child(int fd, bool out) {
+    dup2(fd, STDERR_FILENO);
+    if (out) {
+        dup2(fd, STDOUT_FILENO);
+    }
+    close(fd);
+}
+
+// The job started; its output is read from now on
+void amcsh_joblog_attach(pid_t pgid, int read_fd, const char *command) {
+    joblog_t *log = calloc(1, sizeof(joblog_t));
+    char *ring = malloc(ring_size);
+    pthread_mutex_lock(&joblog_lock);
+    if (!log || !ring || (epoll_fd < 0 && !start_drain())) {
+        pthread_mutex_unlock(&joblog_lock);
+        free(log);
+        free(ring);
+        close(read_fd);
+        return;
+    }
+    log->pgid = pgid;
+    log->command = strndup(command, strcspn(command, "\n"));
+    log->ring = ring;
+    log->size = ring_size;
+    log->fd = read_fd;
+    log->next = logs;
+    logs = log;
+
+    // Forget the oldest finished logs nobody is reading
+    int finished = 0;
+    for (joblog_t **link = &logs; *link;) {
+        joblog_t *old = *link;
+        if (old->fd < 0 && ++finished > JOBLOG_KEEP && old->readers == 0) {
+            *link = old->next;
+            free(old->command);
+            free(old->ring);
+            free(old);
+            continue;
+        }
+        link = &old->next;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = log};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, read_fd, &ev) != 0) {
+        close(read_fd);
+        log->fd = -1;
+    }
+    pthread_mutex_unlock(&joblog_lock);
+}
+
+static void list_logs(void) {
+    pthread_mutex_lock(&joblog_lock);
+    for (joblog_t *log = logs; log; log = log->next) {
+        int number = amcsh_job_number(log->pgid);
+        char label[16] = "";
+        if (number > 0) {
+            snprintf(label, sizeof(label), "[%d]", number);
+        }
+        amcsh_printf("%-5s %-8d %-7s %10llu  %s\n", label, (int)log->pgid,
+                     log->fd >= 0 ? "running" : "done",
+                     (unsigned long long)log->total, log->command);
+    }
+    pthread_mutex_unlock(&joblog_lock);
+}
+
+// Print what the ring holds; with follow, keep printing until the job
+// closes its output or Ctrl-C
+static int print_log(joblog_t *log, bool follow) {
+    char *chunk = malloc(log->size);
+    if (!chunk) {
+        return 1;
+    }
+    amcsh_interrupted = 0;
+    uint64_t pos = 0;
+    pthread_mutex_lock(&joblog_lock);
+    for (;;) {
+        uint64_t start = log->total > log->size ? log->total - log->size : 0;
+        uint64_t dropped = pos < start ? start - pos : 0;
+        if (dropped) {
+            pos = start;
+        }
+        size_t len = pos < log->total ? ring_copy(log, pos, chunk) : 0;
+        pos = log->total;
+        bool open = log->fd >= 0;
+        pthread_mutex_unlock(&joblog_lock);
+
+        if (dropped) {
+            fprintf(stderr, "amcsh: joblog: %llu earlier bytes were overwritten\n",
+                    (unsigned long long)dropped);
+        }
+        amcsh_write(chunk, len);
+        amcsh_flush();
+        if (!follow || !open || amcsh_interrupted) {
+            break;
+        }
+
+        pthread_mutex_lock(&joblog_lock);
+        if (log->total == pos && log->fd >= 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += JOBLOG_POLL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&joblog_changed, &joblog_lock, &deadline);
+        }
+    }
+    free(chunk);
+    return 0;
+}
+
+// joblog              list captured jobs
+// joblog [-f] [%N|PGID] print a job's captured output (default: the newest)
+int amcsh_builtin_joblog(char **args) {
+    bool follow = false;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (strcmp(args[i], "-f") == 0) {
+            follow = true;
+        } else {
+            fprintf(stderr, "amcsh: joblog: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+    if (!args[i] && !follow) {
+        list_logs();
+        return 0;
+    }
+
+    pid_t pgid = 0;
+    if (args[i]) {
+        char *end;
+        const char *spec = args[i][0] == '%' ? args[i] + 1 : args[i];
+        long n = strtol(spec, &end, 10);
+        if (*spec == '\0' || *end != '\0' || n <= 0) {
+            fprintf(stderr, "amcsh: joblog: %s: not a job\n", args[i]);
+            return 2;
+        }
+        pgid = args[i][0] == '%' ? amcsh_job_pgid(n) : (pid_t)n;
+    }
+
+    pthread_mutex_lock(&joblog_lock);
+    joblog_t *log = logs;
+    while (log && args[i] && log->pgid != pgid) {
+        log = log->next;
+    }
+    if (log) {
+        log->readers++;
+    }
+    pthread_mutex_unlock(&joblog_lock);
+    if (!log) {
+        fprintf(stderr, "amcsh: joblog: %s: no captured output\n", args[i] ? args[i] : "no jobs");
+        return 1;
+    }
+
+    int status = print_log(log, follow);
+    pthread_mutex_lock(&joblog_lock);
+    log->readers--;
+    pthread_mutex_unlock(&joblog_lock);
+    return status;
+}
@@ -0,0 +1,916 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "parser.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Command lists and groups. A line holding ; & && || or a ( ) / { } group is
+// split into pipelines here without expanding anything; each pipeline is
+// parsed (and so expanded) only when it is about to run, so "cd dir && ls *"
+// globs in dir. Here-document bodies stay in the command text and are read
+// from there by the pipeline they belong to.
+//
+// A ( ) subshell runs in this process when nothing in it can change state
+// that a snapshot cannot put back; only the rest pay for a fork.
+
+#define LIST_MAX_HEREDOCS 16
+#define LIST_MAX_DEPTH 64
+#define LIST_DELIM_MAX 256
+
+enum {
+    TOK_END,
+    TOK_WORD,
+    TOK_NEWLINE,
+    TOK_SEMI,
+    TOK_AMP,
+    TOK_AND,
+    TOK_OR,
+    TOK_PIPE,
+    TOK_OPEN,
+    TOK_CLOSE,
+    TOK_REDIRECT,          // Operator and its target word
+};
+
+typedef enum {
+    JOIN_SEQ,              // First of an and-or list
+    JOIN_AND,              // && : runs if the previous one succeeded
+    JOIN_OR,               // || : runs if it failed
+} join_t;
+
+// One pipeline of a list
+typedef struct {
+    const char *start, *end;
+    join_t join;
+    bool background;       // Ends an and-or list followed by &
+    const char *bodies, *bodies_end; // Its here-document body lines
+} segment_t;
+
+// Here-document whose body starts after the current line
+typedef struct {
+    char delim[LIST_DELIM_MAX];
+    size_t len;
+    bool strip_tabs;
+    int owner;             // Segment index; -1 inside a group, -2 not yet known
+} pending_doc_t;
+
+typedef struct {
+    const char *p, *end;
+    const char *start;     // Text of the last token
+    pending_doc_t docs[LIST_MAX_HEREDOCS];
+    int ndocs;
+    segment_t *segments;   // Where finished bodies are recorded, if anywhere
+    bool unterminated;     // A body ran to the end of the text
+} lexer_t;
+
+typedef struct {
+    segment_t *items;
+    int count, cap;
+    bool incomplete;       // Needs more lines: open group, trailing operator or body
+    const char *error;     // Unexpected token, for the syntax error
+} list_t;
+
+static __thread amcsh_output_t *list_capture; // Capture of the list running on this thread
+
+// Lexer
+
+static const char *skip_parens(const char *p, const char *end);
+
+static const char *skip_dquote(const char *p, const char *end) {
+    while (p < end && *p != '"') {
+        if (*p == '\\' && p + 1 < end) {
+            p += 2;
+        } else if (*p == '$' && p + 1 < end && p[1] == '(') {
+            p = skip_parens(p + 2, end);
+        } else {
+            p++;
+        }
+    }
+    return p < end ? p + 1 : end;
+}
+
+// Past the ')' closing a "$(" whose body starts at p
+static const char *skip_parens(const char *p, const char *end) {
+    int depth = 1;
+    while (p < end) {
+        char c = *p++;
+        if (c == '\\' && p < end) {
+            p++;
+        } else if (c == '\'') {
+            const char *q = memchr(p, '\'', end - p);
+            p = q ? q + 1 : end;
+        } else if (c == '"') {
+            p = skip_dquote(p, end);
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            break;
+        }
+    }
+    return p;
+}
+
+static bool is_operator_char(char c) {
+    return c == ';' || c == '&' || c == '|' || c == '(' || c == ')' || c == '<' || c == '>';
+}
+
+static const char *skip_word(const char *p, const char *end) {
+    while (p < end) {
+        char c = *p;
+        if (c == ' ' || c == '\t' || c == '\n' || is_operator_char(c)) {
+            break;
+        }
+        if (c == '\\') {
+            p += p + 1 < end ? 2 : 1;
+        } else if (c == '\'') {
+            const char *q = memchr(p + 1, '\'', end - p - 1);
+            p = q ? q + 1 : end;
+        } else if (c == '"') {
+            p = skip_dquote(p + 1, end);
+        } else if (c == '`') {
+            p++;
+            while (p < end && *p != '`') {
+                p += *p == '\\' && p + 1 < end ? 2 : 1;
+            }
+            if (p < end) p++;
+        } else if (c == '$' && p + 1 < end && p[1] == '(') {
+            p = skip_parens(p + 2, end);
+        } else if (c == '$' && p + 1 < end && p[1] == '{') {
+            const char *q = memchr(p, '}', end - p);
+            p = q ? q + 1 : end;
+        } else {
+            p++;
+        }
+    }
+    return p;
+}
+
+static void lexer_init(lexer_t *lx, const char *text, size_t len) {
+    memset(lx, 0, sizeof(*lx));
+    lx->p = text;
+    lx->end = text + len;
+}
+
+static bool token_is(const lexer_t *lx, const char *word) {
+    size_t len = strlen(word);
+    return (size_t)(lx->p - lx->start) == len && memcmp(lx->start, word, len) == 0;
+}
+
+// Delimiter with its quoting removed, as the parser compares it
+static void add_heredoc(lexer_t *lx, const char *word, const char *end, bool strip_tabs) {
+    if (lx->ndocs == LIST_MAX_HEREDOCS) {
+        return;
+    }
+    pending_doc_t *doc = &lx->docs[lx->ndocs++];
+    doc->len = 0;
+    doc->strip_tabs = strip_tabs;
+    doc->owner = -2;
+    char quote = 0;
+    for (const char *p = word; p < end && doc->len + 1 < sizeof(doc->delim); p++) {
+        if (quote) {
+            if (*p == quote) quote = 0;
+            else doc->delim[doc->len++] = *p;
+        } else if (*p == '\'' || *p == '"') {
+            quote = *p;
+        } else if (*p == '\\' && p + 1 < end) {
+            doc->delim[doc->len++] = *++p;
+        } else {
+            doc->delim[doc->len++] = *p;
+        }
+    }
+}
+
+// Bodies of the line's here-documents follow it; skip them and note where
+// each owner's lines are
+static void skip_bodies(lexer_t *lx) {
+    for (int i = 0; i < lx->ndocs; i++) {
+        pending_doc_t *doc = &lx->docs[i];
+        const char *start = lx->p;
+        bool found = false;
+        while (lx->p < lx->end && !found) {
+            const char *line = lx->p;
+            const char *nl = memchr(line, '\n', lx->end - line);
+            const char *line_end = nl ? nl : lx->end;
+            lx->p = nl ? nl + 1 : lx->end;
+            if (doc->strip_tabs) {
+                while (line < line_end && *line == '\t') line++;
+            }
+            found = (size_t)(line_end - line) == doc->len && memcmp(line, doc->delim, doc->len) == 0;
+        }
+        if (!found) {
+            lx->unterminated = true;
+        }
+        if (doc->owner >= 0 && lx->segments) {
+            segment_t *seg = &lx->segments[doc->owner];
+            if (!seg->bodies) seg->bodies = start;
+            seg->bodies_end = lx->p;
+        }
+    }
+    lx->ndocs = 0;
+}
+
+static int next_token(lexer_t *lx) {
+    while (lx->p < lx->end) {
+        if (*lx->p == ' ' || *lx->p == '\t') {
+            lx->p++;
+        } else if (*lx->p == '\\' && lx->p + 1 < lx->end && lx->p[1] == '\n') {
+            lx->p += 2;
+        } else {
+            break;
+        }
+    }
+    lx->start = lx->p;
+    if (lx->p >= lx->end) {
+        return TOK_END;
+    }
+
+    char c = *lx->p++;
+    char next = lx->p < lx->end ? *lx->p : '\0';
+    switch (c) {
+        case '\n':
+            skip_bodies(lx);
+            return TOK_NEWLINE;
+        case ';':
+            return TOK_SEMI;
+        case '&':
+            if (next == '&') {
+                lx->p++;
+                return TOK_AND;
+            }
+            return TOK_AMP;
+        case '|':
+            if (next == '|') {
+                lx->p++;
+                return TOK_OR;
+            }
+            return TOK_PIPE;
+        case '(':
+            return TOK_OPEN;
+        case ')':
+            return TOK_CLOSE;
+        case '<':
+        case '>': {
+            if (next == '(') {
+                lx->p = skip_parens(lx->p + 1, lx->end); // Process substitution
+                return TOK_WORD;
+            }
+            bool heredoc = false, strip_tabs = false;
+            if (next == '&') {
+                lx->p++; // >&N and <&N
+            } else if (next == c) {
+                lx->p++;
+                if (c == '<' && lx->p < lx->end && *lx->p == '<') {
+                    lx->p++; // <<<
+                } else if (c == '<') {
+                    heredoc = true;
+                    if (lx->p < lx->end && *lx->p == '-') {
+                        strip_tabs = true;
+                        lx->p++;
+                    }
+                }
+            }
+            while (lx->p < lx->end && (*lx->p == ' ' || *lx->p == '\t')) lx->p++;
+            const char *word = lx->p;
+            lx->p = skip_word(lx->p, lx->end);
+            if (heredoc) {
+                add_heredoc(lx, word, lx->p, strip_tabs);
+            }
+            return TOK_REDIRECT;
+        }
+        default:
+            lx->p = skip_word(lx->p - 1, lx->end);
+            return TOK_WORD;
+    }
+}
+
+// Groups
+
+// Track ( ) and { } nesting; returns the new depth. "{" and "}" only count
+// as words in command position, "(" only there too.
+static int track_group(lexer_t *lx, int kind, char *stack, int depth, bool *command) {
+    switch (kind) {
+        case TOK_OPEN:
+            if (*command && depth < LIST_MAX_DEPTH) {
+                stack[depth++] = '(';
+            }
+            break;
+        case TOK_CLOSE:
+            if (depth > 0 && stack[depth - 1] == '(') {
+                depth--;
+            }
+            *command = false;
+            return depth;
+        case TOK_WORD:
+            if (*command && token_is(lx, "{") && depth < LIST_MAX_DEPTH) {
+                stack[depth++] = '{';
+                return depth;
+            }
+            if (*command && token_is(lx, "}") && depth > 0 && stack[depth - 1] == '{') {
+                depth--;
+            }
+            *command = false;
+            return depth;
+        case TOK_REDIRECT:
+            return depth;
+        default:
+            break;
+    }
+    *command = true;
+    return depth;
+}
+
+// The ')' or '}' closing the group opened at open, or NULL if it is not closed
+const char *amcsh_group_end(const char *open) {
+    lexer_t lx;
+    lexer_init(&lx, open + 1, strlen(open + 1));
+    char stack[LIST_MAX_DEPTH] = {*open};
+    int depth = 1;
+    bool command = true;
+    for (;;) {
+        int kind = next_token(&lx);
+        if (kind == TOK_END) {
+            return NULL;
+        }
+        depth = track_group(&lx, kind, stack, depth, &command);
+        if (depth == 0) {
+            return lx.start;
+        }
+    }
+}
+
+// Splitting a list into pipelines
+
+static int list_add(list_t *list, const char *start, join_t join) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 8;
+        list->items = realloc(list->items, list->cap * sizeof(segment_t));
+    }
+    segment_t *seg = &list->items[list->count];
+    memset(seg, 0, sizeof(*seg));
+    seg->start = start;
+    seg->join = join;
+    return list->count++;
+}
+
+static void scan_list(const char *text, size_t len, list_t *list) {
+    lexer_t lx;
+    lexer_init(&lx, text, len);
+    char stack[LIST_MAX_DEPTH];
+    int depth = 0;
+    bool command = true;
+    int current = -1;
+    join_t join = JOIN_SEQ;
+    int last = TOK_END;
+
+    memset(list, 0, sizeof(*list));
+    for (;;) {
+        lx.segments = list->items;
+        int kind = next_token(&lx);
+        lx.segments = list->items;
+
+        if (depth > 0) {
+            if (kind == TOK_END) {
+                list->incomplete = true;
+                break;
+            }
+            depth = track_group(&lx, kind, stack, depth, &command);
+            for (int i = 0; i < lx.ndocs; i++) {
+                if (lx.docs[i].owner == -2) lx.docs[i].owner = -1;
+            }
+            list->items[current].end = lx.p;
+            continue;
+        }
+
+        switch (kind) {
+            case TOK_END:
+                list->incomplete = last == TOK_AND || last == TOK_OR || last == TOK_PIPE ||
+                                   lx.unterminated || lx.ndocs > 0;
+                return;
+            case TOK_NEWLINE:
+            case TOK_SEMI:
+            case TOK_AMP:
+                if (current < 0) {
+                    // A newline may follow && || | or stand alone
+                    if (kind == TOK_NEWLINE) {
+                        continue;
+                    }
+                    list->error = kind == TOK_SEMI ? ";" : "&";
+                    return;
+                }
+                list->items[current].background = kind == TOK_AMP;
+                current = -1;
+                join = JOIN_SEQ;
+                command = true;
+                last = kind;
+                continue;
+            case TOK_AND:
+            case TOK_OR:
+            case TOK_PIPE:
+                if (current < 0) {
+                    list->error = kind == TOK_AND ? "&&" : kind == TOK_OR ? "||" : "|";
+                    return;
+                }
+                if (kind != TOK_PIPE) {
+                    current = -1;
+                    join = kind == TOK_AND ? JOIN_AND : JOIN_OR;
+                }
+                command = true;
+                last = kind;
+                continue;
+            case TOK_CLOSE:
+                list->error = ")";
+                return;
+            case TOK_WORD:
+                if (!command && token_is(&lx, "}")) {
+                    break;
+                }
+                if (command && token_is(&lx, "}")) {
+                    list->error = "}";
+                    return;
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (current < 0) {
+            current = list_add(list, lx.start, join);
+            lx.segments = list->items;
+        }
+        for (int i = 0; i < lx.ndocs; i++) {
+            if (lx.docs[i].owner == -2) lx.docs[i].owner = current;
+        }
+        depth = track_group(&lx, kind, stack, depth, &command);
+        list->items[current].end = lx.p;
+        last = kind;
+    }
+}
+
+bool amcsh_list_needed(const char *line) {
+    lexer_t lx;
+    lexer_init(&lx, line, strlen(line));
+    bool command = true, separated = false;
+    for (;;) {
+        int kind = next_token(&lx);
+        switch (kind) {
+            case TOK_END:
+                return false;
+            case TOK_SEMI:
+            case TOK_AND:
+            case TOK_OR:
+                return true;
+            case TOK_AMP:
+            case TOK_NEWLINE:
+                // A trailing & is a background pipeline, which the parser knows
+                separated = true;
+                command = true;
+                break;
+            case TOK_PIPE:
+                command = true;
+                break;
+            case TOK_OPEN:
+                if (command) return true;
+                break;
+            case TOK_WORD:
+                if (separated || (command && token_is(&lx, "{"))) return true;
+                command = false;
+                break;
+            default:
+                if (separated) return true;
+                break;
+        }
+    }
+}
+
+char *amcsh_list_read(const char *line, amcsh_line_reader_t reader, void *ctx) {
+    size_t len = strlen(line);
+    size_t cap = len + 256;
+    char *text = malloc(cap);
+    if (!text) {
+        return NULL;
+    }
+    memcpy(text, line, len + 1);
+
+    for (;;) {
+        list_t list;
+        scan_list(text, len, &list);
+        free(list.items);
+        if (!list.incomplete || list.error) {
+            return text;
+        }
+        const char *more = reader ? reader(ctx) : NULL;
+        if (!more) {
+            return text; // Reported when it runs
+        }
+        size_t more_len = strlen(more);
+        if (len + more_len + 2 > cap) {
+            cap = (len + more_len + 2) * 2;
+            char *grown = realloc(text, cap);
+            if (!grown) {
+                return text;
+            }
+            text = grown;
+        }
+        if (len > 0 && text[len - 1] != '\n') {
+            text[len++] = '\n';
+        }
+        memcpy(text + len, more, more_len + 1);
+        len += more_len;
+    }
+}
+
+// Running
+
+typedef struct {
+    const char *p, *end;
+    char *line;
+    size_t cap;
+} body_reader_t;
+
+static const char *body_line(void *ctx) {
+    body_reader_t *reader = ctx;
+    if (!reader->p || reader->p >= reader->end) {
+        return NULL;
+    }
+    const char *nl = memchr(reader->p, '\n', reader->end - reader->p);
+    size_t len = (nl ? nl + 1 : reader->end) - reader->p;
+    if (len + 1 > reader->cap) {
+        reader->cap = len + 64;
+        reader->line = realloc(reader->line, reader->cap);
+    }
+    memcpy(reader->line, reader->p, len);
+    reader->line[len] = '\0';
+    reader->p += len;
+    return reader->line;
+}
+
+static void run_segment(const segment_t *seg, bool background, amcsh_output_t *capture) {
+    char *text = strndup(seg->start, seg->end - seg->start);
+    if (!text) {
+        return;
+    }
+
+    amcsh_command_t cmd;
+    amcsh_command_init(&cmd, text);
+    AMCSH_TRACE_BEGIN(parse_start);
+    amcsh_parse_command(&cmd);
+    AMCSH_TRACE_END(AMCSH_PHASE_PARSE, parse_start);
+    amcsh_prefetch_pipeline(&cmd);
+
+    body_reader_t reader = {seg->bodies, seg->bodies_end, NULL, 0};
+    amcsh_heredoc_read(&cmd, body_line, &reader);
+    free(reader.line);
+
+    if (cmd.argc > 0 || cmd.timed || cmd.group || cmd.next) {
+        cmd.background |= background;
+        if (capture) {
+            amcsh_execute_captured(&cmd, capture);
+        } else {
+            amcsh_execute(&cmd);
+        }
+    }
+    amcsh_command_free(&cmd);
+    free(text);
+}
+
+// Pipelines [first, last) joined by && and ||
+static void run_and_or(const list_t *list, int first, int last, amcsh_output_t *capture) {
+    bool background = list->items[last - 1].background;
+    for (int i = first; i < last && !shell_state.exit_requested; i++) {
+        const segment_t *seg = &list->items[i];
+        if ((seg->join == JOIN_AND && shell_state.exit_status != 0) ||
+            (seg->join == JOIN_OR && shell_state.exit_status == 0)) {
+            continue;
+        }
+        run_segment(seg, background, capture);
+    }
+}
+
+// "a && b &" runs the whole and-or list as one background job
+static void fork_and_or(const list_t *list, int first, int last, const char *text) {
+    int log_read = -1;
+    int log = amcsh_joblog_open(&log_read);
+    fflush(stdout);
+    amcsh_flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (log >= 0) {
+            close(log_read);
+            amcsh_joblog_child(log, true);
+        }
+        if (shell_state.interactive) {
+            setpgid(0, 0);
+        }
+        amcsh_child_t child;
+        amcsh_child_enter(&child, -1);
+        for (int i = first; i < last; i++) {
+            ((segment_t *)&list->items[i])->background = false;
+        }
+        run_and_or(list, first, last, NULL);
+        amcsh_child_exit(&child, shell_state.exit_status);
+    }
+    if (log >= 0) {
+        close(log);
+    }
+    if (pid < 0) {
+        perror("amcsh: fork");
+        if (log_read >= 0) close(log_read);
+        shell_state.exit_status = 1;
+        return;
+    }
+    if (shell_state.interactive) {
+        setpgid(pid, pid);
+    }
+    amcsh_job_add(pid, &pid, 1, text);
+    if (log_read >= 0) {
+        amcsh_joblog_attach(pid, log_read, text);
+    }
+    shell_state.exit_status = 0;
+}
+
+void amcsh_list_run(const char *text, amcsh_output_t *capture) {
+    list_t list;
+    scan_list(text, strlen(text), &list);
+    if (list.error || (list.incomplete && !list.items) ||
+        (list.incomplete && list.items[list.count - 1].end == NULL)) {
+        fprintf(stderr, "amcsh: syntax error near unexpected token `%s'\n",
+                list.error ? list.error : "newline");
+        shell_state.exit_status = 2;
+        free(list.items);
+        return;
+    }
+    if (list.incomplete) {
+        // An open group or a trailing operator; a here-document cut short
+        // by the end of input still runs with what it has
+        const segment_t *tail = &list.items[list.count - 1];
+        const char *group = tail->start;
+        while (group < tail->end && (*group == ' ' || *group == '\t')) group++;
+        bool open_group = (*group == '(' || *group == '{') && !amcsh_group_end(group);
+        size_t n = strlen(text);
+        while (n > 0 && (text[n - 1] == '\n' || text[n - 1] == ' ' || text[n - 1] == '\t')) n--;
+        bool open_operator = n > 0 && (text[n - 1] == '|' || (n > 1 && text[n - 2] == '&' && text[n - 1] == '&'));
+        if (open_group || open_operator) {
+            fprintf(stderr, "amcsh: syntax error: unexpected end of file\n");
+            shell_state.exit_status = 2;
+            free(list.items);
+            return;
+        }
+    }
+
+    amcsh_output_t *saved = list_capture;
+    list_capture = capture;
+    for (int i = 0; i < list.count && !shell_state.exit_requested;) {
+        int j = i + 1;
+        while (j < list.count && list.items[j].join != JOIN_SEQ) j++;
+        if (list.items[j - 1].background && j - i > 1) {
+            char *job = strndup(list.items[i].start, list.items[j - 1].end - list.items[i].start);
+            fork_and_or(&list, i, j, job ? job : "");
+            free(job);
+        } else {
+            run_and_or(&list, i, j, capture);
+        }
+        i = j;
+    }
+    list_capture = saved;
+    free(list.items);
+}
+
+// Subshells
+
+// A subshell can run in this process when nothing in it changes state that a
+// snapshot cannot put back: external commands, pure builtins, cd (undone
+// through a directory fd) and read (the environment is copied first). Names
+// that come from expansions, background jobs and other builtins need a fork.
+static bool subshell_inline(const char *body, bool *cwd, bool *env) {
+    lexer_t lx;
+    lexer_init(&lx, body, strlen(body));
+    bool command = true, prefix = false;
+    for (;;) {
+        int kind = next_token(&lx);
+        switch (kind) {
+            case TOK_END:
+                return true;
+            case TOK_AMP:
+                return false;
+            case TOK_WORD: {
+                if (!command && !prefix) {
+                    break;
+                }
+                if (command && (token_is(&lx, "{") || token_is(&lx, "}"))) {
+                    continue;
+                }
+                size_t len = lx.p - lx.start;
+                char name[64];
+                if (len >= sizeof(name) || memchr(lx.start, '$', len) || memchr(lx.start, '`', len)) {
+                    return false;
+                }
+                memcpy(name, lx.start, len);
+                name[len] = '\0';
+                const amcsh_builtin_t *builtin = amcsh_builtin_lookup(name);
+                if (builtin && amcsh_builtin_enabled(builtin)) {
+                    if (builtin->flags & AMCSH_BUILTIN_PREFIX) {
+                        prefix = true; // The command it runs is among the words after it
+                    } else if (builtin->flags & AMCSH_BUILTIN_PURE) {
+                        // Leaves shell state alone
+                    } else if (strcmp(name, "cd") == 0) {
+                        *cwd = true;
+                    } else if (strcmp(name, "read") == 0) {
+                        *env = true;
+                    } else if (builtin->func) {
+                        return false; // exit, fg, bg, enable...
+                    }
+                }
+                command = false;
+                continue;
+            }
+            case TOK_REDIRECT:
+            case TOK_CLOSE:
+                break;
+            default:
+                command = true;
+                prefix = false;
+                break;
+        }
+    }
+}
+
+static char **env_save(void) {
+    extern char **environ;
+    size_t n = 0;
+    while (environ[n]) n++;
+    char **saved = malloc((n + 1) * sizeof(char *));
+    if (!saved) {
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        saved[i] = strdup(environ[i]);
+    }
+    saved[n] = NULL;
+    return saved;
+}
+
+static void env_restore(char **saved) {
+    clearenv();
+    for (char **var = saved; *var; var++) {
+        char *eq = strchr(*var, '=');
+        if (eq) {
+            *eq = '\0';
+            setenv(*var, eq + 1, 1);
+        }
+        free(*var);
+    }
+    free(saved);
+}
+
+// A subshell in a child: for pipeline stages, background groups and bodies
+// that change what a snapshot cannot restore
+static int fork_group(amcsh_command_t *cmd) {
+    int log_read = -1;
+    int log = cmd->background ? amcsh_joblog_open(&log_read) : -1;
+    fflush(stdout);
+    amcsh_flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (log >= 0) {
+            close(log_read);
+            amcsh_joblog_child(log, true); // Redirections still win below
+        }
+        if (shell_state.interactive) {
+            setpgid(0, 0);
+        }
+        amcsh_child_t child;
+        amcsh_child_enter(&child, -1);
+        cmd->background = false;
+        amcsh_child_exit(&child, amcsh_group_run(cmd, true));
+    }
+
+    if (log >= 0) {
+        close(log);
+    }
+    int status = 0;
+    if (pid < 0) {
+        perror("amcsh: fork");
+        status = 1;
+    } else {
+        if (shell_state.interactive) {
+            setpgid(pid, pid);
+        }
+        if (cmd->background) {
+            amcsh_job_add(pid, &pid, 1, cmd->raw_cmd);
+            if (log_read >= 0) {
+                amcsh_joblog_attach(pid, log_read, cmd->raw_cmd);
+                log_read = -1;
+            }
+        } else {
+            status = amcsh_wait_process(pid, NULL);
+        }
+    }
+    if (log_read >= 0) close(log_read);
+    if (cmd->redirect_in >= 0) close(cmd->redirect_in);
+    if (cmd->redirect_out >= 0) close(cmd->redirect_out);
+    if (cmd->redirect_err >= 0) close(cmd->redirect_err);
+    if (cmd->pipe_read >= 0) close(cmd->pipe_read);
+    if (cmd->pipe_write >= 0) close(cmd->pipe_write);
+    cmd->redirect_in = cmd->redirect_out = cmd->redirect_err = -1;
+    cmd->pipe_read = cmd->pipe_write = -1;
+    return shell_state.exit_status = status;
+}
+
+// Put fd on target for the length of a group; returns the saved original
+static int swap_fd(int fd, int target) {
+    if (fd < 0) {
+        return -1;
+    }
+    int saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, target);
+    close(fd);
+    return saved;
+}
+
+static void restore_fd(int saved, int target) {
+    if (saved >= 0) {
+        dup2(saved, target);
+        close(saved);
+    }
+}
+
+// Run a ( ) or { } group. Its redirections or pipe ends become this process's
+// standard streams while the body runs. A { } body shares the shell's state;
+// a ( ) body gets a snapshot that is put back afterwards, or a child when
+// forked is false and a snapshot is not enough.
+int amcsh_group_run(amcsh_command_t *cmd, bool forked) {
+    bool cwd = false, env = false;
+    if (!forked && (cmd->background || (cmd->subshell && !subshell_inline(cmd->group, &cwd, &env)))) {
+        return fork_group(cmd);
+    }
+
+    int dir = -1;
+    char **saved_env = NULL;
+    if (cmd->subshell && !forked) {
+#ifdef O_PATH
+        if (cwd) dir = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+        if (cwd) dir = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+        if (env) saved_env = env_save();
+        if ((cwd && dir < 0) || (env && !saved_env)) {
+            if (dir >= 0) close(dir);
+            if (saved_env) env_restore(saved_env);
+            return fork_group(cmd);
+        }
+    }
+
+    // stderr is taken before the pipe ends close and before fd 1 moves, so
+    // 2>&1 still means the stage's pipe or the stdout the group started with
+    int err = amcsh_stderr_fd(cmd);
+    if (err >= 0 && err != cmd->redirect_err) {
+        err = fcntl(err, F_DUPFD_CLOEXEC, 3);
+    }
+    int in = cmd->redirect_in >= 0 ? cmd->redirect_in : cmd->pipe_read;
+    int out = cmd->redirect_out >= 0 ? cmd->redirect_out : cmd->pipe_write;
+    if (cmd->redirect_in >= 0 && cmd->pipe_read >= 0) close(cmd->pipe_read);
+    if (cmd->redirect_out >= 0 && cmd->pipe_write >= 0) close(cmd->pipe_write);
+    cmd->redirect_in = cmd->redirect_out = cmd->redirect_err = -1;
+    cmd->pipe_read = cmd->pipe_write = -1;
+
+    // Output already buffered goes out before the streams move
+    fflush(stdout);
+    amcsh_flush();
+    int saved_err = swap_fd(err, STDERR_FILENO);
+    int saved_in = swap_fd(in, STDIN_FILENO);
+    int saved_out = swap_fd(out, STDOUT_FILENO);
+
+    amcsh_output_t redirected;
+    char buf[AMCSH_OUTPUT_BUFFER_SIZE];
+    amcsh_io_t saved_io;
+    if (out >= 0) {
+        amcsh_output_init(&redirected, STDOUT_FILENO, buf, sizeof(buf));
+    }
+    amcsh_io_enter(out >= 0 ? &redirected : NULL, in >= 0 ? STDIN_FILENO : -1, &saved_io);
+
+    amcsh_list_run(cmd->group, out >= 0 ? NULL : list_capture);
+
+    amcsh_io_leave(&saved_io);
+    fflush(stdout);
+    restore_fd(saved_out, STDOUT_FILENO);
+    restore_fd(saved_in, STDIN_FILENO);
+    restore_fd(saved_err, STDERR_FILENO);
+
+    int status = shell_state.exit_status;
+    if (dir >= 0) {
+        if (fchdir(dir) != 0) {
+            perror("amcsh: subshell");
+        }
+        close(dir);
+        amcsh_prompt_chdir();
+    }
+    if (saved_env) {
+        env_restore(saved_env);
+    }
+    return shell_state.exit_status = status;
+}
@@ -1,44 +1,356 @@
+#define _GNU_SOURCE
 #include "amcsh.h"
+#include "trace.h"
+#include "server.h"
+#include "highlight.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <histedit.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <errno.h>
+#include <poll.h>
+#include <wchar.h>
+#include <locale.h>
 
 static EditLine *el = NULL;
 static History *hist = NULL;
-amcsh_state_t shell_state = {0};
-
-// Prompt callback for libedit
+static bool continuation = false;
+static const char *command_string = NULL; // -c argument
+static bool startup_trace = false;        // --startup-trace
+static const char *server_socket = NULL;  // --server argument
+static uint64_t startup_mark;
+static amcsh_state_t main_state;
+static amcsh_highlight_t highlight;
+static bool highlighting = false;         // Interactive, colour terminal, AMCSH_HIGHLIGHT != 0
+
+static char drawn_prompt[AMCSH_MAX_CMD_LENGTH]; // Prompt libedit last drew
+static long drawn_prompt_cols;
+
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+#define PASTE_MARKER_LEN 6
+
+static bool paste_mode = false;           // Terminal brackets pastes with PASTE_START/END
+static char pending[4096];                // Input read ahead of libedit
+static size_t pending_pos, pending_len;
+static char *paste_run;                   // Complete lines of a paste, run when el_gets returns
+static char *paste_tail;                  // Text after its last newline, for the next line
+
+// Prompt callback for libedit; the text is cached between redraws
 char *prompt(EditLine *e)
 {
-    static char prompt_buf[AMCSH_MAX_CMD_LENGTH];
-    char cwd[AMCSH_MAX_CMD_LENGTH];
-    char *home = getenv("HOME");
+    static char continuation_prompt[] = "> ";
+    char *text = continuation ? continuation_prompt : (char *)amcsh_prompt_render();
+    if (strcmp(text, drawn_prompt) != 0) {
+        // Columns without the escapes bracketed by \001
+        char visible[AMCSH_MAX_CMD_LENGTH];
+        size_t n = 0;
+        bool hidden = false;
+        for (const char *p = text; *p; p++) {
+            if (*p == '\001')
+                hidden = !hidden;
+            else if (!hidden)
+                visible[n++] = *p;
+        }
+        drawn_prompt_cols = amcsh_highlight_columns(visible, n);
+        snprintf(drawn_prompt, sizeof(drawn_prompt), "%s", text);
+    }
+    return text;
+}
 
-    getcwd(cwd, sizeof(cwd));
+// Cursor motion between two offsets counted in columns from the start of
+// the prompt. An offset on a row boundary that was just written sits at the
+// end of the row above until the next character is written.
+static int cursor_move(char *out, size_t size, long from, long to, int cols, bool written)
+{
+    long row = (written && from > 0 && from % cols == 0 ? from - 1 : from) / cols;
+    long rows = to / cols - row;
+    int len = 0;
+    if (rows < 0)
+        len += snprintf(out + len, size - len, "\033[%ldA", -rows);
+    else if (rows > 0)
+        len += snprintf(out + len, size - len, "\033[%ldB", rows);
+    len += snprintf(out + len, size - len, "\r");
+    if (to % cols)
+        len += snprintf(out + len, size - len, "\033[%ldC", to % cols);
+    return len;
+}
 
-    // Replace home directory with ~
-    if (home && strncmp(cwd, home, strlen(home)) == 0)
-    {
-        snprintf(prompt_buf, sizeof(prompt_buf), "\033[1;36m~%s\033[0m \033[1;32m➜\033[0m ", cwd + strlen(home));
+// Repaint the part of the line whose colours changed over what libedit drew,
+// then put the cursor back where libedit left it
+static void highlight_paint(EditLine *e)
+{
+    const LineInfo *li = el_line(e);
+    size_t len = li->lastchar - li->buffer;
+    size_t from, to;
+    if (!amcsh_highlight_update(&highlight, li->buffer, len, &from, &to))
+        return;
+
+    int cols, lines;
+    if (el_get(e, EL_GETTC, "co", &cols) != 0 || cols <= 0)
+        return;
+    if (el_get(e, EL_GETTC, "li", &lines) != 0 || lines <= 0)
+        lines = 24;
+
+    long prompt_cols = drawn_prompt_cols;
+    long cursor = amcsh_highlight_columns(li->buffer, li->cursor - li->buffer);
+    if (prompt_cols < 0 || cursor < 0 || amcsh_highlight_columns(li->buffer, len) < 0)
+        return; // Control characters are drawn as ^X; leave those lines alone
+    cursor += prompt_cols;
+
+    // Rows a screen height or more from the cursor's are off screen: a long
+    // pasted line only repaints what can be seen
+    long first_visible = (cursor / cols - lines + 1) * cols - prompt_cols;
+    long last_visible = (cursor / cols + lines) * cols - prompt_cols;
+    long start = amcsh_highlight_columns(li->buffer, from);
+    if (start < first_visible) {
+        from = amcsh_highlight_offset(li->buffer, len, first_visible);
+        start = amcsh_highlight_columns(li->buffer, from);
     }
-    else
-    {
-        char *last_dir = strrchr(cwd, '/');
-        if (last_dir && *(last_dir + 1))
-        {
-            snprintf(prompt_buf, sizeof(prompt_buf), "\033[1;36m%s\033[0m \033[1;32m➜\033[0m ", last_dir + 1);
+    if (start + amcsh_highlight_columns(li->buffer + from, to - from) > last_visible)
+        to = amcsh_highlight_offset(li->buffer, len, last_visible);
+    if (to <= from)
+        return;
+    long span = amcsh_highlight_columns(li->buffer + from, to - from);
+    start += prompt_cols;
+
+    char before[64], after[64];
+    size_t text_len;
+    const char *text = amcsh_highlight_render(&highlight, from, to, &text_len);
+    struct iovec iov[3] = {
+        {before, cursor_move(before, sizeof(before), cursor, start, cols, false)},
+        {(void *)text, text_len},
+        {after, cursor_move(after, sizeof(after), start + span, cursor, cols, span > 0)},
+    };
+    amcsh_output_t out;
+    amcsh_output_init(&out, STDOUT_FILENO, NULL, 0);
+    fflush(stdout);
+    amcsh_output_writev(&out, iov, 3);
+}
+
+// libedit redraws from wherever the cursor is, so a redraw starts by moving
+// back to the prompt and clearing what was drawn
+static void clear_line(EditLine *e)
+{
+    const LineInfo *li = el_line(e);
+    long cursor = amcsh_highlight_columns(li->buffer, li->cursor - li->buffer);
+    int cols;
+    if (cursor >= 0 && drawn_prompt_cols >= 0 &&
+        el_get(e, EL_GETTC, "co", &cols) == 0 && cols > 0) {
+        long rows = (drawn_prompt_cols + cursor) / cols;
+        if (rows > 0)
+            printf("\033[%ldA", rows);
+    }
+    printf("\r\033[J");
+    fflush(stdout);
+}
+
+static void redraw_line(EditLine *e)
+{
+    clear_line(e);
+    el_set(e, EL_REFRESH);
+    amcsh_highlight_invalidate(&highlight);
+}
+
+// Have at least want bytes of input read ahead, waiting up to timeout
+// milliseconds for each read
+static bool pending_fill(size_t want, int timeout)
+{
+    if (pending_pos > 0) {
+        memmove(pending, pending + pending_pos, pending_len - pending_pos);
+        pending_len -= pending_pos;
+        pending_pos = 0;
+    }
+    while (pending_len < want) {
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, timeout) <= 0)
+            return false;
+        ssize_t n = read(STDIN_FILENO, pending + pending_len, sizeof(pending) - pending_len);
+        if (n <= 0)
+            return false;
+        pending_len += n;
+    }
+    return true;
+}
+
+// Whether the input after an escape is the rest of PASTE_START; whatever
+// else it is stays read ahead for libedit. Arrow keys differ by the third byte.
+static bool paste_started(void)
+{
+    for (size_t i = 1; i < PASTE_MARKER_LEN; i++) {
+        if (!pending_fill(i, 50) || pending[pending_pos + i - 1] != PASTE_START[i])
+            return false;
+    }
+    pending_pos += PASTE_MARKER_LEN - 1;
+    return true;
+}
+
+// The pasted text up to the end marker, in one buffer, with the \r line
+// ends terminals send turned into \n
+static char *read_paste(size_t *len)
+{
+    char *text = NULL;
+    size_t n = 0, cap = 0;
+    for (;;) {
+        char *start = pending + pending_pos;
+        size_t avail = pending_len - pending_pos;
+        char *end = memmem(start, avail, PASTE_END, PASTE_MARKER_LEN);
+        // Without the marker, hold back enough to match one split across reads
+        size_t take = end ? (size_t)(end - start) :
+                      avail >= PASTE_MARKER_LEN ? avail - (PASTE_MARKER_LEN - 1) : 0;
+        if (n + take + 1 > cap) {
+            cap = (n + take + 1) * 2;
+            char *grown = realloc(text, cap);
+            if (!grown) {
+                free(text);
+                return NULL;
+            }
+            text = grown;
         }
-        else
-        {
-            snprintf(prompt_buf, sizeof(prompt_buf), "\033[1;36m/\033[0m \033[1;32m➜\033[0m ");
+        memcpy(text + n, start, take);
+        n += take;
+        pending_pos += take;
+        if (end) {
+            pending_pos += PASTE_MARKER_LEN;
+            break;
+        }
+        // A paste arrives in one burst; a long gap means the end marker was lost
+        if (!pending_fill(pending_len - pending_pos + 1, 1000)) {
+            memcpy(text + n, pending + pending_pos, pending_len - pending_pos);
+            n += pending_len - pending_pos;
+            pending_pos = pending_len = 0;
+            break;
         }
     }
 
-    return prompt_buf;
+    size_t out = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (text[i] == '\r')
+            text[out++] = i + 1 < n && text[i + 1] == '\n' ? text[++i] : '\n';
+        else if (text[i] != '\0')
+            text[out++] = text[i];
+    }
+    text[out] = '\0';
+    *len = out;
+    return text;
+}
+
+// Text joins the line with one redraw rather than one per character
+static void insert_text(EditLine *e, const char *text)
+{
+    clear_line(e);
+    el_insertstr(e, text);
+    el_set(e, EL_REFRESH);
+    amcsh_highlight_invalidate(&highlight);
+}
+
+// A bracketed paste. Text without a newline is inserted at the cursor. Complete
+// lines are shown once and the line is ended, so the main loop runs them as one
+// script; true when that happened. Text after the last newline starts the next line.
+static bool paste(EditLine *e)
+{
+    size_t len;
+    char *text = read_paste(&len);
+    if (!text)
+        return false;
+    char *last = memrchr(text, '\n', len);
+    if (!last) {
+        if (len > 0)
+            insert_text(e, text);
+        free(text);
+        return false;
+    }
+
+    if (last[1])
+        paste_tail = strdup(last + 1);
+    last[1] = '\0';
+    paste_run = text;
+
+    // The lines go after what is typed; libedit's own newline ends the last one
+    const LineInfo *li = el_line(e);
+    if (li->cursor != li->lastchar) {
+        clear_line(e);
+        el_cursor(e, li->lastchar - li->cursor);
+        el_set(e, EL_REFRESH);
+    }
+    fwrite(text, 1, last - text, stdout);
+    fflush(stdout);
+    return true;
+}
+
+// Character reader for libedit that also wakes for late prompt segments and
+// highlighting results, and redraws the line with them
+static int read_char(EditLine *e, wchar_t *wc)
+{
+    static mbstate_t state;
+    struct pollfd fds[2] = {
+        {STDIN_FILENO, POLLIN, 0},
+        {amcsh_prompt_wake_fd(), POLLIN, 0},
+    };
+    if (paste_tail) {
+        insert_text(e, paste_tail);
+        free(paste_tail);
+        paste_tail = NULL;
+    }
+    for (;;) {
+        char ch;
+        if (pending_pos < pending_len) {
+            ch = pending[pending_pos++];
+            goto decode;
+        }
+
+        // Colour the line and read ahead the commands in it once typing
+        // pauses: with keys already queued (a paste) there is more to come
+        if (poll(fds, 1, 0) == 0) {
+            if (highlighting)
+                highlight_paint(e);
+            const LineInfo *li = el_line(e);
+            amcsh_prefetch_typed(li->buffer, li->lastchar - li->buffer);
+        }
+
+        if (poll(fds, fds[1].fd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (fds[1].revents & POLLIN) {
+            // Highlighting results repaint above; only a new prompt needs libedit
+            amcsh_prompt_wake_drain();
+            if (!continuation && strcmp(amcsh_prompt_render(), drawn_prompt) != 0)
+                redraw_line(e);
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        ssize_t n = read(STDIN_FILENO, &ch, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return (int)n;
+
+    decode:
+        if (ch == '\033' && paste_mode && paste_started()) {
+            if (paste(e)) {
+                *wc = '\n';
+                return 1;
+            }
+            continue;
+        }
+        if (ch == '\f')
+            amcsh_highlight_invalidate(&highlight); // Clear screen redraws the line
+        size_t used = mbrtowc(wc, &ch, 1, &state);
+        if (used == (size_t)-2)
+            continue; // Rest of a multibyte character
+        if (used == (size_t)-1) {
+            memset(&state, 0, sizeof(state));
+            *wc = (unsigned char)ch;
+        }
+        return 1;
+    }
 }
 
 // Command completion callback
@@ -69,56 +381,154 @@ static unsigned char complete(EditLine *el, int ch)
     
     // Redisplay prompt and line
     el_set(el, EL_REFRESH);
+    amcsh_highlight_invalidate(&highlight);
     return CC_REDISPLAY;
 }
 
+// Here-document lines while interactive
+static const char *read_continuation_line(void *ctx)
+{
+    int count;
+    continuation = true;
+    const char *line = el_gets((EditLine *)ctx, &count);
+    continuation = false;
+    return line;
+}
+
+// --startup-trace: time since the previous step, on stderr
+static void startup_step(const char *step)
+{
+    if (!startup_trace)
+        return;
+    uint64_t now = amcsh_trace_now();
+    fprintf(stderr, "amcsh: startup: %-14s %8.1fus\n", step, (now - startup_mark) / 1e3);
+    startup_mark = now;
+}
+
+// Only what every command needs happens here. The thread pool starts its
+// workers on first submit; completion and history load on first use.
 void amcsh_init(void)
 {
-    // Initialize shell state
-    shell_state.interactive = isatty(STDIN_FILENO);
-    shell_state.jobs = NULL;
-    
-    // Initialize locks with default attributes
-    pthread_mutex_init(&shell_state.job_mutex, NULL);
-    pthread_rwlock_init(&shell_state.cache_lock, NULL);
+    uint64_t init_start = startup_mark = amcsh_trace_now();
 
-    // Pre-allocate command cache with a power of 2 size for faster modulo
-    shell_state.cmd_cache = calloc(AMCSH_CMD_CACHE_SIZE, sizeof(amcsh_cmd_cache_entry_t));
-    shell_state.cmd_cache_size = AMCSH_CMD_CACHE_SIZE;
+    // Locks, command cache and thread pool, shared with embedded interpreters
+    amcsh_current_state = &main_state;
+    amcsh_state_init(&main_state);
+    main_state.interactive = !command_string && !server_socket && isatty(STDIN_FILENO);
+    startup_step("state");
 
-    // Initialize thread pool with optimized settings
-    shell_state.thread_pool = malloc(sizeof(amcsh_thread_pool_t));
-    amcsh_thread_pool_init(shell_state.thread_pool);
+    // Pick the process creation backend
+    amcsh_spawn_init();
+    startup_step("spawn backend");
+
+    // Phase histograms, dumped to AMCSH_TRACE_FILE on exit
+    amcsh_trace_init();
+    startup_step("tracing");
 
     // Setup signal handlers
     amcsh_setup_signals();
-
-    // Initialize completion system (lazy load in background)
-    if (shell_state.interactive) {
-        pthread_t completion_thread;
-        pthread_create(&completion_thread, NULL, (void *(*)(void *))amcsh_completion_init, NULL);
-        pthread_detach(completion_thread);
-    }
+    startup_step("signals");
 
     // Initialize line editing
     if (shell_state.interactive)
     {
+        // Multibyte input and the prompt are decoded in the user's locale
+        setlocale(LC_CTYPE, "");
         HistEvent ev;
         hist = history_init();
         history(hist, &ev, H_SETSIZE, AMCSH_HISTORY_SIZE);
 
         el = el_init("amcsh", stdin, stdout, stderr);
-        el_set(el, EL_PROMPT, &prompt);
+        el_set(el, EL_PROMPT_ESC, &prompt, '\001');
         el_set(el, EL_EDITOR, "emacs");
         el_set(el, EL_HIST, history, hist);
         el_set(el, EL_ADDFN, "complete", "Complete command", complete);
         el_set(el, EL_BIND, "^I", "complete", NULL);
-        
-        // Load history asynchronously
-        pthread_t history_thread;
-        pthread_create(&history_thread, NULL, (void *(*)(void *))amcsh_history_load, NULL);
-        pthread_detach(history_thread);
+        el_set(el, EL_GETCFN, read_char);
+        amcsh_prompt_init();
+        const char *term = getenv("TERM");
+        const char *enabled = getenv("AMCSH_HIGHLIGHT");
+        highlighting = term && strcmp(term, "dumb") != 0 && !(enabled && strcmp(enabled, "0") == 0);
+        paste_mode = term && strcmp(term, "dumb") != 0;
+        amcsh_highlight_init(&highlight);
+        startup_step("line editing");
+    }
+
+    if (startup_trace) {
+        fprintf(stderr, "amcsh: startup: %-14s %8.1fus\n", "total",
+                (amcsh_trace_now() - init_start) / 1e3);
+    }
+}
+
+// Record a line in history off the REPL thread
+static void *history_task(void *arg)
+{
+    AMCSH_TRACE_BEGIN(history_start);
+    amcsh_history_add(arg);
+    AMCSH_TRACE_END(AMCSH_PHASE_HISTORY, history_start);
+    free(arg);
+    return NULL;
+}
+
+static void *history_lines_task(void *arg)
+{
+    AMCSH_TRACE_BEGIN(history_start);
+    amcsh_history_add_lines(arg);
+    AMCSH_TRACE_END(AMCSH_PHASE_HISTORY, history_start);
+    free(arg);
+    return NULL;
+}
+
+// Pasted lines run as one script after the line typed before them: parsed
+// as they come, recorded in history in one call, with no prompt in between
+static void run_paste(const char *line)
+{
+    size_t prefix = strlen(line);
+    if (prefix > 0 && line[prefix - 1] == '\n')
+        prefix--;
+    size_t len = strlen(paste_run);
+    char *script = malloc(prefix + len + 1);
+    if (script) {
+        memcpy(script, line, prefix);
+        memcpy(script + prefix, paste_run, len + 1);
+    }
+    free(paste_run);
+    paste_run = NULL;
+    if (!script)
+        return;
+
+    char *hist_text = strdup(script);
+    if (hist_text)
+        amcsh_thread_pool_submit(shell_state.thread_pool, history_lines_task, hist_text);
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    FILE *in = fmemopen(script, prefix + len, "r");
+    if (in)
+    {
+        amcsh_run_script(in, NULL);
+        fclose(in);
     }
+    amcsh_prompt_command_done(shell_state.exit_status, amcsh_elapsed(&started));
+    free(script);
+}
+
+// A line with ; && || & or a group, plus any lines it still needs
+static void run_list(const char *line)
+{
+    char *text = amcsh_list_read(line, read_continuation_line, el);
+    if (!text)
+        return;
+
+    char *hist_text = strdup(text);
+    if (hist_text)
+        amcsh_thread_pool_submit(shell_state.thread_pool, history_lines_task, hist_text);
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    amcsh_list_run(text, NULL);
+    amcsh_prompt_command_done(shell_state.exit_status, amcsh_elapsed(&started));
+    free(text);
 }
 
 void amcsh_cleanup(void)
@@ -127,27 +537,51 @@ void amcsh_cleanup(void)
     {
         history_end(hist);
         el_end(el);
+        amcsh_highlight_free(&highlight);
     }
 
+    // Thread pool, command cache and jobs; history additions queued on the
+    // pool are in once its workers have been joined
+    amcsh_state_destroy(&main_state);
+
     // Save history before exit
     amcsh_history_save();
-
-    // Cleanup thread pool
-    amcsh_thread_pool_shutdown(shell_state.thread_pool);
-    free(shell_state.thread_pool);
-
-    // Cleanup command cache
-    amcsh_cache_cleanup();
-
-    // Cleanup jobs
-    pthread_mutex_destroy(&shell_state.job_mutex);
-    pthread_rwlock_destroy(&shell_state.cache_lock);
 }
 
 int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--startup-trace") == 0)
+        {
+            startup_trace = true;
+        }
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+        {
+            server_socket = argv[++i];
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            command_string = argv[i + 1];
+            break;
+        }
+        else
+        {
+            fprintf(stderr, "amcsh: %s: invalid option\n", argv[i]);
+            fprintf(stderr, "Usage: amcsh [--startup-trace] [--server socket | -c command]\n");
+            return 2;
+        }
+    }
+
     amcsh_init();
 
+    if (server_socket)
+    {
+        int status = amcsh_server_run(server_socket);
+        amcsh_cleanup();
+        return status;
+    }
+
     if (shell_state.interactive)
     {
         printf("\033[1;35mamcsh %s\033[0m - High Performance Shell\n", AMCSH_VERSION);
@@ -156,87 +590,110 @@ int main(int argc, char *argv[])
         int count;
         char *cmd_copy = NULL;
 
-        while ((line = el_gets(el, &count)))
+        for (;;)
         {
+            amcsh_prompt_update();
+            amcsh_highlight_reset(&highlight);
+            AMCSH_TRACE_BEGIN(read_start);
+            // Bracketed paste only while editing; commands get the terminal as it was
+            if (paste_mode)
+                fputs("\033[?2004h", stdout);
+            line = el_gets(el, &count);
+            if (paste_mode) {
+                fputs("\033[?2004l", stdout);
+                fflush(stdout);
+            }
+            AMCSH_TRACE_END(AMCSH_PHASE_READ, read_start);
+            if (!line)
+                break;
+
+            if (paste_run) {
+                amcsh_update_jobs();
+                run_paste(line);
+                continue;
+            }
+
+            // Report background jobs that finished since the last prompt
+            amcsh_update_jobs();
+
             if (count <= 1)
                 continue;
 
-            // Parse and execute the command
-            amcsh_command_t cmd = {0};
-            cmd.redirect_in = -1;
-            cmd.redirect_out = -1;
-            cmd.pipe_read = -1;
-            cmd.pipe_write = -1;
+            // Lists and groups: read until complete, split, then run a pipeline at a time
+            if (amcsh_list_needed(line)) {
+                run_list(line);
+                continue;
+            }
 
             // Reuse command buffer if possible
             if (cmd_copy) {
                 free(cmd_copy);
             }
             cmd_copy = strdup(line);
-            cmd.raw_cmd = cmd_copy;
+
+            // Parse and execute the command
+            amcsh_command_t cmd;
+            amcsh_command_init(&cmd, cmd_copy);
 
             // Parse the command
+            AMCSH_TRACE_BEGIN(parse_start);
             amcsh_parse_command(&cmd);
-            if (cmd.argc > 0)
+            AMCSH_TRACE_END(AMCSH_PHASE_PARSE, parse_start);
+            amcsh_prefetch_pipeline(&cmd);
+            amcsh_heredoc_read(&cmd, read_continuation_line, el);
+            if (cmd.argc > 0 || cmd.timed || cmd.group || cmd.next)
             {
-                // Fast path for built-in commands
-                if (amcsh_execute_builtin(&cmd) == 0) {
-                    continue;
-                }
+                struct timespec started;
+                clock_gettime(CLOCK_MONOTONIC, &started);
 
-                // Check command cache with read lock
-                pthread_rwlock_rdlock(&shell_state.cache_lock);
-                char *cached_path = amcsh_cache_lookup(cmd.argv[0]);
-                if (cached_path) {
-                    char *path_copy = strdup(cached_path);
-                    pthread_rwlock_unlock(&shell_state.cache_lock);
-                    free(cmd.argv[0]);
-                    cmd.argv[0] = path_copy;
-                } else {
-                    pthread_rwlock_unlock(&shell_state.cache_lock);
+                // Fast path for built-in commands (resolved by the parser)
+                if (!cmd.next && !cmd.timed && !cmd.background && amcsh_execute_builtin(&cmd) >= 0) {
+                    amcsh_prompt_command_done(shell_state.exit_status, amcsh_elapsed(&started));
+                    amcsh_command_free(&cmd);
+                    continue;
                 }
 
-                // Execute command
+                // Execute command (the spawn step resolves it through the command cache)
                 amcsh_execute(&cmd);
-                
+                amcsh_prompt_command_done(shell_state.exit_status, amcsh_elapsed(&started));
+
                 // Update history in background
                 if (shell_state.interactive) {
                     char *hist_line = strdup(line);
-                    pthread_t hist_thread;
-                    pthread_create(&hist_thread, NULL, (void *(*)(void *))amcsh_history_add, hist_line);
-                    pthread_detach(hist_thread);
+                    if (hist_line)
+                        amcsh_thread_pool_submit(shell_state.thread_pool, history_task, hist_line);
                 }
 
-                // Update command cache if successful
-                if (shell_state.exit_status == 0 && !cached_path) {
-                    amcsh_cache_update(cmd.argv[0], cmd.argv[0]);
-                }
-                
-                // Free argv array
-                if (cmd.argv) {
-                    free(cmd.argv);
-                    cmd.argv = NULL;
-                }
             }
+
+            // Free argv and expanded words
+            amcsh_command_free(&cmd);
         }
 
         if (cmd_copy) {
             free(cmd_copy);
         }
     }
-    else
+    else if (command_string)
     {
-        // Non-interactive mode optimization
-        char buffer[AMCSH_MAX_CMD_LENGTH];
-        while (fgets(buffer, sizeof(buffer), stdin)) {
-            amcsh_command_t cmd = {0};
-            cmd.raw_cmd = buffer;
-            amcsh_parse_command(&cmd);
-            if (cmd.argc > 0) {
-                amcsh_execute(&cmd);
-            }
+        // -c text is read like a script, here-documents included
+        FILE *in = fmemopen((void *)command_string, strlen(command_string), "r");
+        if (in)
+        {
+            amcsh_run_script(in, NULL);
+            fclose(in);
         }
     }
+    else
+    {
+        // Commands share the script's stdin, so the shell must not read
+        // past the current line; files are rewound, anything else is read
+        // a byte at a time
+        struct stat st;
+        if (fstat(STDIN_FILENO, &st) != 0 || !S_ISREG(st.st_mode))
+            setvbuf(stdin, NULL, _IONBF, 0);
+        amcsh_run_script(stdin, NULL);
+    }
 
     amcsh_cleanup();
     return shell_state.exit_status;
@@ -244,7 +701,12 @@ int main(int argc, char *argv[])
 
 void amcsh_setup_signals(void)
 {
-    signal(SIGINT, amcsh_handle_signal);
+    // Without SA_RESTART, so Ctrl-C interrupts a builtin blocked in read
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = amcsh_handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
     signal(SIGTSTP, amcsh_handle_signal);
     signal(SIGCHLD, amcsh_handle_signal);
 }
@@ -255,7 +717,8 @@ void amcsh_handle_signal(int signo)
     {
     case SIGINT:
         // Handle Ctrl+C
-        if (shell_state.interactive)
+        amcsh_interrupted = 1;
+        if (main_state.interactive)
         {
             printf("\n");
             el_reset(el);
@@ -267,8 +730,8 @@ void amcsh_handle_signal(int signo)
         break;
 
     case SIGCHLD:
-        // Handle child process status changes
-        amcsh_update_jobs();
+        // Jobs are reaped from the main loop; wait4 and stdio are not safe here
+        amcsh_child_exited = 1;
         break;
     }
 }
@@ -0,0 +1,440 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// memo: run a command once per distinct set of inputs and replay its output
+// afterwards. The key is a SHA-256 over the working directory, argv, the
+// executable's identity, the environment variables and dependency files the
+// caller names; stdout, stderr and the exit status are kept under that key in
+// $XDG_CACHE_HOME/amcsh/memo and copied back out in the kernel on a hit.
+
+#define MEMO_VERSION "amcsh-memo-1"
+#define MEMO_MAX_INPUTS 64
+
+// SHA-256 (FIPS 180-4)
+
+typedef struct {
+    uint32_t h[8];
+    uint64_t len;
+    unsigned char block[64];
+    size_t used;
+} sha256_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_init(sha256_t *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(s->h, iv, sizeof(iv));
+    s->len = 0;
+    s->used = 0;
+}
+
+static void sha256_block(sha256_t *s, const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3];
+    uint32_t e = s->h[4], f = s->h[5], g = s->h[6], h = s->h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s->h[0] += a; s->h[1] += b; s->h[2] += c; s->h[3] += d;
+    s->h[4] += e; s->h[5] += f; s->h[6] += g; s->h[7] += h;
+}
+
+static void sha256_update(sha256_t *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    s->len += len;
+    if (s->used) {
+        size_t take = 64 - s->used < len ? 64 - s->used : len;
+        memcpy(s->block + s->used, p, take);
+        s->used += take;
+        p += take;
+        len -= take;
+        if (s->used < 64) {
+            return;
+        }
+        sha256_block(s, s->block);
+        s->used = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        sha256_block(s, p);
+    }
+    memcpy(s->block, p, len);
+    s->used = len;
+}
+
+static void sha256_final(sha256_t *s, unsigned char out[32]) {
+    uint64_t bits = s->len * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padlen = (s->used < 56 ? 56 : 120) - s->used;
+    for (int i = 0; i < 8; i++) {
+        pad[padlen + i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    sha256_update(s, pad, padlen + 8);
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = s->h[i] >> 24;
+        out[4 * i + 1] = s->h[i] >> 16;
+        out[4 * i + 2] = s->h[i] >> 8;
+        out[4 * i + 3] = s->h[i];
+    }
+}
+
+// Key material
+
+// Length-prefixed, so ("ab", "c") and ("a", "bc") hash differently
+static void hash_field(sha256_t *s, char tag, const void *data, size_t len) {
+    uint64_t n = len;
+    sha256_update(s, &tag, 1);
+    sha256_update(s, &n, sizeof(n));
+    sha256_update(s, data, len);
+}
+
+static void hash_string(sha256_t *s, char tag, const char *str) {
+    hash_field(s, tag, str, strlen(str));
+}
+
+// A file's identity as far as cheap dependency checks go; a missing file
+// hashes as such, so creating it later is a change too
+static void hash_stat(sha256_t *s, char tag, const char *path) {
+    struct stat st;
+    uint64_t id[5] = {0};
+    if (stat(path, &st) == 0) {
+        id[0] = st.st_dev;
+        id[1] = st.st_ino;
+        id[2] = st.st_size;
+        id[3] = st.st_mtim.tv_sec;
+        id[4] = st.st_mtim.tv_nsec;
+    }
+    hash_string(s, tag, path);
+    hash_field(s, tag, id, sizeof(id));
+}
+
+static int hash_contents(sha256_t *s, char tag, const char *path) {
+    unsigned char digest[32] = {0};
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        sha256_t file;
+        sha256_init(&file);
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                close(fd);
+                return -1;
+            }
+            sha256_update(&file, buf, n);
+        }
+        close(fd);
+        sha256_final(&file, digest);
+    } else if (errno != ENOENT) {
+        return -1;
+    }
+    hash_string(s, tag, path);
+    hash_field(s, tag, digest, sizeof(digest));
+    return 0;
+}
+
+// Cache directory
+
+static int make_dirs(char *path) {
+    for (char *p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            int err = mkdir(path, 0700) != 0 && errno != EEXIST;
+            *p = '/';
+            if (err) return -1;
+        }
+    }
+    return mkdir(path, 0700) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static int memo_dir(char *out, size_t size) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    int n;
+    if (base && base[0] == '/') {
+        n = snprintf(out, size, "%s/amcsh/memo", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !*home) {
+            errno = ENOENT;
+            return -1;
+        }
+        n = snprintf(out, size, "%s/.cache/amcsh/memo", home);
+    }
+    if (n < 0 || (size_t)n >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return make_dirs(out);
+}
+
+static void remove_entry(const char *dir) {
+    static const char *const files[] = {"stdout", "stderr", "status"};
+    char path[PATH_MAX];
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+// Copy a stored stream back out; stdout goes wherever builtin output goes
+static int replay(const char *dir, const char *name, int out) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = amcsh_copy_fd(fd, out);
+    close(fd);
+    return result;
+}
+
+// Exit status of a stored entry, or -1 when there is none (or a torn one)
+static int read_status(const char *dir) {
+    char path[PATH_MAX], buf[16];
+    snprintf(path, sizeof(path), "%s/status", dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    char *end;
+    long status = strtol(buf, &end, 10);
+    return end != buf && status >= 0 && status < 256 ? (int)status : -1;
+}
+
+static int open_output(const char *dir, const char *name) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+}
+
+// Run the command with its output going to files in tmp; returns its exit
+// status as the shell reports it, and whether it exited on its own
+static int run_into(const char *tmp, const char *path, char **argv, bool *exited) {
+    int out = open_output(tmp, "stdout");
+    int err = open_output(tmp, "stderr");
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    pid_t pid = -1;
+    if (out >= 0 && err >= 0 && null_fd >= 0) {
+        amcsh_spawn_req_t req;
+        amcsh_spawn_req_init(&req, argv);
+        req.path = path;
+        req.fds[STDIN_FILENO] = null_fd;
+        req.fds[STDOUT_FILENO] = out;
+        req.fds[STDERR_FILENO] = err;
+        pid = amcsh_spawn_process(&req, NULL);
+    }
+    int saved = errno;
+    if (out >= 0) close(out);
+    if (err >= 0) close(err);
+    if (null_fd >= 0) close(null_fd);
+    if (pid < 0) {
+        errno = saved;
+        return -1;
+    }
+
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    *exited = WIFEXITED(wstatus);
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+}
+
+int amcsh_builtin_memo(char **args) {
+    const char *deps[MEMO_MAX_INPUTS], *hashed[MEMO_MAX_INPUTS], *envs[MEMO_MAX_INPUTS];
+    int ndeps = 0, nhashed = 0, nenvs = 0;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char **list;
+        int *count;
+        if (strcmp(args[i], "--dep") == 0) {
+            list = deps, count = &ndeps;
+        } else if (strcmp(args[i], "--hash") == 0) {
+            list = hashed, count = &nhashed;
+        } else if (strcmp(args[i], "--env") == 0) {
+            list = envs, count = &nenvs;
+        } else {
+            fprintf(stderr, "amcsh: memo: %s: invalid option\n", args[i]);
+            return 2;
+        }
+        if (!args[i + 1]) {
+            fprintf(stderr, "amcsh: memo: %s: missing argument\n", args[i]);
+            return 2;
+        }
+        if (*count == MEMO_MAX_INPUTS) {
+            fprintf(stderr, "amcsh: memo: too many %s options\n", args[i]);
+            return 2;
+        }
+        list[(*count)++] = args[++i];
+    }
+    char **argv = &args[i];
+    if (!argv[0]) {
+        fprintf(stderr, "amcsh: memo: usage: memo [--dep FILE]... [--hash FILE]... [--env NAME]... [--] command [arg...]\n");
+        return 2;
+    }
+
+    // Builtins see shell state the key cannot, so they just run; memo runs
+    // in pipeline threads, where only pure ones may
+    const amcsh_builtin_t *builtin = amcsh_builtin_lookup(argv[0]);
+    if (builtin && builtin->func && amcsh_builtin_enabled(builtin)) {
+        if (!(builtin->flags & AMCSH_BUILTIN_PURE)) {
+            fprintf(stderr, "amcsh: memo: %s: shell builtin\n", argv[0]);
+            return 2;
+        }
+        return builtin->func(argv);
+    }
+
+    char path[PATH_MAX];
+    int err = amcsh_command_path(argv[0], path, sizeof(path));
+    if (err != 0) {
+        fprintf(stderr, "amcsh: memo: %s: %s\n", argv[0],
+                err == ENOENT ? "command not found" : strerror(err));
+        return err == ENOENT ? 127 : 126;
+    }
+
+    sha256_t key;
+    sha256_init(&key);
+    hash_string(&key, 'v', MEMO_VERSION);
+    char cwd[PATH_MAX];
+    hash_string(&key, 'c', getcwd(cwd, sizeof(cwd)) ? cwd : "");
+    for (char **arg = argv; *arg; arg++) {
+        hash_string(&key, 'a', *arg);
+    }
+    hash_stat(&key, 'x', path);
+    for (int e = 0; e < nenvs; e++) {
+        const char *value = getenv(envs[e]);
+        hash_string(&key, 'e', envs[e]);
+        hash_string(&key, value ? '=' : '-', value ? value : "");
+    }
+    for (int d = 0; d < ndeps; d++) {
+        hash_stat(&key, 'd', deps[d]);
+    }
+    for (int h = 0; h < nhashed; h++) {
+        if (hash_contents(&key, 'h', hashed[h]) != 0) {
+            fprintf(stderr, "amcsh: memo: %s: %s\n", hashed[h], strerror(errno));
+            return 1;
+        }
+    }
+    unsigned char digest[32];
+    sha256_final(&key, digest);
+
+    char dir[PATH_MAX], entry[PATH_MAX + 80];
+    if (memo_dir(dir, sizeof(dir)) != 0) {
+        fprintf(stderr, "amcsh: memo: cache directory: %s\n", strerror(errno));
+        return 1;
+    }
+    int n = snprintf(entry, sizeof(entry), "%s/", dir);
+    for (int b = 0; b < 32; b++) {
+        n += snprintf(entry + n, sizeof(entry) - n, "%02x", digest[b]);
+    }
+
+    int out = amcsh_out_fd();
+    amcsh_flush();
+    fflush(stderr);
+
+    int status = read_status(entry);
+    if (status >= 0) {
+        if (replay(entry, "stdout", out) == 0 && replay(entry, "stderr", STDERR_FILENO) == 0) {
+            return status;
+        }
+        if (errno == EPIPE) {
+            return 1;
+        }
+        // Unreadable entry: run the command again and replace it
+        remove_entry(entry);
+    }
+
+    // Miss: fill a private directory, then publish it in one rename so a
+    // concurrent memo of the same key never sees half an entry
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s/.tmp-XXXXXX", dir);
+    if (!mkdtemp(tmp)) {
+        fprintf(stderr, "amcsh: memo: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    bool exited = false;
+    status = run_into(tmp, path, argv, &exited);
+    if (status < 0) {
+        fprintf(stderr, "amcsh: memo: %s: %s\n", argv[0], strerror(errno));
+        remove_entry(tmp);
+        return 126;
+    }
+
+    const char *from = tmp;
+    // A command killed by a signal did not finish; its output is not kept
+    if (exited) {
+        char status_path[PATH_MAX + 32];
+        snprintf(status_path, sizeof(status_path), "%s/status", tmp);
+        FILE *f = fopen(status_path, "we");
+        bool stored = f && fprintf(f, "%d\n", status) > 0;
+        if (f && fclose(f) != 0) {
+            stored = false;
+        }
+        if (stored && rename(tmp, entry) == 0) {
+            from = entry;
+        }
+    }
+
+    int result = replay(from, "stdout", out);
+    if (result == 0) {
+        result = replay(from, "stderr", STDERR_FILENO);
+    }
+    if (from == tmp) {
+        // Not published: killed, or another memo of the same key got there first
+        remove_entry(tmp);
+    }
+    if (result != 0 && errno != EPIPE) {
+        fprintf(stderr, "amcsh: memo: %s\n", strerror(errno));
+    }
+    return result != 0 ? 1 : status;
+}
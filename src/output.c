@@ -0,0 +1,225 @@
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+// Standard streams of the builtin running on this thread. Pipeline stages run
+// on worker threads, so they cannot share fds 0/1 with the shell.
+static __thread amcsh_output_t thread_stdout = {STDOUT_FILENO, NULL, 0, 0, false};
+static __thread amcsh_output_t *thread_out = NULL; // NULL: unbuffered stdout
+static __thread int thread_in = STDIN_FILENO;
+
+static amcsh_output_t *current_out(void) {
+    return thread_out ? thread_out : &thread_stdout;
+}
+
+// fd >= 0 writes through buf (caller storage, may be NULL for unbuffered);
+// fd < 0 collects everything in a heap buffer owned by the output
+void amcsh_output_init(amcsh_output_t *out, int fd, char *buf, size_t cap) {
+    out->fd = fd;
+    out->buf = fd >= 0 ? buf : NULL;
+    out->len = 0;
+    out->cap = fd >= 0 ? cap : 0;
+    out->failed = false;
+}
+
+// Write a gather list completely, resuming after short writes
+static int write_iov(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Memory outputs grow instead of flushing
+static bool output_grow(amcsh_output_t *out, size_t extra) {
+    if (out->len + extra + 1 <= out->cap) {
+        return true;
+    }
+    size_t cap = out->cap ? out->cap : 4096;
+    while (cap < out->len + extra + 1) cap *= 2;
+    char *buf = realloc(out->buf, cap);
+    if (!buf) {
+        out->failed = true;
+        return false;
+    }
+    out->buf = buf;
+    out->cap = cap;
+    return true;
+}
+
+// Send buffered bytes followed by iov in a single writev
+static int output_send(amcsh_output_t *out, const struct iovec *iov, int count) {
+    struct iovec list[AMCSH_OUTPUT_MAX_IOV + 1];
+    int n = 0;
+
+    if (out->len > 0) {
+        list[n].iov_base = out->buf;
+        list[n++].iov_len = out->len;
+    }
+    for (int i = 0; i < count; i++) {
+        if (iov[i].iov_len > 0) list[n++] = iov[i];
+    }
+
+    out->len = 0;
+    if (out->failed || n == 0) {
+        return out->failed ? -1 : 0;
+    }
+    if (write_iov(out->fd, list, n) != 0) {
+        // Typically EPIPE: the reader is gone, so drop the rest of the output
+        out->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+int amcsh_output_flush(amcsh_output_t *out) {
+    if (out->fd < 0) {
+        return 0;
+    }
+    return output_send(out, NULL, 0);
+}
+
+// Collected bytes of a memory output, NUL-terminated; the caller frees them
+char *amcsh_output_take(amcsh_output_t *out, size_t *len) {
+    output_grow(out, 0);
+    char *buf = out->buf;
+    if (buf) {
+        buf[out->len] = '\0';
+    }
+    *len = buf ? out->len : 0;
+    out->buf = NULL;
+    out->len = out->cap = 0;
+    return buf;
+}
+
+int amcsh_output_writev(amcsh_output_t *out, const struct iovec *iov, int count) {
+    while (count > AMCSH_OUTPUT_MAX_IOV) {
+        if (amcsh_output_writev(out, iov, AMCSH_OUTPUT_MAX_IOV) != 0) {
+            return -1;
+        }
+        iov += AMCSH_OUTPUT_MAX_IOV;
+        count -= AMCSH_OUTPUT_MAX_IOV;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += iov[i].iov_len;
+    }
+
+    if (out->fd < 0 && !output_grow(out, total)) {
+        return -1;
+    }
+    if (out->fd < 0 || out->len + total <= out->cap) {
+        for (int i = 0; i < count; i++) {
+            memcpy(out->buf + out->len, iov[i].iov_base, iov[i].iov_len);
+            out->len += iov[i].iov_len;
+        }
+        return 0;
+    }
+    return output_send(out, iov, count);
+}
+
+void amcsh_io_enter(amcsh_output_t *out, int in, amcsh_io_t *saved) {
+    saved->out = thread_out;
+    saved->in = thread_in;
+    if (out) {
+        thread_out = out;
+    }
+    if (in >= 0) {
+        thread_in = in;
+    }
+}
+
+// Builtin output is flushed once, when the builtin finishes
+void amcsh_io_leave(const amcsh_io_t *saved) {
+    amcsh_output_flush(current_out());
+    thread_out = saved->out;
+    thread_in = saved->in;
+}
+
+int amcsh_in_fd(void) {
+    return thread_in;
+}
+
+// -1 while output is captured into memory
+int amcsh_out_fd(void) {
+    return current_out()->fd;
+}
+
+void amcsh_flush(void) {
+    amcsh_output_flush(current_out());
+}
+
+int amcsh_printf(const char *format, ...) {
+    amcsh_output_t *out = current_out();
+    va_list ap, retry;
+    va_start(ap, format);
+    va_copy(retry, ap);
+
+    size_t room = out->cap - out->len;
+    int n = vsnprintf(out->buf ? out->buf + out->len : NULL, room, format, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n < room) {
+        // Formatted straight into the buffer
+    } else if (out->fd < 0 ? output_grow(out, n)
+                           : amcsh_output_flush(out) == 0 && (size_t)n < out->cap) {
+        vsnprintf(out->buf + out->len, out->cap - out->len, format, retry);
+    } else if (out->fd >= 0 && !out->failed) {
+        // Larger than the whole buffer: format aside and write it directly
+        char *tmp = malloc(n + 1);
+        if (tmp) {
+            vsnprintf(tmp, n + 1, format, retry);
+            amcsh_write(tmp, n);
+            free(tmp);
+        }
+        va_end(retry);
+        return n;
+    }
+    if (n > 0 && !out->failed) {
+        out->len += n;
+    }
+    va_end(retry);
+    return n;
+}
+
+void amcsh_writev(const struct iovec *iov, int count) {
+    amcsh_output_writev(current_out(), iov, count);
+}
+
+void amcsh_write(const void *data, size_t len) {
+    struct iovec iov = {(void *)data, len};
+    amcsh_output_writev(current_out(), &iov, 1);
+}
+
+void amcsh_puts(const char *str) {
+    amcsh_write(str, strlen(str));
+}
+
+void amcsh_putc(int c) {
+    amcsh_output_t *out = current_out();
+    if (out->len < out->cap) {
+        out->buf[out->len++] = (char)c;
+    } else {
+        char ch = (char)c;
+        amcsh_write(&ch, 1);
+    }
+}
@@ -1,76 +1,715 @@
 #include "amcsh.h"
 #include "parser.h"
+#include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 
-// Fast string tokenization without copying
-static char *skip_whitespace(char *str) {
-    while (isspace(*str)) str++;
-    return str;
+#define PARSER_INITIAL_ARGS 16
+
+// Word being assembled; copied into the command arena once complete
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool active;  // Set once the word has content or an empty quote pair
+    bool no_split; // Redirection target: expansions never split or push args
+    bool glob;    // Unquoted *, ?, [ or { seen: needs pathname/brace expansion
+    bool escaped; // Quoted metacharacters were backslash-escaped in buf
+} word_t;
+
+void amcsh_command_init(amcsh_command_t *cmd, char *raw_cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->raw_cmd = raw_cmd;
+    cmd->redirect_in = -1;
+    cmd->redirect_out = -1;
+    cmd->redirect_err = -1;
+    cmd->pipe_read = -1;
+    cmd->pipe_write = -1;
+    cmd->job_log = -1;
+}
+
+void amcsh_command_free(amcsh_command_t *cmd) {
+    // Later pipeline stages live in this command's arena
+    if (cmd->next) {
+        amcsh_command_free(cmd->next);
+        cmd->next = NULL;
+    }
+
+    // Redirections of commands that never reached a spawn are still open
+    if (cmd->redirect_in >= 0) close(cmd->redirect_in);
+    if (cmd->redirect_out >= 0) close(cmd->redirect_out);
+    if (cmd->redirect_err >= 0) close(cmd->redirect_err);
+    if (cmd->pipe_read >= 0) close(cmd->pipe_read);
+    if (cmd->pipe_write >= 0) close(cmd->pipe_write);
+    cmd->redirect_in = -1;
+    cmd->redirect_out = -1;
+    cmd->redirect_err = -1;
+    cmd->pipe_read = -1;
+    cmd->pipe_write = -1;
+    cmd->heredocs = NULL;
+    amcsh_procsub_close(cmd);
+
+    amcsh_arena_free(&cmd->arena);
+    cmd->argv = NULL;
+    cmd->argc = 0;
+    cmd->argv_capacity = 0;
+}
+
+static void word_append(word_t *w, const char *str, size_t len) {
+    if (w->len + len + 1 > w->cap) {
+        size_t cap = w->cap ? w->cap : 64;
+        while (cap < w->len + len + 1) cap *= 2;
+        w->buf = realloc(w->buf, cap);
+        w->cap = cap;
+    }
+    memcpy(w->buf + w->len, str, len);
+    w->len += len;
+    w->active = true;
+}
+
+static void word_putc(word_t *w, char c) {
+    word_append(w, &c, 1);
+}
+
+// Characters that mean something to brace or pathname expansion
+static bool is_glob_special(char c) {
+    return c == '*' || c == '?' || c == '[' || c == ']' ||
+           c == '{' || c == '}' || c == ',' || c == '\\';
+}
+
+// Quoted text: escape metacharacters so expansion treats them literally
+static void word_quoted(word_t *w, const char *str, size_t len) {
+    if (w->no_split) {
+        word_append(w, str, len);
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (is_glob_special(str[i])) {
+            word_putc(w, '\\');
+            w->escaped = true;
+        }
+        word_putc(w, str[i]);
+    }
+    w->active = true;
+}
+
+// Unquoted character: metacharacters mark the word for expansion
+static void word_unquoted(word_t *w, char c) {
+    if (!w->no_split) {
+        if (c == '\\') {
+            word_putc(w, '\\');
+            w->escaped = true;
+        } else if (c == '*' || c == '?' || c == '[' || c == '{') {
+            w->glob = true;
+        }
+    }
+    word_putc(w, c);
+}
+
+static void push_arg(amcsh_command_t *cmd, char *arg) {
+    if (cmd->argc + 1 >= cmd->argv_capacity) {
+        int capacity = cmd->argv_capacity ? cmd->argv_capacity * 2 : PARSER_INITIAL_ARGS;
+        char **argv = amcsh_arena_alloc(&cmd->arena, capacity * sizeof(char *));
+        if (cmd->argc) {
+            memcpy(argv, cmd->argv, cmd->argc * sizeof(char *));
+        }
+        cmd->argv = argv;
+        cmd->argv_capacity = capacity;
+    }
+    cmd->argv[cmd->argc++] = arg;
+    cmd->argv[cmd->argc] = NULL;
 }
 
-static char *find_token_end(char *str) {
-    while (*str && !isspace(*str)) {
+static void finish_word(amcsh_command_t *cmd, word_t *w) {
+    if (!w->active) {
+        return;
+    }
+
+    const char *text = w->buf ? w->buf : "";
+    if (w->glob) {
+        char **fields;
+        w->buf[w->len] = '\0';
+        int n = amcsh_glob_expand(w->buf, &cmd->arena, &fields);
+        if (n < 0) {
+            // Like a failed redirection, the command does not run
+            fprintf(stderr, "amcsh: %s\n", errno == E2BIG ? "brace expansion too large" : strerror(errno));
+            cmd->redirect_failed = true;
+            shell_state.exit_status = 1;
+        }
+        for (int i = 0; i < n; i++) {
+            push_arg(cmd, fields[i]);
+        }
+    } else if (w->escaped) {
+        push_arg(cmd, amcsh_glob_unescape(&cmd->arena, text, w->len));
+    } else {
+        push_arg(cmd, amcsh_arena_strndup(&cmd->arena, text, w->len));
+    }
+
+    w->len = 0;
+    w->active = false;
+    w->glob = false;
+    w->escaped = false;
+}
+
+static bool is_word_end(char c) {
+    return c == '\0' || isspace((unsigned char)c) ||
+           c == '|' || c == '&' || c == '<' || c == '>';
+}
+
+// Find the ')' closing a "$(" whose body starts at str
+static const char *find_subst_end(const char *str) {
+    int depth = 1;
+    while (*str) {
+        if (*str == '\\' && str[1]) {
+            str += 2;
+            continue;
+        }
         if (*str == '"' || *str == '\'') {
             char quote = *str++;
-            while (*str && *str != quote) str++;
-            if (*str) str++;
+            while (*str && *str != quote) {
+                if (quote == '"' && *str == '\\' && str[1]) str++;
+                str++;
+            }
+            if (!*str) return NULL;
+        } else if (*str == '(') {
+            depth++;
+        } else if (*str == ')' && --depth == 0) {
+            return str;
+        }
+        str++;
+    }
+    return NULL;
+}
+
+// Add expansion output to the current word, splitting fields when unquoted.
+// Unquoted output owned by the arena that forms whole words is split in place.
+static void emit_value(amcsh_command_t *cmd, word_t *w, char *value, size_t len,
+                       bool quoted, bool in_place) {
+    if (quoted || w->no_split) {
+        word_quoted(w, value, len);
+        return;
+    }
+
+    // Fields that need pathname expansion take the copying path below
+    if (in_place && !w->active && !strpbrk(value, "*?[{\\")) {
+        char *field = NULL;
+        for (size_t i = 0; i < len; i++) {
+            if (isspace((unsigned char)value[i])) {
+                value[i] = '\0';
+                if (field) push_arg(cmd, field);
+                field = NULL;
+            } else if (!field) {
+                field = value + i;
+            }
+        }
+        if (field) push_arg(cmd, field);
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (isspace((unsigned char)value[i])) {
+            finish_word(cmd, w);
         } else {
-            str++;
+            word_unquoted(w, value[i]);
         }
     }
-    return str;
 }
 
-void amcsh_parse_command(amcsh_command_t *cmd) {
-    char *current = cmd->raw_cmd;
+// Expand a '$' construct at str; returns the position after it
+static const char *expand_dollar(amcsh_command_t *cmd, word_t *w, const char *str, bool quoted) {
+    const char *p = str + 1;
+
+    if (*p == '(') {
+        const char *end = find_subst_end(p + 1);
+        if (!end) {
+            word_putc(w, '$');
+            return p;
+        }
+        size_t len;
+        char *value = amcsh_subst_capture(p + 1, end - (p + 1), &cmd->arena, &len);
+        emit_value(cmd, w, value, len, quoted, is_word_end(end[1]));
+        return end + 1;
+    }
+
+    char num[24];
+    if (*p == '?' || *p == '$') {
+        snprintf(num, sizeof(num), "%d", *p == '?' ? shell_state.exit_status : (int)getpid());
+        emit_value(cmd, w, num, strlen(num), quoted, false);
+        return p + 1;
+    }
+
+    const char *name = p;
+    const char *end;
+    if (*p == '{') {
+        name = p + 1;
+        end = strchr(name, '}');
+        if (!end) {
+            word_putc(w, '$');
+            return p;
+        }
+    } else {
+        end = p;
+        while (isalnum((unsigned char)*end) || *end == '_') end++;
+        if (end == p) {
+            word_putc(w, '$');
+            return p;
+        }
+    }
+
+    char var[256];
+    size_t name_len = end - name;
+    if (name_len < sizeof(var)) {
+        memcpy(var, name, name_len);
+        var[name_len] = '\0';
+        char *value = getenv(var);
+        if (value) {
+            emit_value(cmd, w, value, strlen(value), quoted, false);
+        } else if (quoted) {
+            w->active = true;
+        }
+    }
+    return *end == '}' ? end + 1 : end;
+}
+
+// Expand a backquoted substitution at str; returns the position after it
+static const char *expand_backtick(amcsh_command_t *cmd, word_t *w, const char *str, bool quoted) {
+    const char *p = str + 1;
+    word_t body = {0};
+
+    // Inside backquotes a backslash only escapes '$', '`' and '\'
+    while (*p && *p != '`') {
+        if (*p == '\\' && (p[1] == '$' || p[1] == '`' || p[1] == '\\')) {
+            p++;
+        }
+        word_putc(&body, *p++);
+    }
+    if (!*p) {
+        free(body.buf);
+        word_putc(w, '`');
+        return str + 1;
+    }
+
+    size_t len;
+    char *value = amcsh_subst_capture(body.buf ? body.buf : "", body.len, &cmd->arena, &len);
+    emit_value(cmd, w, value, len, quoted, is_word_end(p[1]));
+    free(body.buf);
+    return p + 1;
+}
+
+// Parse one word starting at current; returns the position after it
+static const char *parse_word(amcsh_command_t *cmd, word_t *w, const char *current) {
+    while (!is_word_end(*current)) {
+        char c = *current;
+
+        switch (c) {
+            case '\'': {
+                const char *start = ++current;
+                while (*current && *current != '\'') current++;
+                word_quoted(w, start, current - start);
+                if (*current) current++;
+                break;
+            }
+
+            case '"':
+                // "$(...)" as a whole word is used directly without copying
+                if (!w->active && !w->no_split && current[1] == '$' && current[2] == '(') {
+                    const char *end = find_subst_end(current + 3);
+                    if (end && end[1] == '"' && is_word_end(end[2])) {
+                        size_t len;
+                        push_arg(cmd, amcsh_subst_capture(current + 3, end - (current + 3),
+                                                          &cmd->arena, &len));
+                        return end + 2;
+                    }
+                }
+
+                w->active = true;
+                current++;
+                while (*current && *current != '"') {
+                    if (*current == '\\' && current[1] && strchr("$`\"\\\n", current[1])) {
+                        word_quoted(w, current + 1, 1);
+                        current += 2;
+                    } else if (*current == '$') {
+                        current = expand_dollar(cmd, w, current, true);
+                    } else if (*current == '`') {
+                        current = expand_backtick(cmd, w, current, true);
+                    } else {
+                        word_quoted(w, current++, 1);
+                    }
+                }
+                if (*current) current++;
+                break;
+
+            case '\\':
+                if (current[1]) {
+                    word_quoted(w, current + 1, 1);
+                    current += 2;
+                } else {
+                    current++;
+                }
+                break;
+
+            case '$':
+                current = expand_dollar(cmd, w, current, false);
+                break;
+
+            case '`':
+                current = expand_backtick(cmd, w, current, false);
+                break;
+
+            default:
+                word_unquoted(w, c);
+                current++;
+                break;
+        }
+    }
+    return current;
+}
+
+// Here-document delimiters are not expanded; any quoting disables body expansion
+static const char *scan_delimiter(word_t *w, const char *current, bool *quoted) {
+    *quoted = false;
+    while (!is_word_end(*current)) {
+        if (*current == '\'' || *current == '"') {
+            char quote = *current++;
+            *quoted = true;
+            w->active = true;
+            while (*current && *current != quote) {
+                word_putc(w, *current++);
+            }
+            if (*current) current++;
+        } else if (*current == '\\' && current[1]) {
+            *quoted = true;
+            word_putc(w, current[1]);
+            current += 2;
+        } else {
+            word_putc(w, *current++);
+        }
+    }
+    return current;
+}
+
+// A new input redirection supersedes earlier ones
+static void replace_stdin(amcsh_command_t *cmd, int fd) {
+    if (cmd->redirect_in >= 0) {
+        close(cmd->redirect_in);
+    }
+    cmd->redirect_in = fd;
+    for (amcsh_heredoc_t *doc = cmd->heredocs; doc; doc = doc->next) {
+        doc->is_stdin = false;
+    }
+}
+
+// Point descriptor target (0, 1 or 2) at fd, which the command now owns
+static void set_redirect(amcsh_command_t *cmd, int target, int fd, bool append) {
+    if (target == STDIN_FILENO) {
+        replace_stdin(cmd, fd);
+        return;
+    }
+    int *slot = target == STDOUT_FILENO ? &cmd->redirect_out : &cmd->redirect_err;
+    if (*slot >= 0) {
+        close(*slot);
+    }
+    *slot = fd;
+    if (target == STDOUT_FILENO) {
+        cmd->append_out = append;
+    } else {
+        cmd->err_to_out = false;
+    }
+}
+
+// The command does not run; redirections after this one are not opened
+static const char *redirect_error(amcsh_command_t *cmd, const char *current, int status) {
+    cmd->redirect_failed = true;
+    shell_state.exit_status = status;
+    return current;
+}
+
+// N>&M and N<&M: descriptor target becomes a copy of what M is now
+static const char *parse_dup(amcsh_command_t *cmd, const char *current, int target) {
+    while (*current == ' ' || *current == '\t') current++;
+    word_t word = {0};
+    word.no_split = true;
+    current = parse_word(cmd, &word, current);
+
+    int source = 0;
+    size_t i = 0;
+    for (; i < word.len && isdigit((unsigned char)word.buf[i]) && source < 1000; i++) {
+        source = source * 10 + (word.buf[i] - '0');
+    }
+    bool number = word.len > 0 && i == word.len;
+    free(word.buf);
+    if (!number) {
+        fprintf(stderr, "amcsh: syntax error: file descriptor expected after `%s&'\n",
+                target == STDIN_FILENO ? "<" : ">");
+        return redirect_error(cmd, current, 2);
+    }
+    if (cmd->redirect_failed || source == target) {
+        return current;
+    }
+
+    // 2>&1 before any output redirection follows the stage's pipe, which is
+    // only connected when the pipeline runs
+    int fd = source;
+    if (source == STDIN_FILENO && cmd->redirect_in >= 0) {
+        fd = cmd->redirect_in;
+    } else if (source == STDOUT_FILENO && cmd->redirect_out >= 0) {
+        fd = cmd->redirect_out;
+    } else if (source == STDERR_FILENO && cmd->redirect_err >= 0) {
+        fd = cmd->redirect_err;
+    } else if ((source == STDOUT_FILENO && target == STDERR_FILENO) ||
+               (source == STDERR_FILENO && cmd->err_to_out)) {
+        if (target == STDERR_FILENO) {
+            set_redirect(cmd, STDERR_FILENO, -1, false);
+            cmd->err_to_out = true;
+        }
+        return current;
+    }
+
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    if (copy < 0) {
+        fprintf(stderr, "amcsh: %d: %s\n", source, strerror(errno));
+        return redirect_error(cmd, current, 1);
+    }
+    set_redirect(cmd, target, copy, false);
+    return current;
+}
+
+// Parse <, >, >>, <<, <<-, <<<, >& or <& and its target at current, applied
+// to descriptor target, or to the operator's own when target is -1
+static const char *parse_redirect(amcsh_command_t *cmd, const char *current, int target) {
+    char op = *current++;
+    bool append = false, heredoc = false, herestring = false, strip_tabs = false;
+
+    if (target < 0) {
+        target = op == '<' ? STDIN_FILENO : STDOUT_FILENO;
+    } else if (target > STDERR_FILENO) {
+        fprintf(stderr, "amcsh: %d: only descriptors 0, 1 and 2 can be redirected\n", target);
+        return redirect_error(cmd, current + (*current == op || *current == '&'), 2);
+    }
+
+    if (*current == '&') {
+        return parse_dup(cmd, current + 1, target);
+    }
+    if (op == '>' && *current == '>') {
+        append = true;
+        current++;
+    } else if (op == '<' && *current == '<') {
+        current++;
+        if (*current == '<') {
+            herestring = true;
+            current++;
+        } else {
+            heredoc = true;
+            if (*current == '-') {
+                strip_tabs = true;
+                current++;
+            }
+        }
+    }
+
+    while (*current == ' ' || *current == '\t') current++;
+
+    if (heredoc && target != STDIN_FILENO) {
+        fprintf(stderr, "amcsh: %d: here-documents can only be standard input\n", target);
+        return redirect_error(cmd, current, 2);
+    }
+
+    word_t word = {0};
+    bool quoted = false;
+    word.no_split = true;
+    const char *subst_end = NULL;
+    if (heredoc) {
+        current = scan_delimiter(&word, current, &quoted);
+    } else if ((*current == '<' || *current == '>') && current[1] == '(' &&
+               (subst_end = find_subst_end(current + 2))) {
+        // "> >(list)" and "< <(list)"
+        char *path = amcsh_procsub_open(cmd, current + 2, subst_end - (current + 2), *current == '>');
+        if (path) {
+            word_append(&word, path, strlen(path));
+        }
+        current = subst_end + 1;
+    } else {
+        current = parse_word(cmd, &word, current);
+    }
+
+    if (!word.active) {
+        free(word.buf);
+        fprintf(stderr, "amcsh: syntax error: missing redirection target\n");
+        return redirect_error(cmd, current, 2);
+    }
+
+    char *name = amcsh_arena_strndup(&cmd->arena, word.buf ? word.buf : "", word.len);
+    free(word.buf);
+
+    // Bodies are still read after a failed redirection, but nothing is opened
+    if (heredoc) {
+        amcsh_heredoc_t *doc = amcsh_arena_alloc(&cmd->arena, sizeof(amcsh_heredoc_t));
+        doc->delimiter = name;
+        doc->strip_tabs = strip_tabs;
+        doc->expand = !quoted;
+        doc->next = NULL;
+
+        replace_stdin(cmd, -1);
+        doc->is_stdin = true;
+
+        amcsh_heredoc_t **tail = &cmd->heredocs;
+        while (*tail) tail = &(*tail)->next;
+        *tail = doc;
+        return current;
+    }
+    if (cmd->redirect_failed) {
+        return current;
+    }
+
+    int fd;
+    if (herestring) {
+        size_t len = strlen(name);
+        name[len] = '\n';
+        fd = amcsh_memfd_from_buffer("amcsh-herestring", name, len + 1);
+        name[len] = '\0';
+    } else if (op == '<') {
+        fd = amcsh_redirect_open(name, O_RDONLY);
+    } else {
+        fd = amcsh_redirect_open(name, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC));
+    }
+
+    if (fd < 0) {
+        return redirect_error(cmd, current, 1);
+    }
+    set_redirect(cmd, target, fd, append);
+    return current;
+}
+
+char *amcsh_expand_string(amcsh_command_t *cmd, const char *str, size_t len, size_t *out_len) {
+    const char *end = str + len;
+    word_t w = {0};
+    w.no_split = true;
+
+    while (str < end) {
+        if (*str == '\\' && str + 1 < end && strchr("$`\\\n", str[1])) {
+            if (str[1] != '\n') {
+                word_putc(&w, str[1]);
+            }
+            str += 2;
+        } else if (*str == '$') {
+            str = expand_dollar(cmd, &w, str, true);
+        } else if (*str == '`') {
+            str = expand_backtick(cmd, &w, str, true);
+        } else {
+            word_putc(&w, *str++);
+        }
+    }
+
+    char *result = amcsh_arena_strndup(&cmd->arena, w.buf ? w.buf : "", w.len);
+    *out_len = w.len;
+    free(w.buf);
+    return result;
+}
+
+// argv is always valid, even for an empty line
+static void start_argv(amcsh_command_t *cmd) {
     cmd->argc = 0;
-    
-    // Allocate memory for argv array
-    cmd->argv = (char **)malloc(AMCSH_MAX_ARGS * sizeof(char *));
-    
-    while (*current && cmd->argc < AMCSH_MAX_ARGS - 1) {
-        current = skip_whitespace(current);
-        if (!*current) break;
-        
-        // Handle special characters
-        if (*current == '|' || *current == '>' || *current == '<' || *current == '&') {
+    cmd->argv = amcsh_arena_alloc(&cmd->arena, PARSER_INITIAL_ARGS * sizeof(char *));
+    cmd->argv_capacity = PARSER_INITIAL_ARGS;
+    cmd->argv[0] = NULL;
+}
+
+void amcsh_parse_command(amcsh_command_t *cmd) {
+    amcsh_command_t *head = cmd;
+    const char *current = cmd->raw_cmd;
+    word_t w = {0};
+    start_argv(cmd);
+
+    while (*current) {
+        if (isspace((unsigned char)*current)) {
+            current++;
+            continue;
+        }
+
+        // <(list) and >(list) become a /dev/fd path to a pipe
+        if ((*current == '<' || *current == '>') && current[1] == '(') {
+            const char *end = find_subst_end(current + 2);
+            if (end) {
+                char *path = amcsh_procsub_open(cmd, current + 2, end - (current + 2), *current == '>');
+                if (path) {
+                    push_arg(cmd, path);
+                }
+                current = end + 1;
+                continue;
+            }
+        }
+
+        // Handle special characters; N< and N> apply to descriptor N
+        if (*current == '<' || *current == '>') {
+            current = parse_redirect(cmd, current, -1);
+            continue;
+        }
+        if (isdigit((unsigned char)*current)) {
+            const char *op = current;
+            while (isdigit((unsigned char)*op)) op++;
+            if ((*op == '<' || *op == '>') && op[1] != '(') {
+                current = parse_redirect(cmd, op, op - current > 4 ? 1000 : atoi(current));
+                continue;
+            }
+        }
+        if (*current == '|' || *current == '&') {
             switch (*current) {
-                case '|':
-                    // TODO: Setup pipe
-                    break;
-                case '>':
-                    if (*(current + 1) == '>') {
-                        cmd->append_out = true;
-                        current++;
-                    }
-                    // TODO: Setup output redirection
-                    break;
-                case '<':
-                    // TODO: Setup input redirection
+                case '|': {
+                    // Each stage is resolved on its own and chained from the head
+                    amcsh_resolve_command(cmd);
+                    amcsh_command_t *stage = amcsh_arena_alloc(&head->arena, sizeof(*stage));
+                    amcsh_command_init(stage, head->raw_cmd);
+                    start_argv(stage);
+                    cmd->next = stage;
+                    cmd = stage;
                     break;
+                }
                 case '&':
-                    cmd->background = true;
+                    head->background = true;
                     break;
             }
             current++;
             continue;
         }
-        
-        // Handle quoted strings
-        if (*current == '"' || *current == '\'') {
-            char quote = *current;
-            cmd->argv[cmd->argc++] = ++current;
-            while (*current && *current != quote) current++;
-            if (*current) *current++ = '\0';
-        } else {
-            cmd->argv[cmd->argc++] = current;
-            char *end = find_token_end(current);
-            if (*end) *end++ = '\0';
-            current = end;
+
+        // A ( ) or { } group stands in for the command words; its body is
+        // split and expanded by the list runner when the group runs
+        if (cmd->argc == 0 && !cmd->group &&
+            (*current == '(' || (*current == '{' && isspace((unsigned char)current[1])))) {
+            const char *close = amcsh_group_end(current);
+            if (!close) {
+                fprintf(stderr, "amcsh: syntax error: unterminated `%c'\n", *current);
+                shell_state.exit_status = 2;
+                break;
+            }
+            cmd->group = amcsh_arena_strndup(&head->arena, current + 1, close - current - 1);
+            cmd->subshell = *current == '(';
+            current = close + 1;
+            continue;
+        }
+        if (cmd->group) {
+            fprintf(stderr, "amcsh: syntax error: unexpected word after `%c'\n", cmd->subshell ? ')' : '}');
+            cmd->group = NULL;
+            shell_state.exit_status = 2;
+            break;
         }
+
+        current = parse_word(cmd, &w, current);
+        if (cmd->redirect_failed) {
+            // The rest of a stage that will not run is only skipped
+            w.len = 0;
+            w.active = w.glob = w.escaped = false;
+            continue;
+        }
+        finish_word(cmd, &w);
     }
-    
-    cmd->argv[cmd->argc] = NULL;
+
+    free(w.buf);
+
+    // Resolve the command name once; execution paths reuse the result
+    amcsh_resolve_command(cmd);
 }
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Speculative command resolution. Once a command word is known (typed at
+// the prompt, or parsed from a script) an idle worker resolves it through
+// the command cache and has the kernel start reading the executable and its
+// ELF interpreter, so exec finds their pages in the page cache instead of
+// faulting them in from cold storage one by one.
+
+#define PREFETCH_RECENT 32     // Commands remembered to avoid asking twice
+#define PREFETCH_NAME_MAX 64
+#define PREFETCH_TTL 30        // Seconds before a command is read ahead again
+#define PREFETCH_DEPTH 3       // Interpreters followed: script, #! target, ld.so
+#define PREFETCH_CHUNK (2 << 20)
+
+typedef struct {
+    char name[PREFETCH_NAME_MAX];
+    time_t when;
+} recent_t;
+
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static recent_t recent[PREFETCH_RECENT];
+static int recent_next;
+static int enabled = -1;       // AMCSH_PREFETCH, read on first use
+
+// The interpreter an executable names: PT_INTERP for ELF, the #! line for
+// scripts. False when it has none.
+static bool read_interpreter(int fd, char *out, size_t size) {
+    unsigned char header[256];
+    ssize_t n = pread(fd, header, sizeof(header), 0);
+    if (n < 4) {
+        return false;
+    }
+
+    if (header[0] == '#' && header[1] == '!') {
+        size_t i = 2, len = 0;
+        while (i < (size_t)n && (header[i] == ' ' || header[i] == '\t')) i++;
+        while (i < (size_t)n && header[i] != ' ' && header[i] != '\t' &&
+               header[i] != '\n' && len + 1 < size) {
+            out[len++] = header[i++];
+        }
+        out[len] = '\0';
+        return len > 0;
+    }
+
+    if (memcmp(header, ELFMAG, SELFMAG) != 0 || n < (ssize_t)sizeof(Elf64_Ehdr)) {
+        return false;
+    }
+    uint64_t phoff, offset = 0, filesz = 0;
+    unsigned phnum, phentsize;
+    bool elf64 = header[EI_CLASS] == ELFCLASS64;
+    if (elf64) {
+        const Elf64_Ehdr *eh = (const Elf64_Ehdr *)header;
+        phoff = eh->e_phoff;
+        phnum = eh->e_phnum;
+        phentsize = eh->e_phentsize;
+    } else {
+        const Elf32_Ehdr *eh = (const Elf32_Ehdr *)header;
+        phoff = eh->e_phoff;
+        phnum = eh->e_phnum;
+        phentsize = eh->e_phentsize;
+    }
+    if (phentsize < (elf64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) || phnum > 256) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < phnum; i++) {
+        union {
+            Elf64_Phdr p64;
+            Elf32_Phdr p32;
+        } ph;
+        size_t want = elf64 ? sizeof(ph.p64) : sizeof(ph.p32);
+        if (pread(fd, &ph, want, phoff + (uint64_t)i * phentsize) != (ssize_t)want) {
+            return false;
+        }
+        uint32_t type = elf64 ? ph.p64.p_type : ph.p32.p_type;
+        if (type == PT_INTERP) {
+            offset = elf64 ? ph.p64.p_offset : ph.p32.p_offset;
+            filesz = elf64 ? ph.p64.p_filesz : ph.p32.p_filesz;
+            break;
+        }
+    }
+    if (filesz == 0 || filesz >= size) {
+        return false; // Static, or a name too long to be real
+    }
+    if (pread(fd, out, filesz, offset) != (ssize_t)filesz) {
+        return false;
+    }
+    out[filesz] = '\0';
+    return true;
+}
+
+// Start reading the whole file into the page cache, then its interpreter
+static void prefetch_file(const char *path, int depth) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // The kernel caps how much one request reads ahead
+        for (off_t off = 0; off < st.st_size; off += PREFETCH_CHUNK) {
+            posix_fadvise(fd, off, PREFETCH_CHUNK, POSIX_FADV_WILLNEED);
+        }
+        char interp[PATH_MAX];
+        if (depth < PREFETCH_DEPTH && read_interpreter(fd, interp, sizeof(interp))) {
+            close(fd);
+            prefetch_file(interp, depth + 1);
+            return;
+        }
+    }
+    close(fd);
+}
+
+static void *prefetch_task(void *arg) {
+    char *name = arg;
+    char path[PATH_MAX];
+    // Resolving here fills the command cache the spawn will look in
+    if (amcsh_command_path(name, path, sizeof(path)) == 0) {
+        prefetch_file(path, 0);
+    }
+    free(name);
+    return NULL;
+}
+
+void amcsh_prefetch_command(const char *name) {
+    if (enabled < 0) {
+        const char *setting = getenv("AMCSH_PREFETCH");
+        enabled = !(setting && strcmp(setting, "0") == 0);
+    }
+    if (!enabled || !*name || strlen(name) >= PREFETCH_NAME_MAX) {
+        return;
+    }
+    const amcsh_builtin_t *builtin = amcsh_builtin_lookup(name);
+    if (builtin && amcsh_builtin_enabled(builtin)) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    pthread_mutex_lock(&prefetch_lock);
+    for (int i = 0; i < PREFETCH_RECENT; i++) {
+        if (strcmp(recent[i].name, name) == 0 && now - recent[i].when < PREFETCH_TTL) {
+            pthread_mutex_unlock(&prefetch_lock);
+            return;
+        }
+    }
+    recent_t *slot = &recent[recent_next];
+    recent_next = (recent_next + 1) % PREFETCH_RECENT;
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    slot->when = now;
+    pthread_mutex_unlock(&prefetch_lock);
+
+    // Speculation never waits: with every worker busy it is skipped and
+    // forgotten, so the next attempt tries again
+    char *job = strdup(name);
+    if (!job || !amcsh_thread_pool_try_submit(shell_state.thread_pool, prefetch_task, job)) {
+        free(job);
+        pthread_mutex_lock(&prefetch_lock);
+        if (strcmp(slot->name, name) == 0) {
+            slot->name[0] = '\0';
+        }
+        pthread_mutex_unlock(&prefetch_lock);
+    }
+}
+
+// Every external command in a parsed pipeline
+void amcsh_prefetch_pipeline(const amcsh_command_t *cmd) {
+    for (; cmd; cmd = cmd->next) {
+        if (cmd->argc > 0 && !cmd->builtin) {
+            amcsh_prefetch_command(cmd->argv[0]);
+        }
+    }
+}
+
+// Command words of a line still being typed: the first word and each one
+// after a pipe or list operator. Only names the command cache or completion
+// index already knows are worth a worker.
+void amcsh_prefetch_typed(const char *line, size_t len) {
+    bool command = true;
+    char quote = 0;
+    for (size_t i = 0; i < len;) {
+        char c = line[i];
+        if (quote) {
+            quote = c == quote ? 0 : quote;
+            i++;
+            continue;
+        }
+        if (c == '\'' || c == '"' || c == '`') {
+            quote = c;
+            command = false;
+            i++;
+        } else if (c == '|' || c == '&' || c == ';' || c == '(') {
+            command = true;
+            i++;
+        } else if (c == ' ' || c == '\t') {
+            i++;
+        } else {
+            size_t start = i;
+            while (i < len && !strchr(" \t|&;()<>'\"`$\\", line[i])) {
+                i++;
+            }
+            // A word still being typed is only a command once the index knows it
+            bool whole = i == len || !strchr("'\"`$\\", line[i]);
+            if (command && whole && i > start && i - start < PREFETCH_NAME_MAX) {
+                char name[PREFETCH_NAME_MAX];
+                memcpy(name, line + start, i - start);
+                name[i - start] = '\0';
+                if (strchr(name, '=') == NULL &&
+                    (amcsh_cache_contains(name) || amcsh_completion_lookup(name) == 1)) {
+                    amcsh_prefetch_command(name);
+                }
+            }
+            command = false;
+            if (i == start) {
+                i++; // Redirection operator or unquoted special character
+            }
+        }
+    }
+}
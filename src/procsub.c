@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "builtins.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <unistd.h>
+
+// Process substitution and coprocesses. Both start a list in a child
+// connected to this shell by pipes. <(list) and >(list) hand the command a
+// /dev/fd path to the other end of the pipe; the fd is kept open across the
+// exec that starts the command, and the children are waited for once the
+// command is done. coproc keeps both ends of a command's standard streams
+// for later redirections.
+
+#define COPROC_MAX 8
+#define COPROC_NAME_MAX 64
+
+typedef struct {
+    char name[COPROC_NAME_MAX];
+    pid_t pid;
+    int read_fd;           // The coprocess's standard output
+    int write_fd;          // Its standard input
+} coproc_t;
+
+static coproc_t coprocs[COPROC_MAX];
+
+// Child side: run text with standard input and output already in place
+static void run_child(const char *text) {
+    // Builtins use the pipe too, not whatever this shell was capturing
+    amcsh_child_t child;
+    amcsh_child_enter(&child, STDIN_FILENO);
+    amcsh_list_run(text, NULL);
+    amcsh_child_exit(&child, shell_state.exit_status);
+}
+
+// Start body with its output (or, for >( ), its input) on a pipe and return
+// the /dev/fd path of this shell's end, owned by the command's arena
+char *amcsh_procsub_open(amcsh_command_t *cmd, const char *body, size_t len, bool output) {
+    if (cmd->procsub_count == AMCSH_MAX_PROCSUBS) {
+        fprintf(stderr, "amcsh: too many process substitutions\n");
+        return NULL;
+    }
+    char *text = strndup(body, len);
+    int fds[2];
+    if (!text || pipe2(fds, O_CLOEXEC) != 0) {
+        perror("amcsh: pipe");
+        free(text);
+        return NULL;
+    }
+
+    fflush(stdout);
+    amcsh_flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(output ? fds[0] : fds[1], output ? STDIN_FILENO : STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        // Earlier substitutions must see end of file when the command closes them
+        for (int i = 0; i < cmd->procsub_count; i++) {
+            close(cmd->procsub_fds[i]);
+        }
+        run_child(text);
+    }
+    free(text);
+
+    int fd = output ? fds[1] : fds[0];
+    close(output ? fds[0] : fds[1]);
+    if (pid < 0) {
+        perror("amcsh: fork");
+        close(fd);
+        return NULL;
+    }
+
+    cmd->procsub_fds[cmd->procsub_count] = fd;
+    cmd->procsub_pids[cmd->procsub_count] = pid;
+    cmd->procsub_count++;
+
+    char path[32];
+    int n = snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    return amcsh_arena_strndup(&cmd->arena, path, n);
+}
+
+// Close this shell's ends, then wait: a >( ) reader finishes what it was
+// given, a <( ) writer nobody read gets EPIPE
+void amcsh_procsub_close(amcsh_command_t *cmd) {
+    for (int i = 0; i < cmd->procsub_count; i++) {
+        close(cmd->procsub_fds[i]);
+    }
+    for (int i = 0; i < cmd->procsub_count; i++) {
+        if (cmd->procsub_pids[i] > 0) {
+            amcsh_wait_process(cmd->procsub_pids[i], NULL);
+        }
+    }
+    cmd->procsub_count = 0;
+}
+
+// A background command's job includes its substitutions, so they are reaped
+// with it instead of being waited for now
+void amcsh_procsub_job_add(amcsh_command_t *head, pid_t pgid, const pid_t *pids, int count) {
+    int total = count;
+    for (amcsh_command_t *c = head; c; c = c->next) {
+        total += c->procsub_count;
+    }
+    pid_t *all = malloc(total * sizeof(pid_t));
+    if (!all) {
+        amcsh_job_add(pgid, pids, count, head->raw_cmd);
+        return;
+    }
+
+    // The command's own processes stay last: the job's status is the last one's
+    int n = 0;
+    for (amcsh_command_t *c = head; c; c = c->next) {
+        for (int i = 0; i < c->procsub_count; i++) {
+            if (c->procsub_pids[i] > 0) {
+                all[n++] = c->procsub_pids[i];
+                c->procsub_pids[i] = 0;
+            }
+        }
+    }
+    memcpy(all + n, pids, count * sizeof(pid_t));
+    amcsh_job_add(pgid, all, n + count, head->raw_cmd);
+    free(all);
+}
+
+// coproc
+
+static coproc_t *coproc_find(const char *name, bool create) {
+    coproc_t *free_slot = NULL;
+    for (int i = 0; i < COPROC_MAX; i++) {
+        if (coprocs[i].name[0] && strcmp(coprocs[i].name, name) == 0) {
+            return &coprocs[i];
+        }
+        if (!coprocs[i].name[0] && !free_slot) {
+            free_slot = &coprocs[i];
+        }
+    }
+    if (create && free_slot) {
+        snprintf(free_slot->name, sizeof(free_slot->name), "%s", name);
+        free_slot->read_fd = free_slot->write_fd = -1;
+    }
+    return create ? free_slot : NULL;
+}
+
+static void coproc_setenv(const char *name, const char *suffix, int value) {
+    char var[COPROC_NAME_MAX + 8], num[24];
+    snprintf(var, sizeof(var), "%s_%s", name, suffix);
+    if (value < 0) {
+        unsetenv(var);
+        return;
+    }
+    snprintf(num, sizeof(num), "%d", value);
+    setenv(var, num, 1);
+}
+
+// The coprocess's stdin is closed so it sees end of file
+static void coproc_close_input(coproc_t *co) {
+    if (co->write_fd >= 0) {
+        close(co->write_fd);
+        co->write_fd = -1;
+    }
+    coproc_setenv(co->name, "WRITE", -1);
+}
+
+// in and out are the child's ends; ours are closed in a forked child
+static pid_t coproc_start(char **argv, int in, int out, int ours_in, int ours_out) {
+    const amcsh_builtin_t *builtin = amcsh_builtin_lookup(argv[0]);
+    if (builtin && amcsh_builtin_enabled(builtin) && builtin->func) {
+        // Builtins run in a child of their own, like any subshell
+        fflush(stdout);
+        amcsh_flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(in, STDIN_FILENO);
+            dup2(out, STDOUT_FILENO);
+            close(ours_in);
+            close(ours_out);
+            for (int i = 0; i < COPROC_MAX; i++) {
+                if (coprocs[i].name[0] && coprocs[i].write_fd >= 0) close(coprocs[i].write_fd);
+            }
+            amcsh_child_t child;
+            amcsh_child_enter(&child, STDIN_FILENO);
+            amcsh_child_exit(&child, builtin->func(argv));
+        }
+        if (pid < 0) {
+            perror("amcsh: fork");
+        }
+        return pid;
+    }
+
+    char path[PATH_MAX];
+    int err = amcsh_command_path(argv[0], path, sizeof(path));
+    if (err != 0) {
+        fprintf(stderr, "amcsh: coproc: %s: %s\n", argv[0],
+                err == ENOENT ? "command not found" : strerror(err));
+        return -1;
+    }
+    amcsh_spawn_req_t req;
+    amcsh_spawn_req_init(&req, argv);
+    req.path = path;
+    req.fds[STDIN_FILENO] = in;
+    req.fds[STDOUT_FILENO] = out;
+    if (shell_state.interactive) {
+        req.set_pgid = true;
+    }
+    pid_t pid = amcsh_spawn_process(&req, NULL);
+    if (pid < 0) {
+        fprintf(stderr, "amcsh: coproc: %s: %s\n", argv[0], strerror(errno));
+    }
+    return pid;
+}
+
+// coproc [-n NAME] command [arg...] starts command with both standard
+// streams on pipes and sets NAME_PID, NAME_READ and NAME_WRITE (NAME
+// defaults to COPROC); redirect from /dev/fd/$NAME_READ to read what it
+// writes. coproc -c [NAME] closes its input.
+int amcsh_builtin_coproc(char **args) {
+    const char *name = "COPROC";
+    bool named = false, close_input = false;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-n") == 0 && args[i + 1]) {
+            name = args[++i];
+            named = true;
+        } else if (strcmp(args[i], "-c") == 0) {
+            close_input = true;
+        } else {
+            fprintf(stderr, "amcsh: coproc: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+    if (strlen(name) >= COPROC_NAME_MAX) {
+        fprintf(stderr, "amcsh: coproc: %s: name too long\n", name);
+        return 2;
+    }
+
+    if (close_input) {
+        if (args[i] && !named) {
+            name = args[i];
+        }
+        coproc_t *co = coproc_find(name, false);
+        if (!co) {
+            fprintf(stderr, "amcsh: coproc: %s: no such coprocess\n", name);
+            return 1;
+        }
+        coproc_close_input(co);
+        return 0;
+    }
+    if (!args[i]) {
+        fprintf(stderr, "amcsh: coproc: missing command\n");
+        return 2;
+    }
+
+    int to_child[2], from_child[2];
+    if (pipe2(to_child, O_CLOEXEC) != 0) {
+        perror("amcsh: pipe");
+        return 1;
+    }
+    if (pipe2(from_child, O_CLOEXEC) != 0) {
+        perror("amcsh: pipe");
+        close(to_child[0]);
+        close(to_child[1]);
+        return 1;
+    }
+
+    pid_t pid = coproc_start(&args[i], to_child[0], from_child[1], from_child[0], to_child[1]);
+    close(to_child[0]);
+    close(from_child[1]);
+    coproc_t *co = pid > 0 ? coproc_find(name, true) : NULL;
+    if (!co) {
+        if (pid > 0) {
+            fprintf(stderr, "amcsh: coproc: too many coprocesses\n");
+            kill(pid, SIGTERM);
+            amcsh_wait_process(pid, NULL);
+        }
+        close(to_child[1]);
+        close(from_child[0]);
+        return 1;
+    }
+
+    // A new coprocess of the same name replaces the old one's pipes
+    coproc_close_input(co);
+    if (co->read_fd >= 0) {
+        close(co->read_fd);
+    }
+    co->pid = pid;
+    co->read_fd = from_child[0];
+    co->write_fd = to_child[1];
+    coproc_setenv(name, "PID", pid);
+    coproc_setenv(name, "READ", co->read_fd);
+    coproc_setenv(name, "WRITE", co->write_fd);
+
+    // Listed and reaped like any background job
+    size_t len = 0;
+    for (int j = 0; args[j]; j++) len += strlen(args[j]) + 1;
+    char *command = malloc(len + 2);
+    if (command) {
+        char *p = command;
+        for (int j = 0; args[j]; j++) {
+            p += sprintf(p, j ? " %s" : "%s", args[j]);
+        }
+        strcpy(p, "\n");
+    }
+    amcsh_job_add(pid, &pid, 1, command ? command : "coproc\n");
+    free(command);
+    return 0;
+}
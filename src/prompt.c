@@ -0,0 +1,368 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <langinfo.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Prompt built from segments. Cheap segments render synchronously; slow ones
+// run on the thread pool. A slow segment gets AMCSH_PROMPT_DEADLINE_MS to
+// finish before the prompt is drawn from its last value. A late result
+// wakes the line editor, which redraws the prompt in place.
+
+typedef struct {
+    const char *name;
+    bool async;
+    // Segment text for the prompt's directory; false when it has none
+    bool (*compute)(const char *cwd, const char *repo, char *out, size_t size);
+    char text[128];
+    char key[PATH_MAX];    // Directory the text was computed for
+    bool fresh;            // Computed since the last command
+    bool pending;          // Queued or running on the pool
+} segment_t;
+
+static bool segment_git_branch(const char *cwd, const char *repo, char *out, size_t size);
+static bool segment_git_dirty(const char *cwd, const char *repo, char *out, size_t size);
+
+static segment_t segments[] = {
+    {.name = "git", .compute = segment_git_branch},
+    {.name = "dirty", .async = true, .compute = segment_git_dirty},
+};
+
+#define SEGMENT_COUNT ((int)(sizeof(segments) / sizeof(segments[0])))
+
+static pthread_mutex_t prompt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prompt_ready = PTHREAD_COND_INITIALIZER;
+static char cwd[PATH_MAX];
+static char repo[PATH_MAX];          // Work tree holding cwd, or ""
+static int last_status;
+static double last_duration;
+static unsigned generation;          // Bumped whenever the prompt text changes
+static unsigned rendered_generation = ~0u;
+static char rendered[AMCSH_MAX_CMD_LENGTH];
+static int wake_pipe[2] = {-1, -1};
+static const char *arrow = ">";      // "➜" in UTF-8 locales
+
+// Work tree root containing dir: the nearest ancestor with a .git entry
+static void find_repo(const char *dir, char *out, size_t size) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", dir);
+    for (;;) {
+        size_t len = strlen(path);
+        struct stat st;
+        if (len + 6 < sizeof(path)) {
+            strcpy(path + len, len > 1 ? "/.git" : ".git");
+            bool found = lstat(path, &st) == 0;
+            path[len] = '\0';
+            if (found) {
+                snprintf(out, size, "%s", path);
+                return;
+            }
+        }
+        char *slash = strrchr(path, '/');
+        if (!slash || len == 1) {
+            break;
+        }
+        slash[slash == path ? 1 : 0] = '\0';
+    }
+    out[0] = '\0';
+}
+
+// Branch from HEAD, or a short commit id when detached. Worktrees and
+// submodules have a .git file pointing at the real directory.
+static bool segment_git_branch(const char *dir, const char *root, char *out, size_t size) {
+    (void)dir;
+    if (!*root) {
+        return false;
+    }
+
+    char path[PATH_MAX], line[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.git", root);
+    FILE *f = fopen(path, "r"); // A .git directory opens but reads nothing
+    if (f && fgets(line, sizeof(line), f) && strncmp(line, "gitdir: ", 8) == 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[8] == '/') {
+            snprintf(path, sizeof(path), "%s", line + 8);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", root, line + 8);
+        }
+    }
+    if (f) fclose(f);
+
+    size_t len = strlen(path);
+    if (len + 6 > sizeof(path)) {
+        return false;
+    }
+    strcpy(path + len, "/HEAD");
+    f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    bool ok = fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
+
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "ref: refs/heads/", 16) == 0) {
+        snprintf(out, size, "%s", line + 16);
+    } else {
+        snprintf(out, size, "%.7s", line);
+    }
+    return true;
+}
+
+// "*" when tracked files differ from HEAD. This is the slow one in large
+// repositories; --no-optional-locks keeps it off the index lock.
+static bool segment_git_dirty(const char *dir, const char *root, char *out, size_t size) {
+    (void)dir;
+    if (!*root) {
+        return false;
+    }
+
+    char git[PATH_MAX];
+    if (amcsh_spawn_resolve("git", git, sizeof(git)) != 0) {
+        return false;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return false;
+    }
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    char *argv[] = {"git", "--no-optional-locks", "-C", (char *)root, "status",
+                    "--porcelain", "--untracked-files=no", NULL};
+    amcsh_spawn_req_t req;
+    amcsh_spawn_req_init(&req, argv);
+    req.path = git;
+    req.fds[STDIN_FILENO] = null_fd;
+    req.fds[STDOUT_FILENO] = fds[1];
+    req.fds[STDERR_FILENO] = null_fd;
+    pid_t pid = amcsh_spawn_process(&req, NULL);
+    close(fds[1]);
+    if (null_fd >= 0) close(null_fd);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    // Any output at all means dirty; the rest is drained so git can finish
+    char buf[4096];
+    bool dirty = false;
+    ssize_t n;
+    while ((n = read(fds[0], buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno != EINTR) break;
+        if (n > 0) dirty = true;
+    }
+    close(fds[0]);
+
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR);
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        return false;
+    }
+    snprintf(out, size, "%s", dirty ? "*" : "");
+    return true;
+}
+
+static void segment_store(segment_t *seg, const char *dir, bool ok, const char *text) {
+    snprintf(seg->text, sizeof(seg->text), "%s", ok ? text : "");
+    snprintf(seg->key, sizeof(seg->key), "%s", dir);
+    seg->fresh = true;
+    generation++;
+}
+
+typedef struct {
+    segment_t *seg;
+    char cwd[PATH_MAX];
+    char repo[PATH_MAX];
+} segment_job_t;
+
+static void *segment_task(void *arg) {
+    segment_job_t *job = arg;
+    char text[sizeof(job->seg->text)];
+    bool ok = job->seg->compute(job->cwd, job->repo, text, sizeof(text));
+
+    pthread_mutex_lock(&prompt_lock);
+    job->seg->pending = false;
+    // A result for a directory since left is dropped
+    if (strcmp(job->cwd, cwd) == 0) {
+        segment_store(job->seg, job->cwd, ok, text);
+        pthread_cond_broadcast(&prompt_ready);
+        amcsh_prompt_wake();
+    }
+    pthread_mutex_unlock(&prompt_lock);
+    free(job);
+    return NULL;
+}
+
+// Called with prompt_lock held
+static void refresh_cwd(void) {
+    if (!getcwd(cwd, sizeof(cwd))) {
+        snprintf(cwd, sizeof(cwd), "?");
+    }
+    find_repo(cwd, repo, sizeof(repo));
+    generation++;
+}
+
+// libedit decodes the prompt in the current locale and fails on bytes it
+// cannot convert, so the arrow is only used where it can be decoded
+void amcsh_prompt_init(void) {
+    if (strcmp(nl_langinfo(CODESET), "UTF-8") == 0) {
+        arrow = "➜";
+    }
+    if (pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
+    pthread_mutex_lock(&prompt_lock);
+    refresh_cwd();
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+// Readable when a late result wants the prompt or line redrawn
+int amcsh_prompt_wake_fd(void) {
+    return wake_pipe[0];
+}
+
+void amcsh_prompt_wake(void) {
+    if (wake_pipe[1] >= 0 && write(wake_pipe[1], "", 1) < 0) {
+        // Already full: a redraw is pending anyway
+    }
+}
+
+void amcsh_prompt_wake_drain(void) {
+    char buf[64];
+    while (wake_pipe[0] >= 0 && read(wake_pipe[0], buf, sizeof(buf)) > 0);
+}
+
+// cd is the only way the shell changes directory
+void amcsh_prompt_chdir(void) {
+    pthread_mutex_lock(&prompt_lock);
+    refresh_cwd();
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+void amcsh_prompt_command_done(int status, double seconds) {
+    pthread_mutex_lock(&prompt_lock);
+    last_status = status;
+    last_duration = seconds;
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        segments[i].fresh = false;
+    }
+    generation++;
+    pthread_mutex_unlock(&prompt_lock);
+}
+
+// Before each prompt: recompute stale segments, waiting a little for slow ones
+void amcsh_prompt_update(void) {
+    pthread_mutex_lock(&prompt_lock);
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        segment_t *seg = &segments[i];
+        if ((seg->fresh && strcmp(seg->key, cwd) == 0) || seg->pending) {
+            continue;
+        }
+        if (!seg->async) {
+            char text[sizeof(seg->text)];
+            segment_store(seg, cwd, seg->compute(cwd, repo, text, sizeof(text)), text);
+            continue;
+        }
+
+        // Only an idle worker will do; queueing behind another would block us
+        segment_job_t *job = malloc(sizeof(segment_job_t));
+        if (!job) {
+            continue;
+        }
+        job->seg = seg;
+        snprintf(job->cwd, sizeof(job->cwd), "%s", cwd);
+        snprintf(job->repo, sizeof(job->repo), "%s", repo);
+        seg->pending = true;
+        if (!amcsh_thread_pool_try_submit(shell_state.thread_pool, segment_task, job)) {
+            seg->pending = false;
+            free(job);
+        }
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += AMCSH_PROMPT_DEADLINE_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    for (;;) {
+        bool waiting = false;
+        for (int i = 0; i < SEGMENT_COUNT; i++) {
+            waiting |= segments[i].pending;
+        }
+        if (!waiting || pthread_cond_timedwait(&prompt_ready, &prompt_lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&prompt_lock);
+
+    // Results that beat the deadline are drawn now, not redrawn
+    amcsh_prompt_wake_drain();
+}
+
+// Text of a segment for the current directory; stale text from an earlier
+// command in the same directory is shown until the new result arrives
+static const char *segment_text(const char *name) {
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        if (strcmp(segments[i].name, name) == 0) {
+            return strcmp(segments[i].key, cwd) == 0 ? segments[i].text : "";
+        }
+    }
+    return "";
+}
+
+// The prompt string, rebuilt only when something in it changed. Escapes are
+// bracketed by \001 so the line editor leaves them out of its column count.
+const char *amcsh_prompt_render(void) {
+    pthread_mutex_lock(&prompt_lock);
+    if (rendered_generation == generation) {
+        pthread_mutex_unlock(&prompt_lock);
+        return rendered;
+    }
+
+    // Replace home directory with ~, else show the last component
+    char dir[PATH_MAX + 1];
+    const char *home = getenv("HOME");
+    size_t home_len = home ? strlen(home) : 0;
+    if (home_len && strncmp(cwd, home, home_len) == 0 &&
+        (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
+        snprintf(dir, sizeof(dir), "~%s", cwd + home_len);
+    } else {
+        const char *last_dir = strrchr(cwd, '/');
+        snprintf(dir, sizeof(dir), "%s", last_dir && last_dir[1] ? last_dir + 1 : "/");
+    }
+
+    size_t len = snprintf(rendered, sizeof(rendered), "\001\033[1;36m\001%s\001\033[0m\001 ", dir);
+    const char *branch = segment_text("git");
+    if (*branch && len < sizeof(rendered)) {
+        len += snprintf(rendered + len, sizeof(rendered) - len, "\001\033[1;35m\001%s%s\001\033[0m\001 ",
+                        branch, segment_text("dirty"));
+    }
+    // Failures, and durations worth noticing, of the last command
+    if (last_duration >= AMCSH_PROMPT_SHOW_DURATION && len < sizeof(rendered)) {
+        len += snprintf(rendered + len, sizeof(rendered) - len, "\001\033[33m\001%.1fs\001\033[0m\001 ",
+                        last_duration);
+    }
+    if (last_status != 0 && len < sizeof(rendered)) {
+        len += snprintf(rendered + len, sizeof(rendered) - len, "\001\033[1;31m\001%d\001\033[0m\001 ",
+                        last_status);
+    }
+    if (len < sizeof(rendered)) {
+        snprintf(rendered + len, sizeof(rendered) - len, "\001\033[1;32m\001%s\001\033[0m\001 ", arrow);
+    }
+
+    rendered_generation = generation;
+    pthread_mutex_unlock(&prompt_lock);
+    return rendered;
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+int amcsh_redirect_open(const char *path, int flags) {
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        fprintf(stderr, "amcsh: %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Put data in an anonymous in-memory file positioned at offset 0.
+// Unlike a pipe this never blocks on size, and nothing touches the disk.
+int amcsh_memfd_from_buffer(const char *name, const char *data, size_t len) {
+    int fd = -1;
+
+#ifdef MFD_ALLOW_SEALING
+    fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0) {
+        if (write_all(fd, data, len) != 0) {
+            perror("amcsh: here-document");
+            close(fd);
+            return -1;
+        }
+        // The reader gets an immutable snapshot of the body
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+        lseek(fd, 0, SEEK_SET);
+        return fd;
+    }
+#endif
+
+    // Fallback for systems without memfd: an already-unlinked temporary file
+    FILE *tmp = tmpfile();
+    if (tmp) {
+        fd = fcntl(fileno(tmp), F_DUPFD_CLOEXEC, 0);
+        fclose(tmp);
+    }
+    if (fd < 0 || write_all(fd, data, len) != 0) {
+        perror("amcsh: here-document");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    (void)name;
+    return fd;
+}
+
+// Read the bodies of one stage's here-documents and attach the last one as stdin
+static int read_heredocs(amcsh_command_t *cmd, amcsh_line_reader_t reader, void *ctx) {
+    int result = 0;
+
+    for (amcsh_heredoc_t *doc = cmd->heredocs; doc; doc = doc->next) {
+        char *body = NULL;
+        size_t len = 0, cap = 0;
+        size_t delim_len = strlen(doc->delimiter);
+        bool terminated = false;
+
+        const char *line;
+        while (reader && (line = reader(ctx))) {
+            if (doc->strip_tabs) {
+                while (*line == '\t') line++;
+            }
+
+            size_t line_len = strlen(line);
+            size_t text_len = line_len;
+            if (text_len > 0 && line[text_len - 1] == '\n') text_len--;
+
+            if (text_len == delim_len && memcmp(line, doc->delimiter, delim_len) == 0) {
+                terminated = true;
+                break;
+            }
+
+            if (len + text_len + 2 > cap) {
+                cap = cap ? cap * 2 : 4096;
+                while (cap < len + text_len + 2) cap *= 2;
+                body = realloc(body, cap);
+            }
+            memcpy(body + len, line, text_len);
+            len += text_len;
+            body[len++] = '\n';
+        }
+
+        if (!terminated) {
+            fprintf(stderr, "amcsh: warning: here-document delimited by end-of-file (wanted '%s')\n",
+                    doc->delimiter);
+        }
+
+        if (doc->is_stdin) {
+            const char *data = body ? body : "";
+            if (doc->expand && len > 0) {
+                data = amcsh_expand_string(cmd, data, len, &len);
+            }
+            int fd = amcsh_memfd_from_buffer("amcsh-heredoc", data, len);
+            if (fd < 0) {
+                result = -1;
+            } else {
+                cmd->redirect_in = fd;
+            }
+        }
+        free(body);
+    }
+
+    cmd->heredocs = NULL;
+    return result;
+}
+
+// Bodies follow the command line in the order their stages appear
+int amcsh_heredoc_read(amcsh_command_t *cmd, amcsh_line_reader_t reader, void *ctx) {
+    int result = 0;
+    for (amcsh_command_t *stage = cmd; stage; stage = stage->next) {
+        if (read_heredocs(stage, reader, ctx) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// "amcsh --server SOCKET": a warm shell that runs scripts for amcsh-client.
+// Each request is received and forked by a pool worker. The fork inherits
+// the warm command cache, and it gives every request its own working
+// directory, standard streams and exit without touching the server. The
+// main loop reaps finished requests and sends their status back.
+
+typedef struct request {
+    int conn;
+    pid_t pid;
+    bool hung_up;          // Client went away; its processes were signalled
+    struct request *next;
+} request_t;
+
+static pthread_mutex_t requests_lock = PTHREAD_MUTEX_INITIALIZER;
+static request_t *requests;
+static int wake_fd = -1;   // Written after a request is registered
+
+#define SERVER_RECV_TIMEOUT 5    // Seconds a client has to send its request
+#define SERVER_RETRY_MS 10       // Poll interval while every worker is busy
+
+static int server_listen(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "amcsh: --server: %s: path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("amcsh: --server: socket");
+        return -1;
+    }
+
+    // Only the owner may connect
+    mode_t mask = umask(077);
+    int err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (err != 0 && errno == EADDRINUSE) {
+        // A socket nobody answers on is left over from a server that died
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool live = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) close(probe);
+        if (live) {
+            errno = EADDRINUSE;
+        } else if (unlink(path) == 0) {
+            err = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        }
+    }
+    umask(mask);
+
+    if (err != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "amcsh: --server: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Header plus the client's descriptors; false for anything malformed
+static bool receive_request(int conn, amcsh_server_request_t *req, int fds[AMCSH_SERVER_FDS]) {
+    union {
+        char buf[CMSG_SPACE(AMCSH_SERVER_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {req, sizeof(*req)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    int count = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            int received = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < received; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                if (count < AMCSH_SERVER_FDS) {
+                    fds[count++] = fd;
+                } else {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    // The rest of a short header may follow without descriptors
+    bool ok = n > 0 && count == AMCSH_SERVER_FDS && !(msg.msg_flags & MSG_CTRUNC) &&
+              ((size_t)n == sizeof(*req) ||
+               read_full(conn, (char *)req + n, sizeof(*req) - n) == 0) &&
+              req->magic == AMCSH_SERVER_MAGIC && req->length <= AMCSH_SERVER_MAX_SCRIPT;
+    if (!ok) {
+        for (int i = 0; i < count; i++) close(fds[i]);
+    }
+    return ok;
+}
+
+// Runs in the forked child: the client's streams and directory become ours
+static void run_request(char *script, size_t len, int fds[AMCSH_SERVER_FDS]) {
+    // The shell's own handlers were installed before the server started;
+    // entering the child also unblocks the signals the server reads
+    signal(SIGTERM, SIG_DFL);
+    amcsh_child_t child;
+    amcsh_child_enter(&child, -1);
+
+    // A group of its own lets the server stop the whole request, unless it
+    // shares the client's terminal and must stay in the foreground
+    if (!isatty(fds[0])) {
+        setpgid(0, 0);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] != i) {
+            dup2(fds[i], i);
+        }
+    }
+    if (fchdir(fds[3]) != 0) {
+        fprintf(stderr, "amcsh: server: working directory: %s\n", strerror(errno));
+        _exit(126);
+    }
+    for (int i = 0; i < AMCSH_SERVER_FDS; i++) {
+        if (fds[i] > 2) close(fds[i]);
+    }
+
+    FILE *in = fmemopen(script, len, "r");
+    if (in) {
+        amcsh_run_script(in, NULL);
+        fclose(in);
+    }
+    fflush(NULL);
+    amcsh_child_exit(&child, shell_state.exit_status);
+}
+
+static void *handle_connection(void *arg) {
+    int conn = (int)(intptr_t)arg;
+
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+        cred.uid != getuid()) {
+        close(conn);
+        return NULL;
+    }
+
+    amcsh_server_request_t req;
+    int fds[AMCSH_SERVER_FDS];
+    if (!receive_request(conn, &req, fds)) {
+        close(conn);
+        return NULL;
+    }
+
+    char *script = malloc(req.length + 1);
+    request_t *entry = malloc(sizeof(request_t));
+    if (!script || !entry || read_full(conn, script, req.length) != 0) {
+        free(script);
+        free(entry);
+        for (int i = 0; i < AMCSH_SERVER_FDS; i++) close(fds[i]);
+        close(conn);
+        return NULL;
+    }
+    script[req.length] = '\0';
+
+    // Registered before the reaper can see the child exit
+    fflush(NULL);
+    pthread_mutex_lock(&requests_lock);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_request(script, req.length, fds);
+    }
+    if (pid > 0) {
+        entry->conn = conn;
+        entry->pid = pid;
+        entry->hung_up = false;
+        entry->next = requests;
+        requests = entry;
+    }
+    pthread_mutex_unlock(&requests_lock);
+
+    if (pid < 0) {
+        dprintf(fds[2], "amcsh: server: fork: %s\n", strerror(errno));
+        amcsh_server_reply_t reply = {126};
+        if (write(conn, &reply, sizeof(reply)) < 0) {
+            // Client already gone
+        }
+        close(conn);
+        free(entry);
+    } else if (write(wake_fd, "", 1) < 0) {
+        // Pipe full: the main loop is already due to wake
+    }
+    for (int i = 0; i < AMCSH_SERVER_FDS; i++) close(fds[i]);
+    free(script);
+    return NULL;
+}
+
+static void reap_requests(void) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        pthread_mutex_lock(&requests_lock);
+        request_t **link = &requests;
+        while (*link && (*link)->pid != pid) link = &(*link)->next;
+        request_t *done = *link;
+        if (done) *link = done->next;
+        pthread_mutex_unlock(&requests_lock);
+        if (!done) {
+            continue;
+        }
+
+        amcsh_server_reply_t reply = {
+            WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)
+        };
+        if (send(done->conn, &reply, sizeof(reply), MSG_NOSIGNAL) < 0) {
+            // Client already gone
+        }
+        close(done->conn);
+        free(done);
+    }
+}
+
+static void stop_request(request_t *req) {
+    if (kill(-req->pid, SIGTERM) != 0) {
+        kill(req->pid, SIGTERM);
+    }
+    req->hung_up = true;
+}
+
+int amcsh_server_run(const char *path) {
+    int listener = server_listen(path);
+    if (listener < 0) {
+        return 1;
+    }
+
+    // Signals arrive as reads on the main loop; workers inherit the mask
+    sigset_t server_signals;
+    sigemptyset(&server_signals);
+    sigaddset(&server_signals, SIGCHLD);
+    sigaddset(&server_signals, SIGINT);
+    sigaddset(&server_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &server_signals, NULL);
+    int signal_fd = signalfd(-1, &server_signals, SFD_CLOEXEC);
+
+    int wake[2];
+    if (signal_fd < 0 || pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("amcsh: --server");
+        close(listener);
+        return 1;
+    }
+    wake_fd = wake[1];
+
+    // Requests share what they resolve through the host-wide cache
+    setenv("AMCSH_SHARED_CACHE", "1", 0);
+
+    amcsh_thread_pool_t pool;
+    amcsh_thread_pool_init(&pool, amcsh_current_state);
+
+    struct pollfd *polls = NULL;
+    request_t **polled = NULL;
+    size_t poll_capacity = 0;
+    int pending = -1;          // Accepted, waiting for an idle worker
+    bool running = true;
+    while (running) {
+        // Listener, signals and wakeups, then every client still connected
+        pthread_mutex_lock(&requests_lock);
+        size_t count = 3;
+        for (request_t *r = requests; r; r = r->next) count++;
+        if (count > poll_capacity) {
+            poll_capacity = count * 2;
+            polls = realloc(polls, poll_capacity * sizeof(struct pollfd));
+            polled = realloc(polled, poll_capacity * sizeof(request_t *));
+        }
+        // With a connection pending, later ones wait in the listen backlog
+        polls[0] = (struct pollfd){pending < 0 ? listener : -1, POLLIN, 0};
+        polls[1] = (struct pollfd){signal_fd, POLLIN, 0};
+        polls[2] = (struct pollfd){wake[0], POLLIN, 0};
+        count = 3;
+        for (request_t *r = requests; r; r = r->next) {
+            if (!r->hung_up) {
+                polled[count] = r;
+                polls[count++] = (struct pollfd){r->conn, POLLRDHUP, 0};
+            }
+        }
+        pthread_mutex_unlock(&requests_lock);
+
+        if (poll(polls, count, pending < 0 ? -1 : SERVER_RETRY_MS) < 0) {
+            if (errno == EINTR) continue;
+            perror("amcsh: --server: poll");
+            break;
+        }
+
+        // Hung-up clients first: only this thread frees requests, in the reaper
+        for (size_t i = 3; i < count; i++) {
+            if (polls[i].revents & (POLLRDHUP | POLLHUP | POLLERR)) {
+                stop_request(polled[i]);
+            }
+        }
+
+        struct signalfd_siginfo info;
+        if ((polls[1].revents & POLLIN) && read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGCHLD) {
+                reap_requests();
+            } else {
+                running = false;
+            }
+        }
+        if (polls[2].revents & POLLIN) {
+            char drain[64];
+            while (read(wake[0], drain, sizeof(drain)) > 0);
+        }
+
+        if (running && pending < 0 && (polls[0].revents & POLLIN)) {
+            pending = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+            // A client that connects and then stalls only holds its worker briefly
+            struct timeval timeout = {SERVER_RECV_TIMEOUT, 0};
+            if (pending >= 0) {
+                setsockopt(pending, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            }
+        }
+        // Receiving blocks, so it never runs inline on this loop
+        if (pending >= 0 &&
+            amcsh_thread_pool_try_submit(&pool, handle_connection, (void *)(intptr_t)pending)) {
+            pending = -1;
+        }
+    }
+
+    // Requests still running are stopped and answered before exiting
+    close(listener);
+    if (pending >= 0) close(pending);
+    unlink(path);
+    amcsh_thread_pool_shutdown(&pool);
+    pthread_mutex_lock(&requests_lock);
+    for (request_t *r = requests; r; r = r->next) stop_request(r);
+    pthread_mutex_unlock(&requests_lock);
+    while (requests) {
+        siginfo_t ignored;
+        if (waitid(P_ALL, 0, &ignored, WEXITED | WNOWAIT) != 0 && errno == ECHILD) break;
+        reap_requests();
+    }
+
+    free(polls);
+    free(polled);
+    close(wake[0]);
+    close(wake[1]);
+    close(signal_fd);
+    return 0;
+}
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Host-wide command resolution cache shared by every amcsh of one user,
+// in a /dev/shm mapping. Each slot is a seqlock: writers make the sequence
+// odd while they copy, readers retry when it moved under them. Nothing ever
+// blocks, so a shell killed mid-write only costs that slot.
+
+#define SHM_MAGIC 0x616d637368636332ull  // "amcshcc2": bump when the layout changes
+#define SHM_SLOTS 2048                   // Power of two
+#define SHM_PROBE 4                      // Slots tried per key
+#define SHM_NAME_MAX 64
+#define SHM_PATH_MAX 240
+
+typedef struct {
+    atomic_uint seq;           // Odd while a writer is copying
+    uint32_t name_len;
+    uint64_t key;              // Hash of (PATH, name)
+    uint64_t dirs;             // PATH directories searched up to the hit, as
+                               // they were when the entry was stored
+    char name[SHM_NAME_MAX];
+    char path[SHM_PATH_MAX];
+} shm_slot_t;
+
+typedef struct {
+    atomic_ullong magic;
+    uint64_t slots;
+    shm_slot_t slot[SHM_SLOTS];
+} shm_table_t;
+
+static shm_table_t *table;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static uint64_t hash_bytes(uint64_t hash, const char *data, size_t len) {
+    // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static uint64_t entry_key(const char *name, size_t len) {
+    const char *search = getenv("PATH");
+    uint64_t hash = 0xcbf29ce484222325ull;
+    if (search) {
+        hash = hash_bytes(hash, search, strlen(search));
+    }
+    hash = hash_bytes(hash, "\0", 1);
+    return hash_bytes(hash, name, len);
+}
+
+// Opt-in with AMCSH_SHARED_CACHE=1; the mapping is per user and 0600
+static void table_open(void) {
+    const char *enabled = getenv("AMCSH_SHARED_CACHE");
+    if (!enabled || !*enabled || strcmp(enabled, "0") == 0) {
+        return;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "/amcsh-cache.%u", (unsigned)getuid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+
+    // Another user's object under our name is never trusted
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_uid != getuid() || (st.st_mode & 077)) {
+        close(fd);
+        return;
+    }
+    // The first shell sizes it; the new pages read as zeros, i.e. empty slots
+    if (st.st_size < (off_t)sizeof(shm_table_t) && ftruncate(fd, sizeof(shm_table_t)) != 0) {
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, sizeof(shm_table_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    shm_table_t *shared = map;
+    unsigned long long expected = 0;
+    if (!atomic_compare_exchange_strong(&shared->magic, &expected, SHM_MAGIC) &&
+        expected != SHM_MAGIC) {
+        munmap(map, sizeof(shm_table_t)); // Left behind by an incompatible build
+        return;
+    }
+    table = shared;
+}
+
+static bool table_ready(void) {
+    pthread_once(&table_once, table_open);
+    return table != NULL;
+}
+
+// Hash the dev, inode and mtime of every PATH directory up to the one path
+// is in: a command added to an earlier directory changes it, as does
+// creating a directory that was missing. False if path's directory is not
+// on PATH.
+static bool dirs_fingerprint(const char *path, uint64_t *out) {
+    const char *slash = strrchr(path, '/');
+    const char *search = getenv("PATH");
+    if (!slash || !search) {
+        return false;
+    }
+    size_t found_len = slash == path ? 1 : (size_t)(slash - path);
+    while (found_len > 1 && path[found_len - 1] == '/') found_len--;
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char *entry = search;; entry++) {
+        size_t len = strcspn(entry, ":");
+        size_t trimmed = len;
+        while (trimmed > 1 && entry[trimmed - 1] == '/') trimmed--;
+
+        char dir[SHM_PATH_MAX];
+        if (len >= sizeof(dir)) {
+            return false;
+        }
+        memcpy(dir, entry, len);
+        dir[len] = '\0';
+        struct stat st;
+        int64_t stamp[3] = {0, 0, -1}; // A missing directory has its own value
+        if (stat(len ? dir : ".", &st) == 0) {
+            stamp[0] = (int64_t)st.st_dev;
+            stamp[1] = (int64_t)st.st_ino;
+            stamp[2] = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        }
+        hash = hash_bytes(hash, (const char *)stamp, sizeof(stamp));
+
+        if (trimmed == found_len && memcmp(entry, path, found_len) == 0) {
+            *out = hash;
+            return true;
+        }
+        entry += len;
+        if (*entry == '\0') {
+            return false;
+        }
+    }
+}
+
+// Copy a slot out under its seqlock; false if it is being written
+static bool slot_read(shm_slot_t *slot, shm_slot_t *copy) {
+    for (int attempt = 0; attempt < 4; attempt++) {
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy((char *)copy + sizeof(copy->seq), (char *)slot + sizeof(slot->seq),
+               sizeof(shm_slot_t) - sizeof(slot->seq));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Path for name found by an earlier shell with the same PATH, provided no
+// directory searched up to the hit has changed since
+int amcsh_shm_cache_lookup(const char *name, char *path, size_t size) {
+    size_t len = strlen(name);
+    if (len >= SHM_NAME_MAX || !table_ready()) {
+        return -1;
+    }
+
+    uint64_t key = entry_key(name, len);
+    for (int i = 0; i < SHM_PROBE; i++) {
+        shm_slot_t copy;
+        if (!slot_read(&table->slot[(key + i) & (SHM_SLOTS - 1)], &copy)) {
+            continue;
+        }
+        if (copy.key != key || copy.name_len != len || memcmp(copy.name, name, len) != 0) {
+            continue;
+        }
+
+        copy.path[SHM_PATH_MAX - 1] = '\0';
+        uint64_t dirs;
+        size_t path_len = strlen(copy.path);
+        if (path_len >= size || !dirs_fingerprint(copy.path, &dirs) || dirs != copy.dirs) {
+            return -1;
+        }
+        memcpy(path, copy.path, path_len + 1);
+        return 0;
+    }
+    return -1;
+}
+
+// Publish a PATH search result. Relative results depend on the working
+// directory and are kept out.
+void amcsh_shm_cache_store(const char *name, const char *path) {
+    size_t len = strlen(name);
+    size_t path_len = strlen(path);
+    if (len >= SHM_NAME_MAX || path_len >= SHM_PATH_MAX || path[0] != '/' || !table_ready()) {
+        return;
+    }
+    uint64_t dirs;
+    if (!dirs_fingerprint(path, &dirs)) {
+        return;
+    }
+
+    // Reuse the key's own slot, else an empty one, else evict the first
+    uint64_t key = entry_key(name, len);
+    shm_slot_t *slot = NULL;
+    for (int i = 0; i < SHM_PROBE && !slot; i++) {
+        shm_slot_t *candidate = &table->slot[(key + i) & (SHM_SLOTS - 1)];
+        shm_slot_t copy;
+        if (slot_read(candidate, &copy) && (copy.key == key || copy.key == 0)) {
+            slot = candidate;
+        }
+    }
+    if (!slot) {
+        slot = &table->slot[key & (SHM_SLOTS - 1)];
+    }
+
+    // Another writer owns the slot: its result is as good as ours
+    unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+    if ((seq & 1) || !atomic_compare_exchange_strong_explicit(&slot->seq, &seq, seq + 1,
+                                                              memory_order_acquire,
+                                                              memory_order_relaxed)) {
+        return;
+    }
+    atomic_thread_fence(memory_order_release);
+
+    slot->key = key;
+    slot->name_len = (uint32_t)len;
+    slot->dirs = dirs;
+    memcpy(slot->name, name, len);
+    memcpy(slot->path, path, path_len + 1);
+
+    atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
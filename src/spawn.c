@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sched.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define CLONE_STACK_SIZE (64 * 1024)
+
+static amcsh_spawn_backend_t spawn_backend = AMCSH_SPAWN_POSIX;
+
+static const char *backend_names[] = {
+    [AMCSH_SPAWN_POSIX] = "posix",
+    [AMCSH_SPAWN_VFORK] = "vfork",
+    [AMCSH_SPAWN_CLONE] = "clone",
+};
+
+// Signals the shell catches; children start with the default action
+static const int child_default_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD, SIGPIPE
+};
+
+int amcsh_spawn_backend_parse(const char *name, amcsh_spawn_backend_t *backend) {
+    for (int i = 0; i < AMCSH_SPAWN_BACKEND_COUNT; i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            *backend = (amcsh_spawn_backend_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *amcsh_spawn_backend_name(amcsh_spawn_backend_t backend) {
+    return backend_names[backend];
+}
+
+void amcsh_spawn_set_backend(amcsh_spawn_backend_t backend) {
+    spawn_backend = backend;
+}
+
+amcsh_spawn_backend_t amcsh_spawn_get_backend(void) {
+    return spawn_backend;
+}
+
+// AMCSH_SPAWN=posix|vfork|clone picks the backend at startup
+void amcsh_spawn_init(void) {
+    const char *name = getenv("AMCSH_SPAWN");
+    if (name && *name && amcsh_spawn_backend_parse(name, &spawn_backend) != 0) {
+        fprintf(stderr, "amcsh: AMCSH_SPAWN: unknown backend '%s'\n", name);
+    }
+}
+
+void amcsh_spawn_req_init(amcsh_spawn_req_t *req, char **argv) {
+    memset(req, 0, sizeof(*req));
+    req->argv = argv;
+    req->envp = environ;
+    req->fds[0] = req->fds[1] = req->fds[2] = -1;
+    req->close_from = 3;
+}
+
+// Find name on PATH the way execvp would; names with a slash are used as is
+int amcsh_spawn_resolve(const char *name, char *path, size_t size) {
+    if (strchr(name, '/')) {
+        if (strlen(name) >= size) {
+            return ENAMETOOLONG;
+        }
+        strcpy(path, name);
+        return 0;
+    }
+
+    const char *search = getenv("PATH");
+    if (!search) {
+        search = "/usr/local/bin:/usr/bin:/bin";
+    }
+
+    int err = ENOENT;
+    size_t name_len = strlen(name);
+    while (*search) {
+        const char *end = strchr(search, ':');
+        size_t dir_len = end ? (size_t)(end - search) : strlen(search);
+
+        // An empty PATH element means the current directory
+        const char *dir = dir_len ? search : ".";
+        size_t len = dir_len ? dir_len : 1;
+        if (len + name_len + 2 <= size) {
+            memcpy(path, dir, len);
+            path[len] = '/';
+            memcpy(path + len + 1, name, name_len + 1);
+            if (access(path, X_OK) == 0) {
+                return 0;
+            }
+            if (errno == EACCES) {
+                err = EACCES;
+            }
+        }
+
+        search += dir_len;
+        if (*search == ':') search++;
+    }
+    return err;
+}
+
+// Close [from, ~0U) except the fds req passes through; async-signal-safe
+static void close_except(const amcsh_spawn_req_t *req) {
+#ifdef SYS_close_range
+    unsigned from = req->close_from;
+    for (;;) {
+        unsigned next = ~0U;
+        for (int i = 0; i < req->inherit_count; i++) {
+            if ((unsigned)req->inherit[i] >= from && (unsigned)req->inherit[i] < next) {
+                next = req->inherit[i];
+            }
+        }
+        if (next > from) {
+            syscall(SYS_close_range, from, next - 1, 0);
+        }
+        if (next == ~0U) {
+            break;
+        }
+        from = next + 1;
+    }
+#else
+    (void)req;
+#endif
+}
+
+static bool needs_child_setup(const amcsh_spawn_req_t *req) {
+    const amcsh_spawn_attr_t *attr = req->attr;
+    return attr && (attr->has_affinity || attr->has_nice || attr->rlimit_count > 0);
+}
+
+// Runs in the child between clone and exec. Only async-signal-safe calls:
+// the child shares the parent's memory until it execs.
+static int child_setup(const amcsh_spawn_req_t *req) {
+    struct sigaction dfl;
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++) {
+        sigaction(child_default_signals[i], &dfl, NULL);
+    }
+
+    if (req->set_pgid && setpgid(0, req->pgid) != 0) {
+        return -1;
+    }
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (req->fds[fd] >= 0 && req->fds[fd] != fd && dup2(req->fds[fd], fd) < 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < req->inherit_count; i++) {
+        fcntl(req->inherit[i], F_SETFD, 0);
+    }
+    if (req->close_from > 0) {
+        close_except(req);
+    }
+
+    const amcsh_spawn_attr_t *attr = req->attr;
+    if (attr) {
+        if (attr->has_affinity &&
+            sched_setaffinity(0, sizeof(attr->affinity), (const cpu_set_t *)attr->affinity) != 0) {
+            return -1;
+        }
+        if (attr->has_nice && setpriority(PRIO_PROCESS, 0, attr->nice) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < attr->rlimit_count; i++) {
+            if (setrlimit(attr->rlimits[i].resource, &attr->rlimits[i].limit) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    // Start from an empty mask, not the calling thread's: workers and
+    // builtins block SIGINT and SIGPIPE for themselves only
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    return 0;
+}
+
+typedef struct {
+    const amcsh_spawn_req_t *req;
+    volatile int err;      // Written by the child; the parent is suspended until exec
+} child_args_t;
+
+static int child_main(void *arg) {
+    child_args_t *args = arg;
+    if (child_setup(args->req) == 0) {
+        execve(args->req->path, args->req->argv, args->req->envp);
+    }
+    args->err = errno;
+    _exit(127);
+}
+
+// Reap a child whose exec failed and report why
+static pid_t spawn_failed(pid_t pid, int err) {
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR);
+    errno = err;
+    return -1;
+}
+
+static pid_t spawn_vfork(const amcsh_spawn_req_t *req, int *pidfd) {
+    // No handler may run in the child while it borrows our memory
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    child_args_t args = {req, 0};
+    pid_t pid = vfork();
+    if (pid == 0) {
+        child_main(&args);
+    }
+    int err = pid < 0 ? errno : args.err;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (pid < 0) {
+        errno = err;
+        return -1;
+    }
+    if (err) {
+        return spawn_failed(pid, err);
+    }
+    (void)pidfd;
+    return pid;
+}
+
+static pid_t spawn_clone(const amcsh_spawn_req_t *req, int *pidfd) {
+    // The child runs on its own small stack until exec; one per thread
+    static __thread char *stack = NULL;
+    if (!stack && !(stack = malloc(CLONE_STACK_SIZE))) {
+        return -1;
+    }
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    child_args_t args = {req, 0};
+    int fd = -1;
+    int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+#ifdef CLONE_PIDFD
+    flags |= CLONE_PIDFD;
+#endif
+    pid_t pid = clone(child_main, stack + CLONE_STACK_SIZE, flags, &args, &fd);
+    int err = pid < 0 ? errno : args.err;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+#ifdef CLONE_PIDFD
+    if (pid < 0 && err == EINVAL) {
+        // Kernels before 5.2 reject CLONE_PIDFD
+        pthread_sigmask(SIG_SETMASK, &all, NULL);
+        pid = clone(child_main, stack + CLONE_STACK_SIZE, flags & ~CLONE_PIDFD, &args, NULL);
+        err = pid < 0 ? errno : args.err;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+#endif
+
+    if (pid < 0) {
+        errno = err;
+        return -1;
+    }
+    if (err) {
+        if (fd >= 0) close(fd);
+        return spawn_failed(pid, err);
+    }
+    if (pidfd) {
+        *pidfd = fd;
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    return pid;
+}
+
+static pid_t spawn_posix(const amcsh_spawn_req_t *req) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (int fd = 0; fd < 3; fd++) {
+        if (req->fds[fd] >= 0 && req->fds[fd] != fd) {
+            posix_spawn_file_actions_adddup2(&actions, req->fds[fd], fd);
+        }
+    }
+    // dup2 onto itself clears close-on-exec; everything below the highest
+    // inherited fd is left to close-on-exec instead of closefrom
+    int close_from = req->close_from;
+    for (int i = 0; i < req->inherit_count; i++) {
+        posix_spawn_file_actions_adddup2(&actions, req->inherit[i], req->inherit[i]);
+        if (close_from > 0 && req->inherit[i] >= close_from) {
+            close_from = req->inherit[i] + 1;
+        }
+    }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+    if (close_from > 0) {
+        posix_spawn_file_actions_addclosefrom_np(&actions, close_from);
+    }
+#endif
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++) {
+        sigaddset(&defaults, child_default_signals[i]);
+    }
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    if (req->set_pgid) {
+        posix_spawnattr_setpgroup(&attr, req->pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int status = posix_spawn(&pid, req->path, &actions, &attr, req->argv, req->envp);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (status != 0) {
+        errno = status;
+        return -1;
+    }
+    return pid;
+}
+
+// Start req->path. Returns the pid, or -1 with errno set when the program
+// could not be started. With pidfd non-NULL a pidfd is returned when available.
+pid_t amcsh_spawn_process(const amcsh_spawn_req_t *req, int *pidfd) {
+    amcsh_spawn_backend_t backend = spawn_backend;
+    pid_t pid;
+
+    if (pidfd) {
+        *pidfd = -1;
+    }
+
+    // posix_spawn has no hook for affinity, priority or limits
+    if (backend == AMCSH_SPAWN_POSIX && needs_child_setup(req)) {
+        backend = AMCSH_SPAWN_VFORK;
+    }
+
+    switch (backend) {
+        case AMCSH_SPAWN_VFORK:
+            pid = spawn_vfork(req, pidfd);
+            break;
+        case AMCSH_SPAWN_CLONE:
+            pid = spawn_clone(req, pidfd);
+            break;
+        default:
+            pid = spawn_posix(req);
+            break;
+    }
+
+#ifdef SYS_pidfd_open
+    if (pid > 0 && pidfd && *pidfd < 0) {
+        *pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    }
+#endif
+    return pid;
+}
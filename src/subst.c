@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define SUBST_INITIAL_CAPACITY 65536
+#define SUBST_PIPE_SIZE (1 << 20)
+
+static int open_pipe(int fds[2]) {
+#ifdef __linux__
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+#ifdef F_SETPIPE_SZ
+    // A larger pipe means fewer wakeups while the child writes
+    fcntl(fds[0], F_SETPIPE_SZ, SUBST_PIPE_SIZE);
+#endif
+#else
+    if (pipe(fds) != 0) {
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+    return 0;
+}
+
+// Drain fd into a growable buffer using large reads; always NUL-terminable
+static char *read_all(int fd, size_t capacity, size_t *out_len) {
+    char *buf = malloc(capacity);
+    size_t len = 0;
+
+    while (buf) {
+        if (capacity - len < 4096) {
+            capacity *= 2;
+            char *grown = realloc(buf, capacity);
+            if (!grown) {
+                break;
+            }
+            buf = grown;
+        }
+
+        ssize_t n = read(fd, buf + len, capacity - len - 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+
+    *out_len = len;
+    return buf;
+}
+
+static char *capture_file(const char *path, size_t *out_len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "amcsh: %s: %s\n", path, strerror(errno));
+        shell_state.exit_status = 1;
+        return NULL;
+    }
+
+    // Size the buffer from the file so regular files take a single read
+    struct stat st;
+    size_t capacity = SUBST_INITIAL_CAPACITY;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        capacity = (size_t)st.st_size + 4096;
+    }
+
+    char *buf = read_all(fd, capacity, out_len);
+    close(fd);
+    shell_state.exit_status = 0;
+    return buf;
+}
+
+// Builtins that leave shell state untouched run in-process with output kept in memory
+static char *capture_builtin(amcsh_command_t *cmd, size_t *out_len) {
+    amcsh_output_t capture;
+    amcsh_output_init(&capture, -1, NULL, 0);
+
+    amcsh_io_t saved;
+    amcsh_io_enter(&capture, -1, &saved);
+    amcsh_execute_builtin(cmd);
+    amcsh_io_leave(&saved);
+
+    return amcsh_output_take(&capture, out_len);
+}
+
+static char *capture_child(amcsh_command_t *cmd, size_t *out_len) {
+    int fds[2];
+    if (open_pipe(fds) != 0) {
+        perror("amcsh: pipe");
+        return NULL;
+    }
+
+    pid_t pid;
+    if (cmd->builtin || cmd->next || cmd->group) {
+        // Builtins such as cd or exit must not affect this shell, and a
+        // pipeline's stages must keep running while we drain the pipe
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            amcsh_child_t child;
+            amcsh_child_enter(&child, -1);
+            amcsh_command_t *last = cmd;
+            while (last->next) last = last->next;
+            last->pipe_write = fds[1];
+            amcsh_execute(cmd);
+            amcsh_child_exit(&child, shell_state.exit_status);
+        }
+        close(fds[1]);
+    } else {
+        cmd->pipe_write = fds[1];
+        pid = amcsh_spawn(cmd);
+    }
+
+    if (pid < 0) {
+        close(fds[0]);
+        return NULL;
+    }
+
+    char *buf = read_all(fds[0], SUBST_INITIAL_CAPACITY, out_len);
+    close(fds[0]);
+
+    shell_state.exit_status = amcsh_wait_process(pid, NULL); // 1 if it cannot be waited for
+    return buf;
+}
+
+// A list runs in a child whose standard output is the pipe
+static char *capture_list(const char *script, size_t *out_len) {
+    int fds[2];
+    if (open_pipe(fds) != 0) {
+        perror("amcsh: pipe");
+        return NULL;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        // Builtins write to the pipe too, not to a capture this shell was in
+        amcsh_child_t child;
+        amcsh_child_enter(&child, -1);
+        amcsh_list_run(script, NULL);
+        amcsh_child_exit(&child, shell_state.exit_status);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        perror("amcsh: fork");
+        close(fds[0]);
+        return NULL;
+    }
+
+    char *buf = read_all(fds[0], SUBST_INITIAL_CAPACITY, out_len);
+    close(fds[0]);
+
+    shell_state.exit_status = amcsh_wait_process(pid, NULL); // 1 if it cannot be waited for
+    return buf;
+}
+
+char *amcsh_subst_capture(const char *body, size_t len, amcsh_arena_t *arena, size_t *out_len) {
+    char *script = malloc(len + 1);
+    memcpy(script, body, len);
+    script[len] = '\0';
+
+    const char *start = script;
+    while (isspace((unsigned char)*start)) start++;
+
+    char *out = NULL;
+    size_t n = 0;
+    if (amcsh_list_needed(script)) {
+        out = capture_list(script, &n);
+        free(script);
+        goto done;
+    }
+
+    amcsh_command_t cmd;
+    amcsh_command_init(&cmd, *start == '<' ? (char *)start + 1 : script);
+    amcsh_parse_command(&cmd);
+
+    if (*start == '<') {
+        // $(< file) only: a group after < names no file
+        if (cmd.argc > 0 && !cmd.group) {
+            out = capture_file(cmd.argv[0], &n);
+        }
+    } else if (cmd.argc > 0 || cmd.group) {
+        if (cmd.builtin && (cmd.builtin->flags & AMCSH_BUILTIN_PURE) && !cmd.next &&
+            !cmd.err_to_out) {
+            out = capture_builtin(&cmd, &n);
+        } else {
+            out = capture_child(&cmd, &n);
+        }
+    }
+
+    amcsh_command_free(&cmd);
+    free(script);
+
+done:
+    if (!out) {
+        out = malloc(1);
+        n = 0;
+    }
+
+    // Trailing newlines are dropped by shortening the string in place
+    while (n > 0 && out[n - 1] == '\n') n--;
+    out[n] = '\0';
+
+    amcsh_arena_adopt(arena, out);
+    *out_len = n;
+    return out;
+}
@@ -4,6 +4,13 @@
 
 static void *worker_thread(void *arg) {
     amcsh_worker_t *worker = (amcsh_worker_t *)arg;
+    amcsh_current_state = worker->thread_pool->owner;
+
+    // SIGINT goes to the shell thread, which may be the one it must interrupt
+    sigset_t interrupt;
+    sigemptyset(&interrupt);
+    sigaddset(&interrupt, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &interrupt, NULL);
     
     while (1) {
         // Wait for work
@@ -13,7 +20,8 @@ static void *worker_thread(void *arg) {
                             &worker->thread_pool->queue_mutex);
         }
         
-        if (worker->thread_pool->shutdown) {
+        // A task assigned before shutdown still runs, so the join waits for it
+        if (!worker->active) {
             pthread_mutex_unlock(&worker->thread_pool->queue_mutex);
             break;
         }
@@ -22,29 +30,45 @@ static void *worker_thread(void *arg) {
         void *(*task)(void *) = worker->task;
         void *task_arg = worker->args;
         worker->active = false;
+        worker->busy = true;
         
         pthread_mutex_unlock(&worker->thread_pool->queue_mutex);
         
         if (task) {
             task(task_arg);
         }
+
+        pthread_mutex_lock(&worker->thread_pool->queue_mutex);
+        worker->busy = false;
+        pthread_mutex_unlock(&worker->thread_pool->queue_mutex);
     }
     
     return NULL;
 }
 
-void amcsh_thread_pool_init(amcsh_thread_pool_t *pool) {
+// Threads are created when a task first needs them, so scripts that never
+// use the pool never pay for it. Called with queue_mutex held.
+static bool start_worker(amcsh_worker_t *worker) {
+    if (!worker->started) {
+        worker->started = pthread_create(&worker->thread, NULL, worker_thread, worker) == 0;
+    }
+    return worker->started;
+}
+
+void amcsh_thread_pool_init(amcsh_thread_pool_t *pool, struct amcsh_state *owner) {
     pthread_mutex_init(&pool->queue_mutex, NULL);
     pthread_cond_init(&pool->queue_cond, NULL);
     pool->shutdown = false;
+    pool->owner = owner;
     
     // Initialize workers
     for (int i = 0; i < AMCSH_MAX_THREADS; i++) {
         pool->workers[i].active = false;
+        pool->workers[i].busy = false;
+        pool->workers[i].started = false;
         pool->workers[i].task = NULL;
         pool->workers[i].args = NULL;
         pool->workers[i].thread_pool = pool;
-        pthread_create(&pool->workers[i].thread, NULL, worker_thread, &pool->workers[i]);
     }
 }
 
@@ -53,11 +77,12 @@ void amcsh_thread_pool_submit(amcsh_thread_pool_t *pool, void *(*task)(void *),
     
     // Find an inactive worker
     for (int i = 0; i < AMCSH_MAX_THREADS; i++) {
-        if (!pool->workers[i].active) {
+        if (!pool->workers[i].active && start_worker(&pool->workers[i])) {
             pool->workers[i].task = task;
             pool->workers[i].args = args;
             pool->workers[i].active = true;
-            pthread_cond_signal(&pool->queue_cond);
+            // Every worker shares the condition, so wake them all to reach this one
+            pthread_cond_broadcast(&pool->queue_cond);
             pthread_mutex_unlock(&pool->queue_mutex);
             return;
         }
@@ -68,6 +93,29 @@ void amcsh_thread_pool_submit(amcsh_thread_pool_t *pool, void *(*task)(void *),
     task(args);
 }
 
+// Hand a task to an idle worker only. Tasks that may block on each other
+// (pipeline stages) must not queue behind a running task or run inline.
+bool amcsh_thread_pool_try_submit(amcsh_thread_pool_t *pool, void *(*task)(void *), void *args) {
+    if (!pool) {
+        return false;
+    }
+
+    pthread_mutex_lock(&pool->queue_mutex);
+    for (int i = 0; i < AMCSH_MAX_THREADS; i++) {
+        if (!pool->workers[i].active && !pool->workers[i].busy &&
+            start_worker(&pool->workers[i])) {
+            pool->workers[i].task = task;
+            pool->workers[i].args = args;
+            pool->workers[i].active = true;
+            pthread_cond_broadcast(&pool->queue_cond);
+            pthread_mutex_unlock(&pool->queue_mutex);
+            return true;
+        }
+    }
+    pthread_mutex_unlock(&pool->queue_mutex);
+    return false;
+}
+
 void amcsh_thread_pool_shutdown(amcsh_thread_pool_t *pool) {
     pthread_mutex_lock(&pool->queue_mutex);
     pool->shutdown = true;
@@ -76,7 +124,9 @@ void amcsh_thread_pool_shutdown(amcsh_thread_pool_t *pool) {
     
     // Wait for all threads to finish
     for (int i = 0; i < AMCSH_MAX_THREADS; i++) {
-        pthread_join(pool->workers[i].thread, NULL);
+        if (pool->workers[i].started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
     }
     
     pthread_mutex_destroy(&pool->queue_mutex);
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include "amcsh.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// Log-linear buckets: values below 2^SUB_BITS are exact, above that every
+// power of two is split into 2^SUB_BITS linear steps (at most 6% error)
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKET_COUNT ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+typedef struct {
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t min;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t buckets[BUCKET_COUNT];
+} histogram_t;
+
+static histogram_t histograms[AMCSH_PHASE_COUNT];
+static pid_t trace_pid;
+
+static const char *phase_names[AMCSH_PHASE_COUNT] = {
+    [AMCSH_PHASE_READ] = "read",
+    [AMCSH_PHASE_PARSE] = "parse",
+    [AMCSH_PHASE_LOOKUP] = "lookup",
+    [AMCSH_PHASE_CACHE] = "cache",
+    [AMCSH_PHASE_SPAWN] = "spawn",
+    [AMCSH_PHASE_WAIT] = "wait",
+    [AMCSH_PHASE_HISTORY] = "history",
+};
+
+uint64_t amcsh_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < SUB_COUNT) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int group = msb - SUB_BITS + 1;
+    int step = (int)(value >> (msb - SUB_BITS)) & (SUB_COUNT - 1);
+    return group * SUB_COUNT + step;
+}
+
+static uint64_t bucket_lower(int index) {
+    int group = index / SUB_COUNT;
+    uint64_t step = index % SUB_COUNT;
+    return group == 0 ? step : (SUB_COUNT + step) << (group - 1);
+}
+
+static uint64_t bucket_upper(int index) {
+    int group = index / SUB_COUNT;
+    return bucket_lower(index) + (group == 0 ? 0 : (1ull << (group - 1)) - 1);
+}
+
+// Lock-free: history is recorded from its own thread
+void amcsh_trace_record(amcsh_phase_t phase, uint64_t ns) {
+    histogram_t *h = &histograms[phase];
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket_index(ns)], 1, memory_order_relaxed);
+
+    uint_fast64_t seen = atomic_load_explicit(&h->min, memory_order_relaxed);
+    while ((seen == 0 || ns < seen) &&
+           !atomic_compare_exchange_weak_explicit(&h->min, &seen, ns ? ns : 1,
+                                                  memory_order_relaxed, memory_order_relaxed));
+    seen = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while (ns > seen &&
+           !atomic_compare_exchange_weak_explicit(&h->max, &seen, ns,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+void amcsh_trace_reset(void) {
+    memset(histograms, 0, sizeof(histograms));
+}
+
+// Upper bound of the bucket holding the given quantile, capped at the maximum
+static uint64_t quantile(histogram_t *h, uint64_t count, double q) {
+    uint64_t rank = (uint64_t)(q * count + 0.5);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+            return upper < max ? upper : max;
+        }
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+// One line per phase, with the non-empty buckets as [lower, upper, count]
+void amcsh_trace_write_json(FILE *out) {
+    for (int p = 0; p < AMCSH_PHASE_COUNT; p++) {
+        histogram_t *h = &histograms[p];
+        uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+        fprintf(out, "{\"pid\":%d,\"phase\":\"%s\",\"count\":%llu,\"sum_ns\":%llu,"
+                "\"min_ns\":%llu,\"max_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+                "\"p99_ns\":%llu,\"buckets\":[",
+                (int)getpid(), phase_names[p], (unsigned long long)count,
+                (unsigned long long)atomic_load_explicit(&h->sum, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&h->min, memory_order_relaxed),
+                (unsigned long long)atomic_load_explicit(&h->max, memory_order_relaxed),
+                (unsigned long long)(count ? quantile(h, count, 0.50) : 0),
+                (unsigned long long)(count ? quantile(h, count, 0.90) : 0),
+                (unsigned long long)(count ? quantile(h, count, 0.99) : 0));
+        bool first = true;
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            uint64_t n = atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+            if (n) {
+                fprintf(out, "%s[%llu,%llu,%llu]", first ? "" : ",",
+                        (unsigned long long)bucket_lower(i),
+                        (unsigned long long)bucket_upper(i), (unsigned long long)n);
+                first = false;
+            }
+        }
+        fprintf(out, "]}\n");
+    }
+}
+
+static void trace_dump(void) {
+    const char *path = getenv("AMCSH_TRACE_FILE");
+    // Forked children exit through here too; only the shell itself reports
+    if (!path || !*path || getpid() != trace_pid) {
+        return;
+    }
+    FILE *out = fopen(path, "a");
+    if (!out) {
+        perror("amcsh: AMCSH_TRACE_FILE");
+        return;
+    }
+    amcsh_trace_write_json(out);
+    fclose(out);
+}
+
+void amcsh_trace_init(void) {
+    trace_pid = getpid();
+    atexit(trace_dump);
+}
+
+static void print_duration(uint64_t ns) {
+    if (ns < 10000) {
+        amcsh_printf(" %8lluns", (unsigned long long)ns);
+    } else if (ns < 10000000) {
+        amcsh_printf(" %8.1fus", ns / 1e3);
+    } else if (ns < 10000000000ull) {
+        amcsh_printf(" %8.1fms", ns / 1e6);
+    } else {
+        amcsh_printf(" %8.2fs ", ns / 1e9);
+    }
+}
+
+// "amcsh-stats [-r] [-j]": latency per phase; -j prints JSON lines, -r clears
+int amcsh_builtin_stats(char **args) {
+    bool json = false, reset = false;
+    for (int i = 1; args[i]; i++) {
+        if (strcmp(args[i], "-j") == 0) {
+            json = true;
+        } else if (strcmp(args[i], "-r") == 0) {
+            reset = true;
+        } else {
+            fprintf(stderr, "amcsh: amcsh-stats: %s: invalid option\n", args[i]);
+            return 2;
+        }
+    }
+
+#ifndef AMCSH_TRACE
+    if (!reset) {
+        fprintf(stderr, "amcsh: amcsh-stats: built without AMCSH_TRACE\n");
+        return 1;
+    }
+#endif
+
+    if (json) {
+        char *text = NULL;
+        size_t len = 0;
+        FILE *out = open_memstream(&text, &len);
+        if (out) {
+            amcsh_trace_write_json(out);
+            fclose(out);
+            amcsh_write(text, len);
+            free(text);
+        }
+    } else if (!reset) {
+        amcsh_printf("%-8s %8s %10s %10s %10s %10s %10s\n",
+                     "phase", "count", "mean", "p50", "p90", "p99", "max");
+        for (int p = 0; p < AMCSH_PHASE_COUNT; p++) {
+            histogram_t *h = &histograms[p];
+            uint64_t count = atomic_load_explicit(&h->count, memory_order_relaxed);
+            amcsh_printf("%-8s %8llu", phase_names[p], (unsigned long long)count);
+            if (count) {
+                print_duration(atomic_load_explicit(&h->sum, memory_order_relaxed) / count);
+                print_duration(quantile(h, count, 0.50));
+                print_duration(quantile(h, count, 0.90));
+                print_duration(quantile(h, count, 0.99));
+                print_duration(atomic_load_explicit(&h->max, memory_order_relaxed));
+            }
+            amcsh_putc('\n');
+        }
+    }
+
+    if (reset) {
+        amcsh_trace_reset();
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+// Build-time generator for the builtin perfect hash table.
+// Finds a seed for amcsh_builtin_hash() with no collisions among the names
+// in builtins.def and writes the seed and slot table as a C header.
+#include "builtins.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *names[] = {
+#define AMCSH_BUILTIN(name, func, flags, summary, usage) name,
+#define AMCSH_PREFIX(name, func, flags, summary, usage) name,
+#include "builtins.def"
+#undef AMCSH_BUILTIN
+#undef AMCSH_PREFIX
+};
+
+#define NAME_COUNT ((int)(sizeof(names) / sizeof(names[0])))
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s OUTPUT\n", argv[0]);
+        return 1;
+    }
+
+    // Keep the table at most a quarter full so a seed turns up quickly
+    unsigned int size = 16;
+    while (size < (unsigned int)NAME_COUNT * 4) size *= 2;
+
+    short *slots = malloc(size * sizeof(short));
+    uint32_t seed;
+    for (seed = 1; seed != 0; seed++) {
+        memset(slots, 0xff, size * sizeof(short));
+        int i;
+        for (i = 0; i < NAME_COUNT; i++) {
+            uint32_t slot = amcsh_builtin_hash(names[i], seed) & (size - 1);
+            if (slots[slot] >= 0) break;
+            slots[slot] = (short)i;
+        }
+        if (i == NAME_COUNT) break;
+    }
+    if (seed == 0) {
+        fprintf(stderr, "gen_builtin_hash: no collision-free seed found\n");
+        return 1;
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by gen_builtin_hash from builtins.def - do not edit\n");
+    fprintf(out, "#ifndef AMCSH_BUILTIN_HASH_H\n#define AMCSH_BUILTIN_HASH_H\n\n");
+    fprintf(out, "#define AMCSH_BUILTIN_HASH_SEED 0x%08xu\n", seed);
+    fprintf(out, "#define AMCSH_BUILTIN_HASH_SIZE %uu\n\n", size);
+    fprintf(out, "// Slot -> index into amcsh_builtins[], -1 when empty\n");
+    fprintf(out, "static const short amcsh_builtin_slots[AMCSH_BUILTIN_HASH_SIZE] = {");
+    for (unsigned int i = 0; i < size; i++) {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", slots[i]);
+    }
+    fprintf(out, "\n};\n\n#endif\n");
+
+    free(slots);
+    return fclose(out) == 0 ? 0 : 1;
+}